@@ -15,7 +15,9 @@
 #include    "report.h"
 #include    "section.h"
 #include    "stdint.h"
+#include    "strtab.h"
 #include    "symbol.h"
+#include    "write.h"
 #include    "write7x.h"
 
 void aout_adjust_code (void) {
@@ -48,7 +50,12 @@ void aout_adjust_code (void) {
 
 }
 
-static int output_relocation (FILE *outfile, struct fixup *fixup, unsigned long start_address_of_section) {
+/** a.out has no room for sections other than .text, .data and .bss. */
+int aout_supports_section (section_t section) {
+    return (section == text_section || section == data_section || section == bss_section);
+}
+
+static int fill_relocation (unsigned char *p, struct fixup *fixup, unsigned long start_address_of_section) {
 
     struct relocation_info reloc;
     
@@ -66,29 +73,15 @@ static int output_relocation (FILE *outfile, struct fixup *fixup, unsigned long
         } else if (symbol_get_section (fixup->add_symbol) == bss_section) {
             r_symbolnum = N_BSS;
         } else {
+        
             report_at (__FILE__, __LINE__, REPORT_INTERNAL_ERROR, "invalid section %s", section_get_name (symbol_get_section (fixup->add_symbol)));
+            return 1;
+        
         }
     
     } else {
     
-        struct symbol *symbol;
-        int32_t symbol_number;
-        
-        for (symbol = symbols, symbol_number = 0; symbol && (symbol != fixup->add_symbol); symbol = symbol->next) {
-        
-            if (symbol_is_section_symbol (symbol)) {
-                continue;
-            }
-            
-            if (!state->keep_locals && *symbol->name == 'L') {
-                continue;
-            }
-            
-            symbol_number++;
-        
-        }
-        
-        r_symbolnum  = symbol_number;
+        r_symbolnum  = symbol_get_symbol_table_index (fixup->add_symbol);
         r_symbolnum |= 1L << 27;
     
     }
@@ -101,196 +94,181 @@ static int output_relocation (FILE *outfile, struct fixup *fixup, unsigned long
     r_symbolnum |= (uint32_t) log2_of_size << 25;
     
     write741_to_byte_array (reloc.r_symbolnum, r_symbolnum);
-    
-    if (fwrite (&reloc, sizeof (reloc), 1, outfile) != 1) {
-    
-        report_at (NULL, 0, REPORT_ERROR, "Error writing text relocations!");
-        return 1;
-    
-    }
+    memcpy (p, &reloc, sizeof (reloc));
     
     return 0;
 
 }
 
-void aout_write_object (void) {
+static uint32_t get_section_size (section_t section) {
 
-    struct exec header;
     struct frag *frag;
+    uint32_t size = 0;
     
-    struct fixup *fixup;
-    unsigned long start_address_of_data;
-    
-    struct symbol *symbol;
-    unsigned long symbol_table_size;
-    
-    int32_t string_table_pos;
-    FILE *outfile;
+    for (frag = section_get_frag_chain (section)->first_frag; frag; frag = frag->next) {
+        size += frag->fixed_size;
+    }
     
-    uint32_t a_text, a_data, a_bss;
-    uint32_t a_trsize, a_drsize;
+    return size;
+
+}
+
+static uint32_t get_section_relocation_count (section_t section) {
+
+    struct frag_chain *frag_chain = section_get_frag_chain (section);
+    struct fixup *fixup;
     
-    memset (&header, 0, sizeof (header));
-    write741_to_byte_array (header.a_info, 0x00640000 | OMAGIC);
+    uint32_t count = 0;
     
-    if ((outfile = fopen (state->outfile, "wb")) == NULL) {
+    for (fixup = frag_chain->fixups; fixup < frag_chain->fixups + frag_chain->nb_fixups; fixup++) {
     
-        report_at (NULL, 0, REPORT_ERROR, "Failed to open '%s' as output file", state->outfile);
-        return;
+        if (!fixup->done) {
+            count++;
+        }
     
     }
     
-    if (fseek (outfile, sizeof (header), SEEK_SET)) {
-    
-        report_at (NULL, 0, REPORT_ERROR, "Failed whilst seeking passed header");
-        return;
-    
-    }
+    return count;
+
+}
+
+/** Builds the relocation entries of section; returns NULL after reporting an internal error. */
+static unsigned char *build_relocations (section_t section, unsigned long start_address_of_section) {
+
+    struct frag_chain *frag_chain = section_get_frag_chain (section);
+    struct fixup *fixup;
     
-    section_set (text_section);
-    a_text = 0;
+    unsigned char *relocations, *p;
+    relocations = p = xmalloc (get_section_relocation_count (section) * sizeof (struct relocation_info) + 1);
     
-    for (frag = current_frag_chain->first_frag; frag; frag = frag->next) {
+    for (fixup = frag_chain->fixups; fixup < frag_chain->fixups + frag_chain->nb_fixups; fixup++) {
     
-        if (frag->fixed_size == 0) {
+        if (fixup->done) {
             continue;
         }
         
-        if (fwrite (frag->buf, frag->fixed_size, 1, outfile) != 1) {
+        if (fill_relocation (p, fixup, start_address_of_section)) {
         
-            report_at (NULL, 0, REPORT_ERROR, "Failed whilst writing text!");
-            return;
+            free (relocations);
+            return NULL;
         
         }
         
-        a_text += frag->fixed_size;
+        p += sizeof (struct relocation_info);
     
     }
     
-    write741_to_byte_array (header.a_text, a_text);
+    return relocations;
+
+}
+
+static const char *get_symbol_name_prefix (struct symbol *symbol) {
+
+    struct hashtab_name *key;
+    const char *prefix = NULL;
     
-    section_set (data_section);
-    a_data = 0;
+    if (!state->sym_start) {
+        return NULL;
+    }
     
-    for (frag = current_frag_chain->first_frag; frag; frag = frag->next) {
+    if (symbol_is_external (symbol)) {
+        return state->sym_start;
+    }
     
-        if (frag->fixed_size == 0) {
-            continue;
-        }
-        
-        if (fwrite (frag->buf, frag->fixed_size, 1, outfile) != 1) {
-        
-            report_at (NULL, 0, REPORT_ERROR, "Failed whilst writing data!");
-            return;
-        
+    if (symbol_is_undefined (symbol) && (key = hashtab_alloc_name (symbol->name)) != NULL) {
+    
+        if (hashtab_get (&state->hashtab_externs, key) != NULL) {
+            prefix = state->sym_start;
         }
         
-        a_data += frag->fixed_size;
+        free (key);
     
     }
     
-    write741_to_byte_array (header.a_data, a_data);
+    return prefix;
+
+}
+
+static int symbol_is_written (struct symbol *symbol) {
+
+    if (symbol_is_section_symbol (symbol)) {
+        return 0;
+    }
     
-    section_set (bss_section);
-    a_bss = 0;
+    return state->keep_locals || *symbol->name != 'L';
+
+}
+
+/**
+ * All the sizes in the header are known and every entry is built before
+ * anything is written, so the file is handed to object_blocks_write as
+ * blocks at fixed offsets.
+ */
+void aout_write_object (void) {
+
+    struct exec header;
     
-    for (frag = current_frag_chain->first_frag; frag; frag = frag->next) {
+    unsigned char *text_relocations, *data_relocations, *symbol_table;
+    struct object_blocks blocks = { 0 };
     
-        if (frag->fixed_size == 0) {
-            continue;
-        }
-        
-        a_bss += frag->fixed_size;
+    struct symbol *symbol;
+    unsigned long symbol_table_size, nb_symbols, i;
     
-    }
+    struct strtab strtab;
+    unsigned long *name_indices;
     
-    write741_to_byte_array (header.a_bss, a_bss);
+    unsigned char string_table_size[4];
+    FILE *outfile;
     
-    section_set (text_section);
-    a_trsize = 0;
+    memset (&header, 0, sizeof (header));
+    write741_to_byte_array (header.a_info, 0x00640000 | OMAGIC);
     
-    for (fixup = current_frag_chain->first_fixup; fixup; fixup = fixup->next) {
+    write741_to_byte_array (header.a_text, get_section_size (text_section));
+    write741_to_byte_array (header.a_data, get_section_size (data_section));
+    write741_to_byte_array (header.a_bss, get_section_size (bss_section));
     
-        struct relocation_info reloc;
-        
-        if (fixup->done) {
-            continue;
-        }
-        
-        if (output_relocation (outfile, fixup, 0)) {
-            return;
-        }
-        
-        a_trsize += sizeof (reloc);
+    write741_to_byte_array (header.a_trsize, get_section_relocation_count (text_section) * sizeof (struct relocation_info));
+    write741_to_byte_array (header.a_drsize, get_section_relocation_count (data_section) * sizeof (struct relocation_info));
     
-    }
+    /* Numbers the written symbols for the relocations and interns their names. */
+    for (symbol = symbols, nb_symbols = 0; symbol; symbol = symbol_next (symbol)) {
     
-    write741_to_byte_array (header.a_trsize, a_trsize);
+        if (symbol_is_written (symbol)) {
+            symbol_set_symbol_table_index (symbol, nb_symbols++);
+        }
     
-    section_set (data_section);
-    a_drsize = 0;
+    }
     
-    start_address_of_data = current_frag_chain->first_frag->address;
+    name_indices = xmalloc (sizeof (*name_indices) * (nb_symbols + 1));
+    strtab_init (&strtab, 4);
     
-    for (fixup = current_frag_chain->first_fixup; fixup; fixup = fixup->next) {
+    for (symbol = symbols, i = 0; symbol; symbol = symbol_next (symbol)) {
     
-        struct relocation_info reloc;
-        
-        if (fixup->done) {
-            continue;
+        if (symbol_is_written (symbol)) {
+            name_indices[i++] = strtab_add (&strtab, get_symbol_name_prefix (symbol), symbol->name);
         }
-        
-        if (output_relocation (outfile, fixup, start_address_of_data)) {
-            return;
-        }
-        
-        a_drsize += sizeof (reloc);
     
     }
     
-    write741_to_byte_array (header.a_drsize, a_drsize);
+    strtab_finalize (&strtab);
+    write741_to_byte_array (string_table_size, 4 + strtab.size);
+    
+    symbol_table_size = nb_symbols * sizeof (struct nlist);
+    write741_to_byte_array (header.a_syms, symbol_table_size);
     
-    symbol_table_size = 0;
-    string_table_pos = 4;
+    /* Every entry is built before the file is opened, so that the blocks can be written in any order. */
+    symbol_table = xmalloc (symbol_table_size + 1);
     
-    for (symbol = symbols; symbol; symbol = symbol->next) {
+    for (symbol = symbols, i = 0; symbol; symbol = symbol_next (symbol)) {
     
         struct nlist symbol_entry;
         memset (&symbol_entry, 0, sizeof (symbol_entry));
         
-        if (symbol_is_section_symbol (symbol)) {
+        if (!symbol_is_written (symbol)) {
             continue;
         }
         
-        if (!state->keep_locals && *symbol->name == 'L') {
-            continue;
-        }
-        
-        write741_to_byte_array (symbol_entry.n_strx, string_table_pos);
-        
-        if (state->sym_start) {
-        
-            if (symbol_is_external (symbol)) {
-                string_table_pos++;
-            } else if (symbol_is_undefined (symbol)) {
-            
-                struct hashtab_name *key;
-                
-                if ((key = hashtab_alloc_name (symbol->name)) != NULL) {
-                
-                    if (hashtab_get (&state->hashtab_externs, key) != NULL) {
-                        string_table_pos++;
-                    }
-                    
-                    free (key);
-                
-                }
-            
-            }
-        
-        }
-        
-        string_table_pos += strlen (symbol->name) + 1;
+        write741_to_byte_array (symbol_entry.n_strx, strtab_get_offset (&strtab, name_indices[i]));
         
         if (symbol->section == undefined_section) {
             symbol_entry.n_type = N_UNDF;
@@ -305,100 +283,44 @@ void aout_write_object (void) {
         } else {
         
             report_at (__FILE__, __LINE__, REPORT_INTERNAL_ERROR, "invalid section %s", section_get_name (symbol->section));
-            exit (EXIT_FAILURE);
+            break;
         
         }
         
         symbol_entry.n_type |= N_EXT;
         write741_to_byte_array (symbol_entry.n_value, symbol_get_value (symbol));
         
-        if (fwrite (&symbol_entry, sizeof (symbol_entry), 1, outfile) != 1) {
-        
-            report_at (NULL, 0, REPORT_ERROR, "Error writing symbol table!");
-            return;
-        
-        }
-        
-        symbol_table_size += sizeof (symbol_entry);
+        memcpy (symbol_table + i++ * sizeof (symbol_entry), &symbol_entry, sizeof (symbol_entry));
     
     }
     
-    write741_to_byte_array (header.a_syms, symbol_table_size);
-    
-    if (fwrite (&string_table_pos, sizeof (string_table_pos), 1, outfile) != 1) {
-    
-        report_at (NULL, 0, REPORT_ERROR, "Failed to write string table!");
-        return;
-    
-    }
+    text_relocations = (symbol ? NULL : build_relocations (text_section, 0));
+    data_relocations = (text_relocations ? build_relocations (data_section, section_get_frag_chain (data_section)->first_frag->address) : NULL);
     
-    for (symbol = symbols; symbol; symbol = symbol->next) {
+    if (data_relocations) {
     
-        if (symbol_is_section_symbol (symbol)) {
-            continue;
-        }
-        
-        if (!state->keep_locals && *symbol->name == 'L') {
-            continue;
-        }
-        
-        if (state->sym_start) {
-        
-            if (symbol_is_external (symbol)) {
-            
-                if (fwrite (state->sym_start, strlen (state->sym_start), 1, outfile) != 1) {
-                
-                    report_at (NULL, 0, REPORT_ERROR, "Failed to write string table!");
-                    return;
-                
-                }
-            
-            } else if (symbol_is_undefined (symbol)) {
-            
-                struct hashtab_name *key;
-                
-                if ((key = hashtab_alloc_name (symbol->name)) != NULL) {
-                
-                    if (hashtab_get (&state->hashtab_externs, key) != NULL) {
-                    
-                        if (fwrite (state->sym_start, strlen (state->sym_start), 1, outfile) != 1) {
-                        
-                            report_at (NULL, 0, REPORT_ERROR, "Failed to write string table!");
-                            return;
-                        
-                        }
-                    
-                    }
-                    
-                    free (key);
-                
-                }
-            
-            }
-        
-        }
-        
-        if (fwrite (symbol->name, strlen (symbol->name) + 1, 1, outfile) != 1) {
-        
-            report_at (NULL, 0, REPORT_ERROR, "Failed to write string table!");
-            return;
+        object_blocks_add (&blocks, &header, sizeof (header), "Failed to write header!", NULL);
+        object_blocks_add (&blocks, section_get_frag_chain (text_section)->image, section_get_frag_chain (text_section)->image_size, "Failed whilst writing text!", NULL);
+        object_blocks_add (&blocks, section_get_frag_chain (data_section)->image, section_get_frag_chain (data_section)->image_size, "Failed whilst writing data!", NULL);
+        object_blocks_add (&blocks, text_relocations, get_section_relocation_count (text_section) * sizeof (struct relocation_info), "Error writing text relocations!", NULL);
+        object_blocks_add (&blocks, data_relocations, get_section_relocation_count (data_section) * sizeof (struct relocation_info), "Error writing text relocations!", NULL);
+        object_blocks_add (&blocks, symbol_table, symbol_table_size, "Error writing symbol table!", NULL);
+        object_blocks_add (&blocks, string_table_size, 4, "Failed to write string table!", NULL);
+        object_blocks_add (&blocks, strtab.blob, strtab.size, "Failed to write string table!", NULL);
         
+        if ((outfile = open_object_file ()) != NULL && !object_blocks_write (&blocks, outfile) && close_object_file (outfile)) {
+            report_at (NULL, 0, REPORT_ERROR, "Failed to close file!");
         }
     
     }
     
-    rewind (outfile);
-    
-    if (fwrite (&header, sizeof (header), 1, outfile) != 1) {
+    free (data_relocations);
+    free (text_relocations);
+    free (symbol_table);
+    free (name_indices);
     
-        report_at (NULL, 0, REPORT_ERROR, "Failed to write header!");
-        return;
-    
-    }
-    
-    if (fclose (outfile)) {
-        report_at (NULL, 0, REPORT_ERROR, "Failed to close file!");
-    }
+    object_blocks_free (&blocks);
+    strtab_free (&strtab);
 
 }
 
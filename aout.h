@@ -4,6 +4,8 @@
 #ifndef     _AOUT_H
 #define     _AOUT_H
 
+#include    "types.h"
+
 #define     SEGMENT_SIZE                0x10000UL
 
 struct exec {
@@ -76,6 +78,8 @@ struct nlist {
 
 #define     N_GETMAGIC(exec)            ((exec).a_info & 0xffff)
 
+int aout_supports_section (section_t section);
+
 void aout_adjust_code (void);
 void aout_write_object (void);
 void install_aout_pseudo_ops (void);
@@ -9,6 +9,7 @@
 #include    "aout.h"
 #include    "as.h"
 #include    "coff.h"
+#include    "depend.h"
 #include    "intel.h"
 #include    "lib.h"
 #include    "listing.h"
@@ -17,17 +18,16 @@
 #include    "pseudo_ops.h"
 #include    "report.h"
 #include    "section.h"
+#include    "trace.h"
 #include    "write.h"
 
 static struct object_format obj_fmts[] = {
 
-    { "a.out",      install_aout_pseudo_ops,    aout_adjust_code,   aout_write_object   },
-    { "coff",       install_coff_pseudo_ops,    0,                  coff_write_object   }
+    { "a.out",      install_aout_pseudo_ops,    aout_adjust_code,   aout_write_object,  aout_supports_section   },
+    { "coff",       install_coff_pseudo_ops,    0,                  coff_write_object,  0                       }
 
 };
 
-static struct object_format *obj_fmt = 0;
-
 struct as_state *state = 0;
 const char *program_name = 0;
 
@@ -58,9 +58,57 @@ static void handle_defines (void) {
 
 }
 
+static void print_stats (void) {
+
+    unsigned long lookups, probes;
+    hashtab_get_stats (&lookups, &probes);
+    
+    fprintf (stderr, "hash tables: %lu lookups, %lu probes", lookups, probes);
+    
+    if (lookups) {
+        fprintf (stderr, " (%lu.%02lu per lookup)", probes / lookups, ((probes % lookups) * 100) / lookups);
+    }
+    
+    fprintf (stderr, "\n");
+    
+    machine_dependent_print_stats (stderr);
+    write_print_stats (stderr);
+    trace_print_stats (stderr);
+    mem_print_stats (stderr);
+
+}
+
+static void print_stats_json (void) {
+
+    unsigned long lookups, probes;
+    FILE *fp;
+    
+    if ((fp = fopen (state->stats_json, "w")) == NULL) {
+    
+        report_at (NULL, 0, REPORT_ERROR, "failed to open '%s' for writing", state->stats_json);
+        return;
+    
+    }
+    
+    hashtab_get_stats (&lookups, &probes);
+    fprintf (fp, "{\n    \"hash_tables\": { \"lookups\": %lu, \"probes\": %lu }", lookups, probes);
+    
+    machine_dependent_print_stats_json (fp);
+    write_print_stats_json (fp);
+    trace_print_stats_json (fp);
+    mem_print_stats_json (fp);
+    
+    fprintf (fp, "\n}\n");
+    
+    if (fclose (fp)) {
+        report_at (NULL, 0, REPORT_ERROR, "failed to write '%s'", state->stats_json);
+    }
+
+}
+
 int main (int argc, char **argv) {
 
-    unsigned long i;
+    unsigned long i, j;
     
     if (argc && *argv) {
     
@@ -83,25 +131,32 @@ int main (int argc, char **argv) {
     
     }
     
-    for (i = 0; i < ARRAY_SIZE (obj_fmts); ++i) {
+    for (i = 0; i < state->nb_outputs; ++i) {
     
-        if (xstrcasecmp (obj_fmts[i].name, state->format) == 0) {
+        struct output *output = state->outputs[i];
+        
+        for (j = 0; j < ARRAY_SIZE (obj_fmts); ++j) {
         
-            obj_fmt = &obj_fmts[i];
-            break;
+            if (xstrcasecmp (obj_fmts[j].name, output->format) == 0) {
+            
+                output->obj_fmt = &obj_fmts[j];
+                break;
+            
+            }
+        
+        }
+        
+        if (!output->obj_fmt) {
+        
+            report_at (program_name, 0, REPORT_INTERNAL_ERROR, "failed to obtain format %s", output->format);
+            return EXIT_FAILURE;
         
         }
     
     }
     
-    if (!obj_fmt) {
-    
-        report_at (program_name, 0, REPORT_INTERNAL_ERROR, "failed to obtain format %s", state->format);
-        return EXIT_FAILURE;
-    
-    }
-    
-    obj_fmt->install_pseudo_ops ();
+    /* The sources are parsed once for all outputs, using the pseudo-ops of the first format. */
+    state->outputs[0]->obj_fmt->install_pseudo_ops ();
     
     machine_dependent_init ();
     pseudo_ops_init ();
@@ -124,12 +179,33 @@ int main (int argc, char **argv) {
     
     }
     
-    write_object_file (obj_fmt);
+    write_object_file ();
+    
+    generate_dependencies ();
     generate_listing ();
     
+    report_flush ();
+    
+    if (state->stats) {
+        print_stats ();
+    }
+    
+    if (state->stats_json) {
+        print_stats_json ();
+    }
+    
+    trace_write ();
+    
     if (get_error_count () > 0) {
     
-        remove (state->outfile);
+        for (i = 0; i < state->nb_outputs; ++i) {
+            remove (state->outputs[i]->filename);
+        }
+        
+        if (state->dep_file) {
+            remove (state->dep_file);
+        }
+        
         return EXIT_FAILURE;
     
     }
@@ -22,7 +22,15 @@ struct seg {
 
 };
 
+struct output {
+
+    const char *format, *filename;
+    struct object_format *obj_fmt;
+
+};
+
 #include    "hashtab.h"
+#include    "types.h"
 
 struct as_state {
 
@@ -31,6 +39,14 @@ struct as_state {
     
     const char *format, *listing, *outfile;
     int nowarn, model, keep_locals;
+    int encoding_cache, optimize, stats, write_if_changed;
+    unsigned long error_limit, warning_limit, jobs;
+    
+    const char *dep_file, *diag_json, *relax_hints, *stats_json, *trace;
+    int make_deps, dep_phony;
+    
+    struct output **outputs;
+    unsigned long nb_outputs;
     
     const char *sym_start, *end_sym;
     struct vector procs, segs;
@@ -50,6 +66,9 @@ struct object_format {
     void (*install_pseudo_ops) (void);
     void (*adjust_code) (void);
     void (*write_object) (void);
+    
+    /* Returns zero for a section the format cannot write; null if every section can be written. */
+    int (*supports_section) (section_t section);
 
 };
 
@@ -14,17 +14,21 @@
 #include    "report.h"
 #include    "section.h"
 #include    "stdint.h"
+#include    "strtab.h"
 #include    "symbol.h"
+#include    "write.h"
 #include    "write7x.h"
 
-static int output_relocation (FILE *outfile, struct fixup *fixup) {
+/** Builds the relocation entry of fixup at p; returns 1 after reporting an internal error. */
+static int fill_relocation (unsigned char *p, struct fixup *fixup) {
 
     struct relocation_entry reloc_entry;
+    memset (&reloc_entry, 0, sizeof (reloc_entry));
     
     if (fixup->add_symbol == NULL) {
     
         report_at (__FILE__, __LINE__, REPORT_INTERNAL_ERROR, "+++output relocation fixup->add_symbol is NULL");
-        exit (EXIT_FAILURE);
+        return 1;
     
     }
     
@@ -61,7 +65,7 @@ static int output_relocation (FILE *outfile, struct fixup *fixup) {
                 default:
                 
                     report_at (__FILE__, __LINE__, REPORT_INTERNAL_ERROR, "unsupported COFF relocation size %i for reloc_type RELOC_TYPE_DEFAULT", fixup->size);
-                    exit (EXIT_FAILURE);
+                    return 1;
             
             }
             
@@ -78,10 +82,7 @@ static int output_relocation (FILE *outfile, struct fixup *fixup) {
     
     }
     
-    if (fwrite (&reloc_entry, RELOCATION_ENTRY_SIZE, 1, outfile) != 1) {
-        return 1;
-    }
-    
+    memcpy (p, &reloc_entry, RELOCATION_ENTRY_SIZE);
     return 0;
 
 }
@@ -133,6 +134,99 @@ static unsigned long translate_section_flags_to_Characteristics (unsigned int fl
 
 }
 
+static void fill_symbol_table_entry (struct symbol *symbol, struct symbol_table_entry *sym_tbl_ent) {
+
+    if (symbol_get_object_format_dependent_data (symbol) == NULL) {
+        
+        memset (sym_tbl_ent, 0, sizeof (*sym_tbl_ent));
+
+        write741_to_byte_array (sym_tbl_ent->Value, symbol_get_value (symbol));
+        
+        if (symbol->section == undefined_section) {
+            write721_to_byte_array (sym_tbl_ent->SectionNumber, IMAGE_SYM_UNDEFINED);
+        } else {
+            write721_to_byte_array (sym_tbl_ent->SectionNumber, section_get_number (symbol->section));
+        }
+    
+        write721_to_byte_array (sym_tbl_ent->Type, ((IMAGE_SYM_DTYPE_NULL << 8) | IMAGE_SYM_TYPE_NULL));
+        
+        if (symbol_is_external (symbol) || symbol_is_undefined (symbol)) {
+            sym_tbl_ent->StorageClass[0] = IMAGE_SYM_CLASS_EXTERNAL;
+        } else if (symbol_is_section_symbol (symbol)) {
+            sym_tbl_ent->StorageClass[0] = IMAGE_SYM_CLASS_STATIC;
+        } else if (symbol_get_section (symbol) == text_section) {
+            sym_tbl_ent->StorageClass[0] = IMAGE_SYM_CLASS_LABEL;
+        } else {
+            sym_tbl_ent->StorageClass[0] = IMAGE_SYM_CLASS_STATIC;
+        }
+        
+        sym_tbl_ent->NumberOfAuxSymbols[0] = 0;
+
+    } else {
+
+        *sym_tbl_ent = *(struct symbol_table_entry *) symbol_get_object_format_dependent_data (symbol);
+
+        write741_to_byte_array (sym_tbl_ent->Value, symbol_get_value (symbol));
+
+        if (!GET_UINT16 (sym_tbl_ent->SectionNumber)) {
+
+            if (symbol->section == undefined_section) {
+                write721_to_byte_array (sym_tbl_ent->SectionNumber, IMAGE_SYM_UNDEFINED);
+            } else {
+                write721_to_byte_array (sym_tbl_ent->SectionNumber, section_get_number (symbol->section));
+            }
+
+        }
+
+        if (!GET_UINT16 (sym_tbl_ent->Type)) {
+            write721_to_byte_array (sym_tbl_ent->Type, ((IMAGE_SYM_DTYPE_NULL << 8) | IMAGE_SYM_TYPE_NULL));
+        }
+
+        if (GET_UINT16 (sym_tbl_ent->SectionNumber) == IMAGE_SYM_UNDEFINED) {
+            sym_tbl_ent->StorageClass[0] = IMAGE_SYM_CLASS_EXTERNAL;
+        } else if (sym_tbl_ent->StorageClass[0] == IMAGE_SYM_CLASS_STATIC && symbol_is_external (symbol)) {
+            sym_tbl_ent->StorageClass[0] = IMAGE_SYM_CLASS_EXTERNAL;
+        } else if (!sym_tbl_ent->StorageClass[0]) {
+
+            if (symbol_is_external (symbol)) {
+                sym_tbl_ent->StorageClass[0] = IMAGE_SYM_CLASS_EXTERNAL;
+            } else if (symbol_is_section_symbol (symbol)) {
+                sym_tbl_ent->StorageClass[0] = IMAGE_SYM_CLASS_STATIC;
+            } else if (symbol_get_section (symbol) == text_section) {
+                sym_tbl_ent->StorageClass[0] = IMAGE_SYM_CLASS_LABEL;
+            } else {
+                sym_tbl_ent->StorageClass[0] = IMAGE_SYM_CLASS_STATIC;
+            }
+
+        }
+
+    }
+
+}
+
+static const char *get_symbol_name_prefix (struct symbol *symbol) {
+
+    if (state->sym_start && (symbol_is_external (symbol) || symbol_is_undefined (symbol))) {
+        return state->sym_start;
+    }
+    
+    return NULL;
+
+}
+
+static void write_long_name_offset (char *Name, unsigned long offset) {
+
+    memset (Name, 0, 4);
+    write741_to_byte_array ((unsigned char *) Name + 4, offset);
+
+}
+
+/**
+ * The whole layout (section data, symbol table, string table and
+ * relocations) is computed first, so the headers can be filled in
+ * before anything is written and the file is handed to
+ * object_blocks_write as blocks at fixed offsets.
+ */
 void coff_write_object (void) {
 
     struct coff_header header;
@@ -141,319 +235,237 @@ void coff_write_object (void) {
     FILE *outfile;
     section_t section;
     
-    uint32_t string_table_size = 4;
+    struct strtab strtab;
+    unsigned long *name_indices, *section_name_indices, i;
+    
+    unsigned char string_table_size[4];
     uint32_t NumberOfSymbols = 0;
     
-    sections_number (1);
-    memset (&header, 0, sizeof (header));
+    unsigned char *symbol_table, **relocations, *p;
+    unsigned long *relocations_sizes;
     
-    if ((outfile = fopen (state->outfile, "wb")) == NULL) {
+    struct object_blocks blocks = { 0 };
     
-        report_at (NULL, 0, REPORT_ERROR, "Failed to open '%s' as output file", state->outfile);
-        return;
+    unsigned long offset;
+    int failed = 0;
     
-    }
+    sections_number (1);
+    memset (&header, 0, sizeof (header));
     
     write721_to_byte_array (header.Machine, IMAGE_FILE_MACHINE_I386);
     write721_to_byte_array (header.NumberOfSections, sections_get_count ());
     write721_to_byte_array (header.SizeOfOptionalHeader, 0);
     write721_to_byte_array (header.Characteristics, IMAGE_FILE_LINE_NUMS_STRIPPED | IMAGE_FILE_32BIT_MACHINE);
     
-    if (fseek (outfile, (sizeof (header) + sections_get_count () * sizeof (struct section_table_entry)), SEEK_SET)) {
-    
-        report_at (NULL, 0, REPORT_ERROR, "Failed to fseek");
-        return;
-    
-    }
-    
-    if (state->sym_start) {
-    
-        for (symbol = symbols; symbol; symbol = symbol->next) {
-        
-            if (symbol_is_external (symbol) || symbol_is_undefined (symbol)) {
-            
-                char *name = xmalloc (strlen (state->sym_start) + strlen (symbol->name) + 1);
-                sprintf (name, "%s%s", state->sym_start, symbol->name);
-                
-                symbol->name = name;
-            
-            }
-        
-        }
-    
-    }
+    offset = sizeof (header) + sections_get_count () * sizeof (struct section_table_entry);
     
     for (section = sections; section; section = section_get_next_section (section)) {
     
+        struct frag_chain *frag_chain = section_get_frag_chain (section);
+        struct frag *frag;
+        
         uint32_t SizeOfRawData = 0;
         
         struct section_table_entry *section_header = xmalloc (sizeof (*section_header));
         section_set_object_format_dependent_data (section, section_header);
         
         memset (section_header, 0, sizeof (*section_header));
-        strcpy (section_header->Name, section_get_name (section));
+        
+        if (strlen (section_get_name (section)) <= 8) {
+            memcpy (section_header->Name, section_get_name (section), strlen (section_get_name (section)));
+        }
         
         write741_to_byte_array (section_header->Characteristics, translate_section_flags_to_Characteristics (section_get_flags (section)));
         
-        if (section != bss_section) {
+        for (frag = frag_chain->first_frag; frag; frag = frag->next) {
+            SizeOfRawData += frag->fixed_size;
+        }
         
-            struct frag *frag;
-            section_set (section);
-            
-            write741_to_byte_array (section_header->PointerToRawData, ftell (outfile));
-            write741_to_byte_array (section_header->SizeOfRawData, 0);
-            
-            for (frag = current_frag_chain->first_frag; frag; frag = frag->next) {
-            
-                if (frag->fixed_size == 0) {
-                    continue;
-                }
-                
-                if (fwrite (frag->buf, frag->fixed_size, 1, outfile) != 1) {
-                
-                    report_at (NULL, 0, REPORT_ERROR, "Failed whilst writing secton '%s'!", section_get_name (section));
-                    return;
-                
-                }
-                
-                SizeOfRawData += frag->fixed_size;
-            
-            }
-            
-            write741_to_byte_array (section_header->SizeOfRawData, SizeOfRawData);
-            
-            if (SizeOfRawData == 0) {
-                write741_to_byte_array (section_header->PointerToRawData, 0);
-            }
+        write741_to_byte_array (section_header->SizeOfRawData, SizeOfRawData);
         
-        } else {
+        if (section != bss_section && SizeOfRawData) {
         
-            struct frag *frag;
-            section_set (section);
-            
-            write741_to_byte_array (section_header->PointerToRawData, 0);
-            write741_to_byte_array (section_header->SizeOfRawData, 0);
-            
-            for (frag = current_frag_chain->first_frag; frag; frag = frag->next) {
-            
-                if (frag->fixed_size == 0) {
-                    continue;
-                }
-                
-                SizeOfRawData += frag->fixed_size;
-            
-            }
-            
-            write741_to_byte_array (section_header->SizeOfRawData, SizeOfRawData);
+            write741_to_byte_array (section_header->PointerToRawData, offset);
+            offset += SizeOfRawData;
         
         }
     
     }
     
-    write741_to_byte_array (header.PointerToSymbolTable, ftell (outfile));
-    write741_to_byte_array (header.NumberOfSymbols, 0);
+    write741_to_byte_array (header.PointerToSymbolTable, offset);
     
-    for (symbol = symbols; symbol; symbol = symbol->next) {
+    for (symbol = symbols; symbol; symbol = symbol_next (symbol)) {
     
-        struct symbol_table_entry sym_tbl_ent;
-        
-        if (symbol->object_format_dependent_data == NULL) {
-            
-            memset (&sym_tbl_ent, 0, sizeof (sym_tbl_ent));
-
-            write741_to_byte_array (sym_tbl_ent.Value, symbol_get_value (symbol));
-            
-            if (symbol->section == undefined_section) {
-                write721_to_byte_array (sym_tbl_ent.SectionNumber, IMAGE_SYM_UNDEFINED);
-            } else {
-                write721_to_byte_array (sym_tbl_ent.SectionNumber, section_get_number (symbol->section));
-            }
-        
-            write721_to_byte_array (sym_tbl_ent.Type, ((IMAGE_SYM_DTYPE_NULL << 8) | IMAGE_SYM_TYPE_NULL));
-            
-            if (symbol_is_external (symbol) || symbol_is_undefined (symbol)) {
-                sym_tbl_ent.StorageClass[0] = IMAGE_SYM_CLASS_EXTERNAL;
-            } else if (symbol_is_section_symbol (symbol)) {
-                sym_tbl_ent.StorageClass[0] = IMAGE_SYM_CLASS_STATIC;
-            } else if (symbol_get_section (symbol) == text_section) {
-                sym_tbl_ent.StorageClass[0] = IMAGE_SYM_CLASS_LABEL;
-            } else {
-                sym_tbl_ent.StorageClass[0] = IMAGE_SYM_CLASS_STATIC;
-            }
-            
-            sym_tbl_ent.NumberOfAuxSymbols[0] = 0;
-
-        } else {
-
-            sym_tbl_ent = *(struct symbol_table_entry *)(symbol->object_format_dependent_data);
-
-            write741_to_byte_array (sym_tbl_ent.Value, symbol_get_value (symbol));
-
-            if (!GET_UINT16 (sym_tbl_ent.SectionNumber)) {
-
-                if (symbol->section == undefined_section) {
-                    write721_to_byte_array (sym_tbl_ent.SectionNumber, IMAGE_SYM_UNDEFINED);
-                } else {
-                    write721_to_byte_array (sym_tbl_ent.SectionNumber, section_get_number (symbol->section));
-                }
-
-            }
-
-            if (!GET_UINT16 (sym_tbl_ent.Type)) {
-                write721_to_byte_array (sym_tbl_ent.Type, ((IMAGE_SYM_DTYPE_NULL << 8) | IMAGE_SYM_TYPE_NULL));
-            }
-
-            if (GET_UINT16 (sym_tbl_ent.SectionNumber) == IMAGE_SYM_UNDEFINED) {
-                sym_tbl_ent.StorageClass[0] = IMAGE_SYM_CLASS_EXTERNAL;
-            } else if (sym_tbl_ent.StorageClass[0] == IMAGE_SYM_CLASS_STATIC && symbol_is_external (symbol)) {
-                sym_tbl_ent.StorageClass[0] = IMAGE_SYM_CLASS_EXTERNAL;
-            } else if (!sym_tbl_ent.StorageClass[0]) {
-
-                if (symbol_is_external (symbol)) {
-                    sym_tbl_ent.StorageClass[0] = IMAGE_SYM_CLASS_EXTERNAL;
-                } else if (symbol_is_section_symbol (symbol)) {
-                    sym_tbl_ent.StorageClass[0] = IMAGE_SYM_CLASS_STATIC;
-                } else if (symbol_get_section (symbol) == text_section) {
-                    sym_tbl_ent.StorageClass[0] = IMAGE_SYM_CLASS_LABEL;
-                } else {
-                    sym_tbl_ent.StorageClass[0] = IMAGE_SYM_CLASS_STATIC;
-                }
-
-            }
-
-        }
-        
-        symbol->write_name_to_string_table = 0;
-        
-        if (strlen (symbol->name) <= 8) {
-            memcpy (sym_tbl_ent.Name, symbol->name, strlen (symbol->name));
-        } else {
-        
-            memset (sym_tbl_ent.Name, 0, 4);
-            
-            sym_tbl_ent.Name[4] = string_table_size & 0xff;
-            sym_tbl_ent.Name[5] = (string_table_size >> 8) & 0xff;
-            sym_tbl_ent.Name[6] = (string_table_size >> 16) & 0xff;
-            sym_tbl_ent.Name[7] = (string_table_size >> 24) & 0xff;
-            
-            string_table_size += strlen (symbol->name) + 1;
-            symbol->write_name_to_string_table = 1;
-        
-        }
-        
-        if (fwrite (&sym_tbl_ent, SYMBOL_TABLE_ENTRY_SIZE, 1, outfile) != 1) {
-        
-            report_at (NULL, 0, REPORT_ERROR, "Error writing symbol table!");
-            return;
-        
-        }
-        
         symbol_set_symbol_table_index (symbol, NumberOfSymbols);
         NumberOfSymbols++;
     
     }
     
     write741_to_byte_array (header.NumberOfSymbols, NumberOfSymbols);
+    offset += NumberOfSymbols * SYMBOL_TABLE_ENTRY_SIZE;
     
-    if (fwrite (&string_table_size, 4, 1, outfile) != 1) {
+    /* Names longer than eight characters go to the string table, including section names. */
+    name_indices = xmalloc (sizeof (*name_indices) * (NumberOfSymbols + 1));
+    strtab_init (&strtab, 4);
     
-        report_at (NULL, 0, REPORT_ERROR, "Failed to write string table!");
-        return;
+    for (symbol = symbols, i = 0; symbol; symbol = symbol_next (symbol), i++) {
+    
+        const char *prefix = get_symbol_name_prefix (symbol);
+        
+        if ((prefix ? strlen (prefix) : 0) + strlen (symbol->name) > 8) {
+            name_indices[i] = strtab_add (&strtab, prefix, symbol->name);
+        }
     
     }
     
-    for (section = sections; section; section = section_get_next_section (section)) {
-
+    section_name_indices = xmalloc (sizeof (*section_name_indices) * (sections_get_count () + 1));
+    
+    for (section = sections, i = 0; section; section = section_get_next_section (section), i++) {
+    
+        if (strlen (section_get_name (section)) > 8) {
+            section_name_indices[i] = strtab_add (&strtab, NULL, section_get_name (section));
+        }
+    
+    }
+    
+    strtab_finalize (&strtab);
+    
+    /* Long section names are written as "/" followed by the decimal offset. */
+    for (section = sections, i = 0; section; section = section_get_next_section (section), i++) {
+    
+        struct section_table_entry *section_header = section_get_object_format_dependent_data (section);
+        char name[16];
+        
         if (strlen (section_get_name (section)) > 8) {
-
-            if (fwrite (section_get_name (section), strlen (section_get_name (section)) + 1, 1, outfile) != 1) {
-            
-                report_at (NULL, 0, REPORT_ERROR, "Failed to write string table!");
-                return;
-            
-            }
+        
+            sprintf (name, "/%lu", strtab_get_offset (&strtab, section_name_indices[i]));
+            memcpy (section_header->Name, name, strlen (name) > 8 ? 8 : strlen (name));
         
         }
-
+    
     }
     
-    for (symbol = symbols; symbol; symbol = symbol->next) {
+    write741_to_byte_array (string_table_size, 4 + strtab.size);
+    
+    offset += 4 + strtab.size;
     
-        if (symbol->write_name_to_string_table) {
+    /* Every entry is built before the file is opened, so that the blocks can be written in any order. */
+    symbol_table = xmalloc (NumberOfSymbols * SYMBOL_TABLE_ENTRY_SIZE + 1);
+    
+    for (symbol = symbols, i = 0; symbol; symbol = symbol_next (symbol), i++) {
+    
+        struct symbol_table_entry sym_tbl_ent;
         
-            if (fwrite (symbol->name, strlen (symbol->name) + 1, 1, outfile) != 1) {
-            
-                report_at (NULL, 0, REPORT_ERROR, "Failed to write string table!");
-                return;
-            
-            }
+        const char *prefix = get_symbol_name_prefix (symbol);
+        unsigned long prefix_length = prefix ? strlen (prefix) : 0;
+        
+        fill_symbol_table_entry (symbol, &sym_tbl_ent);
+        
+        if (prefix_length + strlen (symbol->name) <= 8) {
+        
+            memcpy (sym_tbl_ent.Name, prefix, prefix_length);
+            memcpy (sym_tbl_ent.Name + prefix_length, symbol->name, strlen (symbol->name));
         
+        } else {
+            write_long_name_offset (sym_tbl_ent.Name, strtab_get_offset (&strtab, name_indices[i]));
         }
+        
+        memcpy (symbol_table + i * SYMBOL_TABLE_ENTRY_SIZE, &sym_tbl_ent, SYMBOL_TABLE_ENTRY_SIZE);
     
     }
     
-    for (section = sections; section; section = section_get_next_section (section)) {
+    relocations = xmalloc (sizeof (*relocations) * (sections_get_count () + 1));
+    relocations_sizes = xmalloc (sizeof (*relocations_sizes) * (sections_get_count () + 1));
+    
+    for (section = sections, i = 0; section; section = section_get_next_section (section), i++) {
     
         struct section_table_entry *section_header = section_get_object_format_dependent_data (section);
+        struct frag_chain *frag_chain = section_get_frag_chain (section);
         struct fixup *fixup;
         
         uint32_t NumberOfRelocations = 0;
         
-        write741_to_byte_array (section_header->PointerToRelocations, ftell (outfile));
-        write741_to_byte_array (section_header->NumberOfRelocations, 0);
+        for (fixup = frag_chain->fixups; fixup < frag_chain->fixups + frag_chain->nb_fixups; fixup++) {
+        
+            if (!fixup->done) {
+                NumberOfRelocations++;
+            }
+        
+        }
+        
+        write741_to_byte_array (section_header->NumberOfRelocations, NumberOfRelocations);
+        
+        if (NumberOfRelocations) {
+        
+            write741_to_byte_array (section_header->PointerToRelocations, offset);
+            offset += NumberOfRelocations * RELOCATION_ENTRY_SIZE;
+        
+        }
         
-        section_set (section);
+        relocations_sizes[i] = NumberOfRelocations * RELOCATION_ENTRY_SIZE;
+        relocations[i] = p = xmalloc (relocations_sizes[i] + 1);
         
-        for (fixup = current_frag_chain->first_fixup; fixup; fixup = fixup->next) {
+        for (fixup = frag_chain->fixups; fixup < frag_chain->fixups + frag_chain->nb_fixups; fixup++) {
         
             if (fixup->done) {
                 continue;
             }
             
-            if (output_relocation (outfile, fixup)) {
-            
-                report_at (NULL, 0, REPORT_ERROR, "Failed to write relocation!");
-                return;
-            
+            if (fill_relocation (p, fixup)) {
+                failed = 1;
             }
             
-            NumberOfRelocations++;
-        
-        }
-        
-        write741_to_byte_array (section_header->NumberOfRelocations, NumberOfRelocations);
+            p += RELOCATION_ENTRY_SIZE;
         
-        if (NumberOfRelocations == 0) {
-            write741_to_byte_array (section_header->PointerToRelocations, 0);
         }
     
     }
     
-    rewind (outfile);
-    
-    if (fwrite (&header, sizeof (header), 1, outfile) != 1) {
-    
-        report_at (NULL, 0, REPORT_ERROR, "Failed to write header!");
-        return;
-    
-    }
-    
-    for (section = sections; section; section = section_get_next_section (section)) {
+    if (!failed) {
     
-        struct section_table_entry *section_header = section_get_object_format_dependent_data (section);
+        object_blocks_add (&blocks, &header, sizeof (header), "Failed to write header!", NULL);
         
-        if (fwrite (section_header, sizeof (*section_header), 1, outfile) != 1) {
+        for (section = sections; section; section = section_get_next_section (section)) {
+            object_blocks_add (&blocks, section_get_object_format_dependent_data (section), sizeof (struct section_table_entry), "Failed to write header!", NULL);
+        }
         
-            report_at (NULL, 0, REPORT_ERROR, "Failed to write header!");
-            return;
+        for (section = sections; section; section = section_get_next_section (section)) {
+        
+            struct frag_chain *frag_chain = section_get_frag_chain (section);
+            
+            if (section != bss_section && frag_chain->image_size) {
+                object_blocks_add (&blocks, frag_chain->image, frag_chain->image_size, "Failed whilst writing secton '%s'!", section_get_name (section));
+            }
         
         }
+        
+        object_blocks_add (&blocks, symbol_table, NumberOfSymbols * SYMBOL_TABLE_ENTRY_SIZE, "Error writing symbol table!", NULL);
+        object_blocks_add (&blocks, string_table_size, 4, "Failed to write string table!", NULL);
+        object_blocks_add (&blocks, strtab.blob, strtab.size, "Failed to write string table!", NULL);
+        
+        for (section = sections, i = 0; section; section = section_get_next_section (section), i++) {
+            object_blocks_add (&blocks, relocations[i], relocations_sizes[i], "Failed to write relocation!", NULL);
+        }
+        
+        if ((outfile = open_object_file ()) != NULL && !object_blocks_write (&blocks, outfile) && close_object_file (outfile)) {
+            report_at (NULL, 0, REPORT_ERROR, "Failed to close file!");
+        }
     
     }
     
-    if (fclose (outfile)) {
-        report_at (NULL, 0, REPORT_ERROR, "Failed to close file!");
+    for (i = 0; i < sections_get_count (); i++) {
+        free (relocations[i]);
     }
+    
+    free (relocations_sizes);
+    free (relocations);
+    free (symbol_table);
+    
+    free (section_name_indices);
+    free (name_indices);
+    
+    object_blocks_free (&blocks);
+    strtab_free (&strtab);
 
 }
 
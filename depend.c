@@ -0,0 +1,158 @@
+/******************************************************************************
+ * @file            depend.c
+ *****************************************************************************/
+#include    <stddef.h>
+#include    <stdio.h>
+#include    <stdlib.h>
+#include    <string.h>
+
+#include    "as.h"
+#include    "depend.h"
+#include    "hashtab.h"
+#include    "lib.h"
+#include    "report.h"
+
+static char **dependencies = NULL;
+static unsigned long nb_dependencies = 0;
+
+static struct hashtab hashtab_dependencies = { 0 };
+
+static int is_source_file (const char *filename) {
+
+    unsigned long i;
+    
+    for (i = 0; i < state->nb_files; ++i) {
+    
+        if (strcmp (state->files[i], filename) == 0) {
+            return 1;
+        }
+    
+    }
+    
+    return 0;
+
+}
+
+/** Writes a file name so that make reads it back unchanged. */
+static void write_escaped_filename (FILE *f, const char *filename) {
+
+    const char *p;
+    
+    for (p = filename; *p; ++p) {
+    
+        if (*p == ' ' || *p == '\t' || *p == '#') {
+            fputc ('\\', f);
+        } else if (*p == '$') {
+            fputc ('$', f);
+        }
+        
+        fputc (*p, f);
+    
+    }
+
+}
+
+void add_dependency (const char *filename) {
+
+    struct hashtab_name *key;
+    char *name;
+    
+    if (!state->dep_file) {
+        return;
+    }
+    
+    name = xstrdup (filename);
+    
+    if ((key = hashtab_alloc_name (name)) == NULL) {
+    
+        free (name);
+        return;
+    
+    }
+    
+    if (hashtab_get (&hashtab_dependencies, key) != NULL) {
+    
+        free (key);
+        free (name);
+        
+        return;
+    
+    }
+    
+    if (hashtab_put (&hashtab_dependencies, key, name) < 0) {
+    
+        free (key);
+        free (name);
+        
+        return;
+    
+    }
+    
+    dynarray_add (&dependencies, &nb_dependencies, name);
+
+}
+
+/**
+ * Every output depends on every file that was read, so one rule lists
+ * all of the outputs as targets.  With -MP each included file also gets
+ * an empty rule so that make does not fail once it has been deleted.
+ */
+void generate_dependencies (void) {
+
+    unsigned long i;
+    FILE *f;
+    
+    if (!state->dep_file) {
+        return;
+    }
+    
+    if ((f = fopen (state->dep_file, "w")) == NULL) {
+    
+        report_at (NULL, 0, REPORT_ERROR, "Unable to open '%s' as dependency file", state->dep_file);
+        return;
+    
+    }
+    
+    for (i = 0; i < state->nb_outputs; ++i) {
+    
+        if (i > 0) {
+            fputc (' ', f);
+        }
+        
+        write_escaped_filename (f, state->outputs[i]->filename);
+    
+    }
+    
+    fputc (':', f);
+    
+    for (i = 0; i < nb_dependencies; ++i) {
+    
+        fprintf (f, " \\\n  ");
+        write_escaped_filename (f, dependencies[i]);
+    
+    }
+    
+    fputc ('\n', f);
+    
+    if (state->dep_phony) {
+    
+        for (i = 0; i < nb_dependencies; ++i) {
+        
+            if (is_source_file (dependencies[i])) {
+                continue;
+            }
+            
+            fputc ('\n', f);
+            
+            write_escaped_filename (f, dependencies[i]);
+            fprintf (f, ":\n");
+        
+        }
+    
+    }
+    
+    if (fclose (f) != 0) {
+        report_at (NULL, 0, REPORT_ERROR, "Failed to write dependency file '%s'", state->dep_file);
+    }
+
+}
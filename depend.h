@@ -0,0 +1,10 @@
+/******************************************************************************
+ * @file            depend.h
+ *****************************************************************************/
+#ifndef     _DEPEND_H
+#define     _DEPEND_H
+
+void add_dependency (const char *filename);
+void generate_dependencies (void);
+
+#endif      /* _DEPEND_H */
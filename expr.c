@@ -13,6 +13,7 @@
 #include    "intel.h"
 #include    "lex.h"
 #include    "lib.h"
+#include    "macro.h"
 #include    "report.h"
 #include    "section.h"
 #include    "symbol.h"
@@ -151,8 +152,6 @@ static void integer_constant (char **pp, struct expr *expr, uint32_t radix) {
 
 }
 
-extern struct hashtab hashtab_macros;
-
 extern const char is_end_of_line[];
 extern char get_symbol_name_end (char **pp);
 
@@ -161,7 +160,6 @@ static section_t operand (char **pp, struct expr *expr, enum expr_mode expr_mode
     section_t ret_section;
     char c, *temp;
     
-    struct hashtab_name *key;
     char *entry;
     
     int double_quotes = 0;
@@ -493,19 +491,15 @@ static section_t operand (char **pp, struct expr *expr, enum expr_mode expr_mode
                 
                 }
                 
-                if ((key = hashtab_alloc_name (name)) != NULL) {
+                if ((entry = find_macro (name)) != NULL) {
                 
-                    if ((entry = (char *) hashtab_get (&hashtab_macros, key)) != NULL) {
+                    char *temp = entry;
+                    ret_section = read_into (&temp, expr, 0, expr_mode);
                     
-                        char *temp = entry;
-                        ret_section = read_into (&temp, expr, 0, expr_mode);
-                        
-                        **pp = c;
-                        
-                        (*pp) = skip_whitespace (*pp);
-                        return ret_section;
+                    **pp = c;
                     
-                    }
+                    (*pp) = skip_whitespace (*pp);
+                    return ret_section;
                 
                 }
                 
@@ -833,8 +827,9 @@ struct symbol *make_expr_symbol (struct expr *expr) {
                                                   	    reg_section :
                                                             expr_section)), 0, &zero_address_frag);
     symbol_set_value_expression (symbol, expr);
+    symbol_account_to (symbol, MEM_EXPR_SYMBOLS);
     
-    es_line = xmalloc (sizeof (*es_line));
+    es_line = xmalloc_for (MEM_EXPR_SYMBOLS, sizeof (*es_line));
     es_line->symbol = symbol;
     
     get_filename_and_line_number (&(es_line->filename), &(es_line->line_number));
@@ -2,6 +2,8 @@
  * @file            fixup.c
  *****************************************************************************/
 #include    <stddef.h>
+#include    <stdlib.h>
+#include    <string.h>
 
 #include    "as.h"
 #include    "expr.h"
@@ -13,9 +15,35 @@
 #include    "symbol.h"
 #include    "types.h"
 
-static struct fixup *fixup_new_internal (struct frag *frag, unsigned long where, int32_t size, struct symbol *add_symbol, long add_number, int pcrel, reloc_type_t reloc_type, int far_call) {
+#define     FIXUPS_REALLOC_STEP         64
 
-    struct fixup *fixup = xmalloc (sizeof (*fixup));
+/**
+ * Fixups are kept in one growable array per frag chain; the returned
+ * pointer is only valid until the next fixup is added to the chain.
+ */
+static struct fixup *fixup_alloc (struct frag_chain *frag_chain) {
+
+    struct fixup *fixup;
+    
+    if (frag_chain->nb_fixups == frag_chain->fixups_capacity) {
+    
+        unsigned long old_capacity = frag_chain->fixups_capacity;
+        
+        frag_chain->fixups_capacity += (frag_chain->fixups_capacity > FIXUPS_REALLOC_STEP) ? frag_chain->fixups_capacity : FIXUPS_REALLOC_STEP;
+        frag_chain->fixups = xrealloc_for (MEM_FIXUPS, frag_chain->fixups, sizeof (*fixup) * old_capacity, sizeof (*fixup) * frag_chain->fixups_capacity);
+    
+    }
+    
+    fixup = &frag_chain->fixups[frag_chain->nb_fixups++];
+    memset (fixup, 0, sizeof (*fixup));
+    
+    return fixup;
+
+}
+
+static struct fixup *fixup_new_internal (struct frag_chain *frag_chain, struct frag *frag, unsigned long where, int32_t size, struct symbol *add_symbol, long add_number, int pcrel, reloc_type_t reloc_type, int far_call) {
+
+    struct fixup *fixup = fixup_alloc (frag_chain);
     
     fixup->frag         = frag;
     fixup->where        = where;
@@ -24,24 +52,18 @@ static struct fixup *fixup_new_internal (struct frag *frag, unsigned long where,
     fixup->add_number   = add_number;
     fixup->pcrel        = pcrel;
     fixup->reloc_type   = reloc_type;
-    fixup->next         = NULL;
     fixup->far_call     = far_call;
     
-    if (current_frag_chain->last_fixup) {
-    
-        current_frag_chain->last_fixup->next = fixup;
-        current_frag_chain->last_fixup = fixup;
-    
-    } else {
-        current_frag_chain->last_fixup = current_frag_chain->first_fixup = fixup;
-    }
-    
     return fixup;
 
 }
 
 struct fixup *fixup_new (struct frag *frag, unsigned long where, int32_t size, struct symbol *add_symbol, long add_number, int pcrel, reloc_type_t reloc_type, int far_call) {
-    return fixup_new_internal (frag, where, size, add_symbol, add_number, pcrel, reloc_type, far_call);
+    return fixup_new_internal (current_frag_chain, frag, where, size, add_symbol, add_number, pcrel, reloc_type, far_call);
+}
+
+struct fixup *fixup_new_in_section (section_t section, struct frag *frag, unsigned long where, int32_t size, struct symbol *add_symbol, long add_number, int pcrel, reloc_type_t reloc_type, int far_call) {
+    return fixup_new_internal (section_get_frag_chain (section), frag, where, size, add_symbol, add_number, pcrel, reloc_type, far_call);
 }
 
 struct fixup *fixup_new_expr (struct frag *frag, unsigned long where, int32_t size, struct expr *expr, int pcrel, reloc_type_t reloc_type, int far_call) {
@@ -82,6 +104,54 @@ struct fixup *fixup_new_expr (struct frag *frag, unsigned long where, int32_t si
         
     }
     
-    return fixup_new_internal (frag, where, size, add_symbol, add_number, pcrel, reloc_type, far_call);
+    return fixup_new_internal (current_frag_chain, frag, where, size, add_symbol, add_number, pcrel, reloc_type, far_call);
+
+}
+
+void fixups_append_frag_chain (struct frag_chain *frag_chain, struct frag_chain *other) {
+
+    unsigned long i;
+    
+    for (i = 0; i < other->nb_fixups; i++) {
+        *fixup_alloc (frag_chain) = other->fixups[i];
+    }
+    
+    mem_account (MEM_FIXUPS, 0, sizeof (*other->fixups) * other->fixups_capacity);
+    free (other->fixups);
+    
+    other->fixups = NULL;
+    other->nb_fixups = other->fixups_capacity = 0;
+
+}
+
+/**
+ * Sorts the fixups by address once relaxation has fixed the frag
+ * addresses.  Fixups are created almost in address order (only the ones
+ * added while relaxing come late), so a stable insertion sort is close
+ * to a single pass.
+ */
+void fixups_sort_by_address (struct frag_chain *frag_chain) {
+
+    struct fixup fixup;
+    unsigned long i, j;
+    
+    for (i = 1; i < frag_chain->nb_fixups; i++) {
+    
+        address_t address = frag_chain->fixups[i].frag->address + frag_chain->fixups[i].where;
+        
+        for (j = i; j > 0 && frag_chain->fixups[j - 1].frag->address + frag_chain->fixups[j - 1].where > address; j--) {
+            ;
+        }
+        
+        if (j == i) {
+            continue;
+        }
+        
+        fixup = frag_chain->fixups[i];
+        memmove (&frag_chain->fixups[j + 1], &frag_chain->fixups[j], sizeof (fixup) * (i - j));
+        
+        frag_chain->fixups[j] = fixup;
+    
+    }
 
 }
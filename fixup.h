@@ -20,13 +20,17 @@ struct fixup {
     int done;
     
     reloc_type_t reloc_type;
-    struct fixup *next;
-    
     int far_call;
 
 };
 
 struct fixup *fixup_new (struct frag *frag, unsigned long where, int32_t size, struct symbol *add_symbol, long add_number, int pcrel, reloc_type_t reloc_type, int far_call);
+struct fixup *fixup_new_in_section (section_t section, struct frag *frag, unsigned long where, int32_t size, struct symbol *add_symbol, long add_number, int pcrel, reloc_type_t reloc_type, int far_call);
 struct fixup *fixup_new_expr (frag_t frag, unsigned long where, int32_t size, expr_t expr, int pcrel, reloc_type_t reloc_type, int far_call);
 
+struct frag_chain;
+
+void fixups_append_frag_chain (struct frag_chain *frag_chain, struct frag_chain *other);
+void fixups_sort_by_address (struct frag_chain *frag_chain);
+
 #endif      /* _FIXUP_H */
@@ -1,7 +1,10 @@
 /******************************************************************************
  * @file            frag.c
  *****************************************************************************/
+#include    <string.h>
+
 #include    "frag.h"
+#include    "intel.h"
 #include    "lib.h"
 #include    "section.h"
 #include    "types.h"
@@ -13,11 +16,32 @@ frag_t current_frag;
 
 struct frag *frag_alloc (void) {
 
-    struct frag *frag = xmalloc (sizeof (*frag));
+    struct frag *frag = xmalloc_for (MEM_FRAGS, sizeof (*frag));
     return frag;
 
 }
 
+struct frag *frag_alloc_chain_first (void) {
+
+    struct frag *frag = frag_alloc ();
+    
+    frag->chain_first = frag;
+    frag->seq = 1;
+    
+    return frag;
+
+}
+
+/**
+ * While the frag chains are still separate, every closed frag keeps its
+ * position in the chain so the distance between two frags is a subtraction.
+ * Once the chains have been merged for writing and relaxation starts
+ * changing sizes, the chains are walked instead.
+ */
+static int frags_have_positions (const struct frag *frag1, const struct frag *frag2) {
+    return !sections_frags_chained () && frag1->chain_first && frag1->chain_first == frag2->chain_first;
+}
+
 int frags_offset_is_fixed (const struct frag *frag1, const struct frag *frag2, offset_t *offset_p) {
 
     const struct frag *frag;
@@ -32,6 +56,28 @@ int frags_offset_is_fixed (const struct frag *frag1, const struct frag *frag2, o
     
     }
     
+    if (frags_have_positions (frag1, frag2)) {
+    
+        if (frag1->seq < frag2->seq) {
+        
+            if (frag2->last_variant_seq >= frag1->seq) {
+                return 0;
+            }
+            
+            *offset_p = offset + (offset_t) (frag2->chain_offset - frag1->chain_offset);
+            return 1;
+        
+        }
+        
+        if (frag1->last_variant_seq >= frag2->seq) {
+            return 0;
+        }
+        
+        *offset_p = offset - (offset_t) (frag1->chain_offset - frag2->chain_offset);
+        return 1;
+    
+    }
+    
     /* Checks if frag2 is after frag1. */
     frag = frag1;
     
@@ -91,6 +137,23 @@ int frags_is_greater_than_offset (value_t offset2, const struct frag *frag2, val
     
     difference = offset2 - offset1;
     
+    if (frags_have_positions (frag1, frag2)) {
+    
+        if (frag1->seq > frag2->seq) {
+            return 0;
+        }
+        
+        difference += frag2->chain_offset - frag1->chain_offset;
+        
+        if (difference == 0) {
+            return 0;
+        }
+        
+        *offset_p = offset2 - offset1 - difference;
+        return 1;
+    
+    }
+    
     for (frag = frag1;;) {
     
         difference += frag->fixed_size;
@@ -117,13 +180,36 @@ int frags_is_greater_than_offset (value_t offset2, const struct frag *frag2, val
 
 }
 
-unsigned char *frag_alloc_space (value_t space) {
+/**
+ * Frags of a chain are laid out one after another in chunks of the
+ * chain's arena.  Only the current frag can grow; when it no longer
+ * fits in its chunk it is copied to a new one, so the frags before it
+ * never move.
+ */
+static void frag_resize (value_t size) {
 
-    if (current_frag->fixed_size + space >= current_frag->size) {
+    if (current_frag->buf == NULL || current_frag->buf + size > current_frag_chain->chunk_end) {
+    
+        value_t chunk_size = (size * 2 > FRAG_CHUNK_SIZE) ? size * 2 : FRAG_CHUNK_SIZE;
+        unsigned char *chunk = xmalloc_for (MEM_FRAG_BUFFERS, chunk_size);
+        
+        if (current_frag->size) {
+            memcpy (chunk, current_frag->buf, current_frag->size);
+        }
+        
+        current_frag->buf = chunk;
+        current_frag_chain->chunk_end = chunk + chunk_size;
     
-        current_frag->size += ((space > FRAG_BUF_REALLOC_STEP) ? space : FRAG_BUF_REALLOC_STEP);
-        current_frag->buf   = xrealloc (current_frag->buf, current_frag->size);
+    }
     
+    current_frag->size = size;
+
+}
+
+unsigned char *frag_alloc_space (value_t space) {
+
+    if (current_frag->fixed_size + space >= current_frag->size) {
+        frag_resize (current_frag->size + ((space > FRAG_BUF_REALLOC_STEP) ? space : FRAG_BUF_REALLOC_STEP));
     }
     
     return current_frag->buf + current_frag->fixed_size;
@@ -145,7 +231,13 @@ unsigned char *finished_frag_increase_fixed_size_by_frag_offset (struct frag *fr
 
     if (frag->fixed_size > frag->size) {
         
-        frag->buf = xrealloc (frag->buf, frag->fixed_size);
+        unsigned char *buf = xmalloc_for (MEM_FRAG_BUFFERS, frag->fixed_size);
+        
+        if (frag->size) {
+            memcpy (buf, frag->buf, frag->size);
+        }
+        
+        frag->buf = buf;
         frag->size = frag->fixed_size;
 
     }
@@ -163,6 +255,10 @@ void frag_align (offset_t alignment, int fill_char, offset_t max_bytes_to_skip)
 void frag_align_code (offset_t alignment, offset_t max_bytes_to_skip) {
 
     (frag_alloc_space (1 << alignment))[0] = 0x90;
+    
+    current_frag->code_bits = machine_dependent_get_bits ();
+    current_frag->code_cpu = machine_dependent_get_cpu ();
+    
     frag_set_as_variant (RELAX_TYPE_ALIGN_CODE, (relax_subtype_t) max_bytes_to_skip, NULL, alignment, 0, 0);
 
 }
@@ -170,10 +266,7 @@ void frag_align_code (offset_t alignment, offset_t max_bytes_to_skip) {
 void frag_append_1_char (unsigned char ch) {
 
     if (current_frag->fixed_size == current_frag->size) {
-    
-        current_frag->size += FRAG_BUF_REALLOC_STEP;
-        current_frag->buf   = xrealloc (current_frag->buf, current_frag->size);
-    
+        frag_resize (current_frag->size + FRAG_BUF_REALLOC_STEP);
     }
     
     current_frag->buf[current_frag->fixed_size++] = ch;
@@ -188,11 +281,37 @@ void frag_new (void) {
     current_frag->relax_type = RELAX_TYPE_NONE_NEEDED;
     current_frag->next = NULL;
     
+    if (prev_frag->buf) {
+        current_frag->buf = prev_frag->buf + prev_frag->size;
+    }
+    
+    current_frag->chain_first = prev_frag->chain_first;
+    current_frag->seq = prev_frag->seq + 1;
+    current_frag->chain_offset = prev_frag->chain_offset + prev_frag->fixed_size;
+    
+    if (prev_frag->relax_type != RELAX_TYPE_NONE_NEEDED) {
+        current_frag->last_variant_seq = prev_frag->seq;
+    } else {
+        current_frag->last_variant_seq = prev_frag->last_variant_seq;
+    }
+    
     prev_frag->next = current_frag;
     current_frag_chain->last_frag = current_frag;
 
 }
 
+/**
+ * Starts a new frag after the current one without making the current one
+ * variant.  Its fixed size may still be reduced while the new frag is
+ * empty, so the frags after it do not count on its size either.
+ */
+void frag_new_after_shrinkable (void) {
+
+    frag_new ();
+    current_frag->last_variant_seq = current_frag->seq - 1;
+
+}
+
 void frag_set_as_variant (relax_type_t relax_type, relax_subtype_t relax_subtype, struct symbol *symbol, offset_t offset, value_t opcode_offset_in_buf, int far_call) {
 
     current_frag->relax_type           = relax_type;
@@ -207,3 +326,31 @@ void frag_set_as_variant (relax_type_t relax_type, relax_subtype_t relax_subtype
     frag_new ();
 
 }
+
+void frag_chain_compact (struct frag_chain *frag_chain) {
+
+    struct frag *frag;
+    unsigned char *p;
+    
+    frag_chain->image_size = 0;
+    
+    for (frag = frag_chain->first_frag; frag; frag = frag->next) {
+        frag_chain->image_size += frag->fixed_size;
+    }
+    
+    frag_chain->image = p = (frag_chain->image_size ? xmalloc_for (MEM_FRAG_BUFFERS, frag_chain->image_size) : NULL);
+    
+    for (frag = frag_chain->first_frag; frag; frag = frag->next) {
+    
+        if (frag->fixed_size) {
+            memcpy (p, frag->buf, frag->fixed_size);
+        }
+        
+        frag->buf = p;
+        frag->size = frag->fixed_size;
+        
+        p += frag->fixed_size;
+    
+    }
+
+}
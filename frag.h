@@ -26,15 +26,32 @@ struct frag {
     
     int relax_marker, far_call, symbol_seen;
     frag_t next;
+    
+    /* Mode and cpu level the padding of a RELAX_TYPE_ALIGN_CODE frag is made for. */
+    int code_bits, code_cpu;
+    
+    /**
+     * Position within the frag chain while the source is being read:
+     * the first frag of the chain, a sequence number starting at 1, the
+     * number of fixed bytes in the frags before this one and the sequence
+     * number of the last variant frag before this one (0 if none).
+     */
+    frag_t chain_first;
+    unsigned long seq, last_variant_seq;
+    value_t chain_offset;
 
 };
 
 #define     FRAG_BUF_REALLOC_STEP       16
+#define     FRAG_CHUNK_SIZE             4096
+
+struct frag_chain;
 
 extern struct frag zero_address_frag;
 extern frag_t current_frag;
 
 struct frag *frag_alloc (void);
+struct frag *frag_alloc_chain_first (void);
 
 int frags_offset_is_fixed (const struct frag *frag1, const struct frag *frag2, offset_t *offset_p);
 int frags_is_greater_than_offset (value_t offset2, const struct frag *frag2, value_t offset1, const struct frag *frag1, offset_t *offset_p);
@@ -46,7 +63,9 @@ unsigned char *finished_frag_increase_fixed_size_by_frag_offset (struct frag *fr
 void frag_align (offset_t alignment, int fill_char, offset_t max_bytes_to_skip);
 void frag_align_code (offset_t alignment, offset_t max_bytes_to_skip);
 void frag_append_1_char (unsigned char ch);
+void frag_chain_compact (struct frag_chain *frag_chain);
 void frag_new (void);
+void frag_new_after_shrinkable (void);
 void frag_set_as_variant (relax_type_t relax_type, relax_subtype_t relax_subtype, struct symbol *symbol, offset_t offset, value_t opcode_offset_in_buf, int far_call);
 
 #endif      /* _FRAG_H */
@@ -0,0 +1,417 @@
+/******************************************************************************
+ * @file            hashbench.c
+ *****************************************************************************/
+#include    <stddef.h>
+#include    <stdio.h>
+#include    <stdlib.h>
+#include    <string.h>
+#include    <time.h>
+
+#include    "hashtab.h"
+#include    "lib.h"
+
+/**
+ * Compares hashtab.c with the table it replaced (kept below as old_*,
+ * unchanged apart from the names and a probe counter) on workloads
+ * shaped like the assembler's: many symbols, a fixed set of mnemonics
+ * looked up for every line, and macros that are defined and removed
+ * again as scopes open and close.  Each workload looks up present and
+ * absent names alike and reports probes per lookup and lookups per
+ * second for both tables.  The old table emptied removed slots outright,
+ * so after removals it can miss keys that are present; a line saying
+ * that the results differ shows when that happened.
+ *
+ * Built with "make -f Makefile.unix hashbench".
+ */
+#define     SYMBOLS                     50000
+#define     MACROS                      2000
+
+struct old_hashtab_entry {
+
+    struct hashtab_name *key;
+    void *value;
+
+};
+
+struct old_hashtab {
+
+    struct old_hashtab_entry *entries;
+    unsigned long capacity, count, used;
+
+};
+
+static unsigned long old_lookups = 0;
+static unsigned long old_probes = 0;
+
+static void *bench_alloc (unsigned long size) {
+
+    void *ptr = malloc (size);
+    
+    if (ptr == NULL) {
+    
+        fprintf (stderr, "hashbench: memory full\n");
+        exit (EXIT_FAILURE);
+    
+    }
+    
+    return ptr;
+
+}
+
+/* hashtab.c charges its entry arrays to the heap accounting in lib.c. */
+void mem_account (int category, unsigned long allocated, unsigned long freed) {
+
+    (void) category;
+    (void) allocated;
+    (void) freed;
+
+}
+
+static struct old_hashtab_entry *old_find_entry (struct old_hashtab_entry *entries, unsigned long capacity, struct hashtab_name *key) {
+
+    struct old_hashtab_entry *tombstone = NULL;
+    unsigned long index;
+    
+    ++old_lookups;
+    
+    for (index = key->hash % capacity; ; index = (index + 1) % capacity) {
+    
+        struct old_hashtab_entry *entry = &entries[index];
+        ++old_probes;
+        
+        if (entry->key == NULL) {
+        
+            if (entry->value == NULL) {
+            
+                if (tombstone == NULL) {
+                    return entry;
+                }
+                
+                return tombstone;
+            
+            } else if (tombstone == NULL) {
+                tombstone = entry;
+            }
+        
+        } else if (entry->key->bytes == key->bytes) {
+        
+            if (memcmp (entry->key->chars, key->chars, key->bytes) == 0 && entry->key->hash == key->hash) {
+                return entry;
+            }
+        
+        }
+    
+    }
+
+}
+
+static int old_adjust_capacity (struct old_hashtab *table, unsigned long new_capacity) {
+
+    struct old_hashtab_entry *new_entries, *old_entries;
+    unsigned long i, new_count;
+    
+    if ((new_entries = calloc (new_capacity, sizeof (*new_entries))) == NULL) {
+        return -2;
+    }
+    
+    old_entries = table->entries;
+    new_count = 0;
+    
+    for (i = 0; i < table->capacity; ++i) {
+    
+        struct old_hashtab_entry *entry = &old_entries[i], *dest;
+        
+        if (entry->key == NULL) {
+            continue;
+        }
+        
+        dest = old_find_entry (new_entries, new_capacity, entry->key);
+        
+        dest->key = entry->key;
+        dest->value = entry->value;
+        
+        ++new_count;
+    
+    }
+    
+    free (old_entries);
+    
+    table->capacity = new_capacity;
+    table->count = new_count;
+    table->entries = new_entries;
+    table->used = new_count;
+    
+    return 0;
+
+}
+
+static unsigned long old_hash_string (const void *p, unsigned long length) {
+
+    const unsigned char *str = (const unsigned char *) p;
+    unsigned long i, result = 0;
+    
+    for (i = 0; i < length; ++i) {
+        result = (str[i] << 24) + (result >> 19) + (result << 16) + (result >> 13) + (str[i] << 8) - result;
+    }
+    
+    return result;
+
+}
+
+static void *old_hashtab_get (struct old_hashtab *table, struct hashtab_name *key) {
+
+    struct old_hashtab_entry *entry;
+    
+    if (table->count == 0) {
+        return NULL;
+    }
+    
+    entry = old_find_entry (table->entries, table->capacity, key);
+    return entry->key ? entry->value : NULL;
+
+}
+
+static int old_hashtab_put (struct old_hashtab *table, struct hashtab_name *key, void *value) {
+
+    struct old_hashtab_entry *entry;
+    int ret;
+    
+    if (table->used >= table->capacity / 2) {
+    
+        long capacity = table->capacity * 2 - 1;
+        
+        if (capacity < 15) {
+            capacity = 15;
+        }
+        
+        if ((ret = old_adjust_capacity (table, capacity))) {
+            return ret;
+        }
+    
+    }
+    
+    entry = old_find_entry (table->entries, table->capacity, key);
+    
+    if (entry->key == NULL) {
+    
+        ++table->count;
+        
+        if (entry->value == NULL) {
+            ++table->used;
+        }
+    
+    }
+    
+    entry->key = key;
+    entry->value = value;
+    
+    return 0;
+
+}
+
+/* As before: the slot is emptied outright, which cuts the probe chains running through it. */
+static void old_hashtab_remove (struct old_hashtab *table, struct hashtab_name *key) {
+
+    struct old_hashtab_entry *entry;
+    
+    if ((entry = old_find_entry (table->entries, table->capacity, key)) != NULL) {
+    
+        entry->key = NULL;
+        entry->value = NULL;
+        
+        --table->count;
+    
+    }
+
+}
+
+static const char *mnemonics[] = {
+
+    "aaa", "aad", "aam", "aas", "adc", "add", "and", "arpl", "bound", "bsf", "bsr", "bswap", "bt", "btc", "btr", "bts",
+    "call", "cbw", "cdq", "clc", "cld", "cli", "clts", "cmc", "cmova", "cmovb", "cmove", "cmovne", "cmp", "cmpsb", "cmpsd", "cmpsw",
+    "cmpxchg", "cpuid", "cwd", "cwde", "daa", "das", "dec", "div", "enter", "f2xm1", "fabs", "fadd", "faddp", "fchs", "fcom", "fcomp",
+    "fdiv", "fdivp", "fild", "fist", "fistp", "fld", "fld1", "fldz", "fmul", "fmulp", "fnstsw", "fst", "fstp", "fsub", "fsubp", "fwait",
+    "fxch", "hlt", "idiv", "imul", "in", "inc", "insb", "insd", "insw", "int", "into", "invd", "iret", "iretd", "ja", "jae",
+    "jb", "jbe", "jc", "jcxz", "je", "jecxz", "jg", "jge", "jl", "jle", "jmp", "jna", "jnae", "jnb", "jnbe", "jnc",
+    "jne", "jng", "jnge", "jnl", "jnle", "jno", "jnp", "jns", "jnz", "jo", "jp", "jpe", "jpo", "js", "jz", "lahf",
+    "lar", "lds", "lea", "leave", "les", "lfs", "lgdt", "lgs", "lidt", "lldt", "lmsw", "lock", "lodsb", "lodsd", "lodsw", "loop",
+    "loope", "loopne", "lsl", "lss", "ltr", "mov", "movsb", "movsd", "movsw", "movsx", "movzx", "mul", "neg", "nop", "not", "or",
+    "out", "outsb", "outsd", "outsw", "pop", "popa", "popad", "popf", "popfd", "push", "pusha", "pushad", "pushf", "pushfd", "rcl", "rcr",
+    "rdmsr", "rdtsc", "rep", "repe", "repne", "ret", "retf", "rol", "ror", "sahf", "sal", "sar", "sbb", "scasb", "scasd", "scasw",
+    "seta", "setb", "sete", "setne", "sgdt", "shl", "shld", "shr", "shrd", "sidt", "sldt", "smsw", "stc", "std", "sti", "stosb",
+    "stosd", "stosw", "str", "sub", "test", "verr", "verw", "wait", "wbinvd", "wrmsr", "xadd", "xchg", "xlat", "xor", NULL
+
+};
+
+static struct hashtab_name **make_names (const char *format, unsigned long count) {
+
+    struct hashtab_name **names = bench_alloc (sizeof (*names) * count);
+    unsigned long i;
+    
+    for (i = 0; i < count; ++i) {
+    
+        char *str = bench_alloc (32);
+        sprintf (str, format, i);
+        
+        names[i] = hashtab_alloc_name (str);
+    
+    }
+    
+    return names;
+
+}
+
+/* Gives the names the hash the old table used. */
+static struct hashtab_name **copy_names_old (struct hashtab_name **names, unsigned long count) {
+
+    struct hashtab_name **old_names = bench_alloc (sizeof (*old_names) * count);
+    unsigned long i;
+    
+    for (i = 0; i < count; ++i) {
+    
+        old_names[i] = bench_alloc (sizeof (**old_names));
+        *old_names[i] = *names[i];
+        
+        old_names[i]->hash = old_hash_string (names[i]->chars, names[i]->bytes);
+    
+    }
+    
+    return old_names;
+
+}
+
+struct workload {
+
+    const char *name;
+    unsigned long nb_keys, nb_absent, rounds;
+    
+    /* Every round removes and puts back this many of the keys. */
+    unsigned long churn;
+
+};
+
+static void report_result (const char *table, unsigned long lookups, unsigned long probes, clock_t ticks) {
+
+    double seconds = (double) ticks / CLOCKS_PER_SEC;
+    
+    printf ("  %-4s %6.2f probes/lookup", table, lookups ? (double) probes / lookups : 0.0);
+    
+    if (seconds > 0) {
+        printf (", %7.1fM lookups/s", (double) lookups / seconds / 1000000.0);
+    }
+    
+    printf ("\n");
+
+}
+
+static void run_workload (const struct workload *workload, struct hashtab_name **keys, struct hashtab_name **absent) {
+
+    struct hashtab_name **old_keys = copy_names_old (keys, workload->nb_keys);
+    struct hashtab_name **old_absent = copy_names_old (absent, workload->nb_absent);
+    
+    struct hashtab table = { 0 };
+    struct old_hashtab old_table = { 0 };
+    
+    unsigned long i, round, lookups, probes, start_lookups, start_probes;
+    unsigned long found = 0, old_found = 0;
+    
+    clock_t start;
+    
+    printf ("%s (%lu keys, %lu absent names, %lu rounds):\n", workload->name, workload->nb_keys, workload->nb_absent, workload->rounds);
+    
+    for (i = 0; i < workload->nb_keys; ++i) {
+    
+        hashtab_put (&table, keys[i], keys[i]);
+        old_hashtab_put (&old_table, old_keys[i], old_keys[i]);
+    
+    }
+    
+    start_lookups = old_lookups;
+    start_probes = old_probes;
+    start = clock ();
+    
+    for (round = 0; round < workload->rounds; ++round) {
+    
+        for (i = 0; i < workload->churn; ++i) {
+            old_hashtab_remove (&old_table, old_keys[(round * 7 + i * 3) % workload->nb_keys]);
+        }
+        
+        for (i = 0; i < workload->churn; ++i) {
+            old_hashtab_put (&old_table, old_keys[(round * 7 + i * 3) % workload->nb_keys], old_keys[i]);
+        }
+        
+        for (i = 0; i < workload->nb_keys; ++i) {
+            old_found += (old_hashtab_get (&old_table, old_keys[i]) != NULL);
+        }
+        
+        for (i = 0; i < workload->nb_absent; ++i) {
+            old_found += (old_hashtab_get (&old_table, old_absent[i]) != NULL);
+        }
+    
+    }
+    
+    report_result ("old", old_lookups - start_lookups, old_probes - start_probes, clock () - start);
+    
+    hashtab_get_stats (&start_lookups, &start_probes);
+    start = clock ();
+    
+    for (round = 0; round < workload->rounds; ++round) {
+    
+        for (i = 0; i < workload->churn; ++i) {
+            hashtab_remove (&table, keys[(round * 7 + i * 3) % workload->nb_keys]);
+        }
+        
+        for (i = 0; i < workload->churn; ++i) {
+            hashtab_put (&table, keys[(round * 7 + i * 3) % workload->nb_keys], keys[i]);
+        }
+        
+        for (i = 0; i < workload->nb_keys; ++i) {
+            found += (hashtab_get (&table, keys[i]) != NULL);
+        }
+        
+        for (i = 0; i < workload->nb_absent; ++i) {
+            found += (hashtab_get (&table, absent[i]) != NULL);
+        }
+    
+    }
+    
+    hashtab_get_stats (&lookups, &probes);
+    report_result ("new", lookups - start_lookups, probes - start_probes, clock () - start);
+    
+    if (found != old_found) {
+        printf ("  results differ: old found %lu, new found %lu\n", old_found, found);
+    }
+
+}
+
+int main (void) {
+
+    static const struct workload symbols = { "symbols", SYMBOLS, SYMBOLS, 40, 0 };
+    static const struct workload macros = { "macros", MACROS, MACROS, 1000, MACROS / 4 };
+    
+    struct workload mnemonic = { "mnemonics", 0, 0, 20000, 0 };
+    struct hashtab_name **keys;
+    
+    unsigned long i;
+    
+    keys = make_names ("symbol_%lu", SYMBOLS);
+    run_workload (&symbols, keys, make_names ("L%lu", SYMBOLS));
+    
+    while (mnemonics[mnemonic.nb_keys]) {
+        mnemonic.nb_keys++;
+    }
+    
+    keys = bench_alloc (sizeof (*keys) * mnemonic.nb_keys);
+    
+    for (i = 0; i < mnemonic.nb_keys; ++i) {
+        keys[i] = hashtab_alloc_name (mnemonics[i]);
+    }
+    
+    /* Labels at the start of a line are looked up as mnemonics first. */
+    mnemonic.nb_absent = mnemonic.nb_keys / 4;
+    run_workload (&mnemonic, keys, make_names ("label%lu", mnemonic.nb_absent));
+    
+    run_workload (&macros, make_names ("MACRO_%lu", MACROS), make_names ("ARG%lu", MACROS));
+    return EXIT_SUCCESS;
+
+}
@@ -1,18 +1,55 @@
 /******************************************************************************
  * @file            hashtab.c
  *****************************************************************************/
+#include    <ctype.h>
 #include    <stddef.h>
 #include    <stdlib.h>
 #include    <string.h>
 
 #include    "hashtab.h"
+#include    "lib.h"
+#include    "stdint.h"
 
-static struct hashtab_entry *find_entry (struct hashtab_entry *entries, unsigned long capacity, struct hashtab_name *key);
+/**
+ * Open addressing with linear probing over a power-of-two sized array.
+ * Each slot keeps the hash and length of its key next to the key pointer
+ * so that mismatching slots are rejected without touching the key, and
+ * removal shifts the following entries of the cluster back instead of
+ * leaving tombstones.  The table grows once it is 3/8 full, as linear
+ * probing slows down quickly beyond that, most of all for absent keys.
+ */
+#define     MIN_CAPACITY                16
+
+static unsigned long lookups = 0;
+static unsigned long probes = 0;
+
+static struct hashtab_entry *find_entry (struct hashtab_entry *entries, unsigned long capacity, struct hashtab_name *key) {
+
+    unsigned long mask = capacity - 1, index;
+    
+    ++lookups;
+    
+    for (index = key->hash & mask; ; index = (index + 1) & mask) {
+    
+        struct hashtab_entry *entry = &entries[index];
+        ++probes;
+        
+        if (entry->key == NULL) {
+            return entry;
+        }
+        
+        if (entry->hash == key->hash && entry->bytes == key->bytes && memcmp (entry->key->chars, key->chars, key->bytes) == 0) {
+            return entry;
+        }
+    
+    }
+
+}
 
 static int adjust_capacity (struct hashtab *table, unsigned long new_capacity) {
 
     struct hashtab_entry *new_entries, *old_entries;
-    unsigned long i, new_count, old_capacity;
+    unsigned long i, mask = new_capacity - 1;
     
     if ((new_entries = malloc (sizeof (*new_entries) * new_capacity)) == NULL) {
         return -2;
@@ -20,90 +57,65 @@ static int adjust_capacity (struct hashtab *table, unsigned long new_capacity) {
     
     for (i = 0; i < new_capacity; ++i) {
     
-        struct hashtab_entry *entry = &new_entries[i];
-        
-        entry->key = NULL;
-        entry->value = NULL;
+        new_entries[i].key = NULL;
+        new_entries[i].value = NULL;
     
     }
     
     old_entries = table->entries;
-    old_capacity = table->capacity;
     
-    new_count = 0;
+    for (i = 0; i < table->capacity; ++i) {
     
-    for (i = 0; i < old_capacity; ++i) {
-    
-        struct hashtab_entry *entry = &old_entries[i], *dest;
+        struct hashtab_entry *entry = &old_entries[i];
+        unsigned long index;
         
         if (entry->key == NULL) {
             continue;
         }
         
-        dest = find_entry (new_entries, new_capacity, entry->key);
-        
-        dest->key = entry->key;
-        dest->value = entry->value;
+        /* Keys are unique, so the first free slot is the right one. */
+        for (index = entry->hash & mask; new_entries[index].key; index = (index + 1) & mask) {
+            ;
+        }
         
-        ++new_count;
+        new_entries[index] = *entry;
     
     }
     
     free (old_entries);
+    mem_account (MEM_HASHTABS, sizeof (*new_entries) * new_capacity, sizeof (*old_entries) * table->capacity);
     
     table->capacity = new_capacity;
-    table->count = new_count;
     table->entries = new_entries;
-    table->used = new_count;
     
     return 0;
 
 }
 
-static struct hashtab_entry *find_entry (struct hashtab_entry *entries, unsigned long capacity, struct hashtab_name *key) {
-
-    struct hashtab_entry *tombstone = NULL;
-    unsigned long index;
-    
-    for (index = key->hash % capacity; ; index = (index + 1) % capacity) {
-    
-        struct hashtab_entry *entry = &entries[index];
-        
-        if (entry->key == NULL) {
-        
-            if (entry->value == NULL) {
-            
-                if (tombstone == NULL) {
-                    return entry;
-                }
-                
-                return tombstone;
-            
-            } else if (tombstone == NULL) {
-                tombstone = entry;
-            }
-        
-        } else if (entry->key->bytes == key->bytes) {
-        
-            if (memcmp (entry->key->chars, key->chars, key->bytes) == 0 && entry->key->hash == key->hash) {
-                return entry;
-            }
-        
-        }
-    
-    }
-
-}
-
+/**
+ * FNV-1a over the bytes followed by the MurmurHash3 finalizer, computed
+ * in 32 bits so that the result is the same on every host.
+ */
 static unsigned long hash_string (const void *p, unsigned long length) {
 
     const unsigned char *str = (const unsigned char *) p;
-    unsigned long i, result = 0;
+    uint32_t result = 2166136261UL;
+    
+    unsigned long i;
     
     for (i = 0; i < length; ++i) {
-        result = (str[i] << 24) + (result >> 19) + (result << 16) + (result >> 13) + (str[i] << 8) - result;
+    
+        result ^= str[i];
+        result = (result * 16777619UL) & 0xFFFFFFFFUL;
+    
     }
     
+    result ^= result >> 16;
+    result = (result * 0x85EBCA6BUL) & 0xFFFFFFFFUL;
+    result ^= result >> 13;
+    result = (result * 0xC2B2AE35UL) & 0xFFFFFFFFUL;
+    result ^= result >> 16;
+    
     return result;
 
 }
@@ -111,17 +123,65 @@ static unsigned long hash_string (const void *p, unsigned long length) {
 struct hashtab_name *hashtab_alloc_name (const char *str) {
 
     struct hashtab_name *name;
-    unsigned long bytes = strlen (str), hash = hash_string (str, bytes);
     
     if ((name = malloc (sizeof (*name))) == NULL) {
         return NULL;
     }
     
-    name->bytes = bytes;
+    hashtab_init_name (name, str);
+    return name;
+
+}
+
+/** Fills in a key kept inside another record, so that it needs no allocation of its own. */
+void hashtab_init_name (struct hashtab_name *name, const char *str) {
+
+    name->bytes = strlen (str);
     name->chars = str;
-    name->hash = hash;
+    name->hash = hash_string (str, name->bytes);
+
+}
+
+/**
+ * Looks up str with its letters folded to lower case.  The keyword,
+ * register and mnemonic tables are keyed in lower case, and are searched
+ * for every word of every line, so short names are folded into a buffer
+ * on the stack instead of allocating a copy and a key for each lookup.
+ */
+void *hashtab_get_lowercase (struct hashtab *table, const char *str) {
+
+    char buf[64], *p = buf;
     
-    return name;
+    struct hashtab_name key;
+    unsigned long i, bytes = strlen (str);
+    
+    void *value;
+    
+    if (table == NULL || table->count == 0) {
+        return NULL;
+    }
+    
+    if (bytes >= sizeof (buf) && (p = malloc (bytes + 1)) == NULL) {
+        return NULL;
+    }
+    
+    for (i = 0; i < bytes; ++i) {
+        p[i] = tolower ((unsigned char) str[i]);
+    }
+    
+    p[bytes] = '\0';
+    
+    key.chars = p;
+    key.bytes = bytes;
+    key.hash = hash_string (p, bytes);
+    
+    value = hashtab_get (table, &key);
+    
+    if (p != buf) {
+        free (p);
+    }
+    
+    return value;
 
 }
 
@@ -145,14 +205,12 @@ void *hashtab_get (struct hashtab *table, struct hashtab_name *key) {
 
 int hashtab_put (struct hashtab *table, struct hashtab_name *key, void *value) {
 
-    const long MIN_CAPACITY = 15;
-    
     struct hashtab_entry *entry;
     int ret = 0;
     
-    if (table->used >= table->capacity / 2) {
+    if (table->count >= table->capacity / 2 - table->capacity / 8) {
     
-        long capacity = table->capacity * 2 - 1;
+        unsigned long capacity = table->capacity * 2;
         
         if (capacity < MIN_CAPACITY) {
             capacity = MIN_CAPACITY;
@@ -168,11 +226,10 @@ int hashtab_put (struct hashtab *table, struct hashtab_name *key, void *value) {
     
     if (entry->key == NULL) {
     
-        ++table->count;
+        entry->hash = key->hash;
+        entry->bytes = key->bytes;
         
-        if (entry->value == NULL) {
-            ++table->used;
-        }
+        ++table->count;
     
     }
     
@@ -186,14 +243,49 @@ int hashtab_put (struct hashtab *table, struct hashtab_name *key, void *value) {
 void hashtab_remove (struct hashtab *table, struct hashtab_name *key) {
 
     struct hashtab_entry *entry;
+    unsigned long mask, hole, index, home;
     
-    if ((entry = find_entry (table->entries, table->capacity, key)) != NULL) {
+    if (table == NULL || table->count == 0) {
+        return;
+    }
     
-        entry->key = NULL;
-        entry->value = NULL;
+    if ((entry = find_entry (table->entries, table->capacity, key))->key == NULL) {
+        return;
+    }
+    
+    mask = table->capacity - 1;
+    hole = index = entry - table->entries;
+    
+    for (;;) {
+    
+        index = (index + 1) & mask;
+        
+        if (table->entries[index].key == NULL) {
+            break;
+        }
+        
+        home = table->entries[index].hash & mask;
+        
+        /* Leave the entry alone if its home slot lies after the hole (cyclically). */
+        if (hole <= index ? (hole < home && home <= index) : (hole < home || home <= index)) {
+            continue;
+        }
         
-        --table->count;
+        table->entries[hole] = table->entries[index];
+        hole = index;
     
     }
+    
+    table->entries[hole].key = NULL;
+    table->entries[hole].value = NULL;
+    
+    --table->count;
+
+}
+
+void hashtab_get_stats (unsigned long *lookups_p, unsigned long *probes_p) {
+
+    *lookups_p = lookups;
+    *probes_p = probes;
 
 }
@@ -17,20 +17,27 @@ struct hashtab_entry {
 
     struct hashtab_name *key;
     void *value;
+    
+    unsigned long hash, bytes;
 
 };
 
 struct hashtab {
 
     struct hashtab_entry *entries;
-    unsigned long capacity, count, used;
+    unsigned long capacity, count;
 
 };
 
 struct hashtab_name *hashtab_alloc_name (const char *str);
+void hashtab_init_name (struct hashtab_name *name, const char *str);
+
 int hashtab_put (struct hashtab *table, struct hashtab_name *key, void *value);
 
 void *hashtab_get (struct hashtab *table, struct hashtab_name *key);
+void *hashtab_get_lowercase (struct hashtab *table, const char *str);
 void hashtab_remove (struct hashtab *table, struct hashtab_name *key);
 
+void hashtab_get_stats (unsigned long *lookups_p, unsigned long *probes_p);
+
 #endif      /* _HASHTAB_H */
@@ -15,6 +15,7 @@
 #include    "lex.h"
 #include    "lib.h"
 #include    "intel.h"
+#include    "macro.h"
 #include    "pseudo_ops.h"
 #include    "report.h"
 #include    "section.h"
@@ -157,6 +158,18 @@ static const struct intel_operator intel_operators[] = {
 
 };
 
+/** Both tables are keyed by the lower case names, see add_intel_keyword. */
+static struct hashtab intel_types_hashtab = { 0 };
+static struct hashtab intel_operators_hashtab = { 0 };
+
+static const struct intel_type *find_intel_type (const char *name) {
+    return hashtab_get_lowercase (&intel_types_hashtab, name);
+}
+
+static const struct intel_operator *find_intel_operator (const char *name) {
+    return hashtab_get_lowercase (&intel_operators_hashtab, name);
+}
+
 static struct {
 
     enum expr_type operand_modifier;
@@ -918,10 +931,37 @@ static const struct reg_entry *reg_st0;
 static const struct reg_entry bad_register = { "<bad>", 0, 0 };
 static struct hashtab reg_entry_hashtab = { 0 };
 
+#define     OPERAND_CLASS_REG8          0x01
+#define     OPERAND_CLASS_REG16         0x02
+#define     OPERAND_CLASS_REG32         0x04
+#define     OPERAND_CLASS_ACC           0x08
+#define     OPERAND_CLASS_SREG          0x10
+#define     OPERAND_CLASS_IMM           0x20
+#define     OPERAND_CLASS_MEM           0x40
+#define     OPERAND_CLASS_OTHER         0x80
+
+#define     OPERAND_CLASSES             8
+
+/**
+ * Per-mnemonic index used by match_template.  Every template of a mnemonic
+ * is given a bit (its offset from start) and for each operand position and
+ * coarse operand class we record which templates accept that class.  The
+ * index is only built when a mnemonic has no more than 32 templates.
+ */
+struct template_index {
+
+    uint32_t operand_count[MAX_OPERANDS + 1];
+    uint32_t accepts[MAX_OPERANDS][OPERAND_CLASSES];
+
+};
+
 struct templates {
 
     const char *name;
     struct template *start, *end;
+    
+    /* Points to index_storage once the index is built, so it goes with the entry. */
+    struct template_index *index, index_storage;
 
 };
 
@@ -942,28 +982,12 @@ static int check_reg (const struct reg_entry *reg) {
 }
 
 static const struct reg_entry *find_reg_entry (const char *name) {
-
-    char *p = to_lower (name);
-    
-    struct reg_entry *entry;
-    struct hashtab_name *key;
-    
-    if ((key = hashtab_alloc_name (p)) == NULL) {
-        return NULL;
-    }
-    
-    entry = hashtab_get (&reg_entry_hashtab, key);
-    
-    free (key);
-    free (p);
-    
-    return entry;
-
+    return hashtab_get_lowercase (&reg_entry_hashtab, name);
 }
 
 static int intel_parse_name (struct expr *expr, char *name) {
 
-    int32_t i;
+    const struct intel_type *type;
 
     if (strcmp (name, "$") == 0) {
 
@@ -972,18 +996,14 @@ static int intel_parse_name (struct expr *expr, char *name) {
 
     }
 
-    for (i = 0; intel_types[i].name; i++) {
+    if ((type = find_intel_type (name)) != NULL) {
 
-        if (xstrcasecmp (name, intel_types[i].name) == 0) {
-
-            expr->type = EXPR_TYPE_CONSTANT;
-            expr->add_symbol = NULL;
-            expr->op_symbol = NULL;
-            expr->add_number = intel_types[i].size;
-
-            return 1;
+        expr->type = EXPR_TYPE_CONSTANT;
+        expr->add_symbol = NULL;
+        expr->op_symbol = NULL;
+        expr->add_number = type->size;
 
-        }
+        return 1;
 
     }
 
@@ -1563,7 +1583,7 @@ static int process_suffix (void) {
         
             if ((instruction.types[op] & ANY_MEM) && instruction.disps[op] && instruction.disps[op]->add_symbol != NULL) {
             
-                instruction.suffix = ((instruction.disps[op]->add_symbol->size == 1) ? BYTE_SUFFIX : (instruction.disps[op]->add_symbol->size == 2) ? WORD_SUFFIX : DWORD_SUFFIX);
+                instruction.suffix = ((symbol_get_size (instruction.disps[op]->add_symbol) == 1) ? BYTE_SUFFIX : (symbol_get_size (instruction.disps[op]->add_symbol) == 2) ? WORD_SUFFIX : DWORD_SUFFIX);
                 break;
             
             }
@@ -1765,6 +1785,114 @@ static uint32_t modrm_mode_from_disp_size (uint32_t type) {
     return ((type & DISP8) ? 1 : ((type & (DISP16 | DISP32)) ? 2 : 0));
 }
 
+/**
+ * Size optimizations (-O).
+ *
+ * Only rewrites that behave the same on every cpu level are done: "cmp
+ * reg, 0" becomes "test reg, reg" (which only leaves AF undefined),
+ * segment overrides naming the segment an address uses anyway are dropped
+ * and "mov reg, 0" becomes "xor reg, reg" when the next instruction sets
+ * every flag without reading any.  The bytes saved are counted for each
+ * section and printed with --stats.
+ */
+struct optimize_savings {
+
+    section_t section;
+    unsigned long bytes;
+
+};
+
+static struct optimize_savings **savings = NULL;
+static unsigned long nb_savings = 0;
+
+/** Bytes saved by the instruction being encoded, for the encoding cache. */
+static unsigned long instruction_bytes_saved = 0;
+
+static void note_bytes_saved (section_t section, unsigned long bytes) {
+
+    struct optimize_savings *entry;
+    unsigned long i;
+    
+    for (i = 0; i < nb_savings; ++i) {
+    
+        if (savings[i]->section == section) {
+        
+            savings[i]->bytes += bytes;
+            return;
+        
+        }
+    
+    }
+    
+    entry = xmalloc (sizeof (*entry));
+    entry->section = section;
+    entry->bytes = bytes;
+    
+    dynarray_add (&savings, &nb_savings, entry);
+
+}
+
+/**
+ * Returns the number of the segment register the memory operand encoded
+ * in instruction.modrm uses when there is no override: SS when it is
+ * based on BP, EBP or ESP and DS otherwise.  Returns -1 for instructions
+ * that address memory some other way.
+ */
+static int default_segment (void) {
+
+    int addr16;
+    
+    if (!(instruction.template.opcode_modifier & MODRM)) {
+    
+        /* mov between the accumulator and a memory offset. */
+        if ((instruction.template.base_opcode & ~3) == 0xA0) {
+            return 3;
+        }
+        
+        return -1;
+    
+    }
+    
+    if (instruction.modrm.mode == 3) {
+        return -1;
+    }
+    
+    if (instruction.base_reg) {
+        addr16 = (instruction.base_reg->type & REG16) != 0;
+    } else if (instruction.index_reg) {
+        addr16 = 0;
+    } else {
+        addr16 = (bits == 16) ^ (instruction.prefixes[ADDR_PREFIX] != 0);
+    }
+    
+    if (addr16) {
+    
+        if (instruction.modrm.regmem == 2 || instruction.modrm.regmem == 3 || (instruction.modrm.regmem == 6 && instruction.modrm.mode != 0)) {
+            return 2;
+        }
+        
+        return 3;
+    
+    }
+    
+    if (instruction.modrm.regmem == MODRM_REGMEM_TWO_BYTE_ADDRESSING) {
+    
+        if (instruction.sib.base == 4 || (instruction.sib.base == 5 && instruction.modrm.mode != 0)) {
+            return 2;
+        }
+        
+        return 3;
+    
+    }
+    
+    if (instruction.modrm.regmem == 5 && instruction.modrm.mode != 0) {
+        return 2;
+    }
+    
+    return 3;
+
+}
+
 static int process_operands (void) {
 
     if (instruction.template.opcode_modifier & REG_DUPLICATION) {
@@ -1997,6 +2125,15 @@ static int process_operands (void) {
         
             if (instruction.segments[operand]) {
             
+                if (state->optimize && (int) instruction.segments[operand]->number == default_segment ()) {
+                
+                    note_bytes_saved (current_section, 1);
+                    instruction_bytes_saved++;
+                    
+                    break;
+                
+                }
+                
                 add_prefix (segment_prefixes[instruction.segments[operand]->number]);
                 break;
             
@@ -2030,6 +2167,189 @@ static int fits_in_unsigned_word (long number) {
 }
 
 
+/**
+ * Instruction statistics (--stats and --stats-json).
+ *
+ * Every instruction is counted under its mnemonic and the template it was
+ * matched to, and the prefixes at the start of its bytes are counted by
+ * kind.  Jumps are counted again once relaxation has settled their size.
+ */
+struct instruction_stat {
+
+    const char *mnemonic;
+    uint32_t opcode, extension;
+    
+    unsigned long count;
+
+};
+
+static struct hashtab instruction_stats_hashtab = { 0 };
+static int collect_stats = 0;
+
+static struct instruction_stat **instruction_stats = NULL;
+static unsigned long nb_instruction_stats = 0;
+
+static unsigned long instructions_count = 0;
+static unsigned long instructions_bytes = 0;
+
+#define     PREFIX_STAT_OPERAND_SIZE    0
+#define     PREFIX_STAT_ADDRESS_SIZE    1
+#define     PREFIX_STAT_FWAIT           2
+#define     PREFIX_STAT_REP             3
+#define     PREFIX_STAT_SEGMENT         4
+
+/* The segment overrides follow in the order of segment_prefixes. */
+static const char *prefix_stat_names[] = { "operand_size", "address_size", "fwait", "rep", "es", "cs", "ss", "ds", "fs", "gs" };
+static unsigned long prefix_stats[ARRAY_SIZE (prefix_stat_names)] = { 0 };
+
+/* Jumps by relaxation type when emitted, and by final form. */
+static const char *jump_type_names[] = { "unconditional", "conditional", "conditional86", "forced_short" };
+static unsigned long jumps_emitted[ARRAY_SIZE (jump_type_names)] = { 0 };
+
+#define     JUMP_STAT_SHORT             0
+#define     JUMP_STAT_NEAR              1
+#define     JUMP_STAT_LONG              2
+#define     JUMP_STAT_JUMP86            3
+#define     JUMP_STAT_OTHER_SECTION     4
+
+static const char *jump_stat_names[] = { "short", "near", "long", "jump86_expansions", "other_section" };
+static unsigned long jump_stats[ARRAY_SIZE (jump_stat_names)] = { 0 };
+
+/** Bookkeeping for the instruction being encoded, see count_instruction. */
+static struct instruction_stat *last_instruction_stat = NULL;
+
+static struct instruction_stat *find_instruction_stat (const char *mnemonic, uint32_t opcode, uint32_t extension) {
+
+    struct instruction_stat *stat;
+    struct hashtab_name *key;
+    
+    char *name = xmalloc (strlen (mnemonic) + 2 * 9 + 1);
+    sprintf (name, "%s %lx %lx", mnemonic, (unsigned long) opcode, (unsigned long) extension);
+    
+    if ((key = hashtab_alloc_name (name)) == NULL) {
+    
+        free (name);
+        return NULL;
+    
+    }
+    
+    if ((stat = hashtab_get (&instruction_stats_hashtab, key)) != NULL) {
+    
+        free (name);
+        free (key);
+        
+        return stat;
+    
+    }
+    
+    stat = xmalloc (sizeof (*stat));
+    stat->mnemonic = mnemonic;
+    stat->opcode = opcode;
+    stat->extension = extension;
+    
+    if (hashtab_put (&instruction_stats_hashtab, key, stat)) {
+    
+        free (name);
+        free (key);
+        free (stat);
+        
+        return NULL;
+    
+    }
+    
+    dynarray_add (&instruction_stats, &nb_instruction_stats, stat);
+    return stat;
+
+}
+
+static int prefix_stat_index (unsigned char byte) {
+
+    unsigned long i;
+    
+    switch (byte) {
+    
+        case DATA_PREFIX_OPCODE:
+        
+            return PREFIX_STAT_OPERAND_SIZE;
+        
+        case ADDR_PREFIX_OPCODE:
+        
+            return PREFIX_STAT_ADDRESS_SIZE;
+        
+        case FWAIT_OPCODE:
+        
+            return PREFIX_STAT_FWAIT;
+        
+        case REPNE_PREFIX_OPCODE:
+        case REPE_PREFIX_OPCODE:
+        
+            return PREFIX_STAT_REP;
+    
+    }
+    
+    for (i = 0; i < ARRAY_SIZE (segment_prefixes); i++) {
+    
+        if (segment_prefixes[i] == byte) {
+            return PREFIX_STAT_SEGMENT + i;
+        }
+    
+    }
+    
+    return -1;
+
+}
+
+/**
+ * Counts an instruction encoded to the size bytes at p.  The prefixes are
+ * read back from the bytes, so that prefixes which were dropped are not
+ * counted and a lone "fwait" or "rep" is not taken for a prefix.
+ */
+static void count_instruction (struct instruction_stat *stat, const unsigned char *p, unsigned long size) {
+
+    unsigned long i;
+    int index;
+    
+    if (stat) {
+        stat->count++;
+    }
+    
+    instructions_count++;
+    instructions_bytes += size;
+    
+    for (i = 0; i + 1 < size && (index = prefix_stat_index (p[i])) >= 0; i++) {
+        prefix_stats[index]++;
+    }
+
+}
+
+static void count_jump_emitted (relax_subtype_t relax_subtype) {
+
+    if (collect_stats) {
+        jumps_emitted[TYPE_FROM_RELAX_SUBTYPE (relax_subtype)]++;
+    }
+
+}
+
+static void count_jump_relaxed (relax_subtype_t relax_subtype, long extension) {
+
+    if (!collect_stats) {
+        return;
+    }
+    
+    instructions_bytes += extension;
+    
+    if ((relax_subtype & RELAX_SUBTYPE_LONG_JUMP) == 0) {
+        jump_stats[JUMP_STAT_SHORT]++;
+    } else if ((relax_subtype & RELAX_SUBTYPE_CODE16_JUMP) == 0) {
+        jump_stats[JUMP_STAT_LONG]++;
+    } else if (TYPE_FROM_RELAX_SUBTYPE (relax_subtype) == RELAX_SUBTYPE_CONDITIONAL_JUMP86) {
+        jump_stats[JUMP_STAT_JUMP86]++;
+    } else {
+        jump_stats[JUMP_STAT_NEAR]++;
+    }
+
+}
+
 static void output_jump (void) {
     
     struct symbol *symbol;
@@ -2095,10 +2415,13 @@ static void output_jump (void) {
         }
         
         relax_subtype |= code16;
+        
+        count_jump_emitted (relax_subtype);
         frag_set_as_variant (RELAX_TYPE_MACHINE_DEPENDENT, relax_subtype, symbol, offset, opcode_offset_in_buf, instruction.far_call);
     
     } else {
     
+        count_jump_emitted (ENCODE_RELAX_SUBTYPE (RELAX_SUBTYPE_FORCED_SHORT_JUMP, RELAX_SUBTYPE_SHORT_JUMP));
         frag_set_as_variant (RELAX_TYPE_MACHINE_DEPENDENT,
                              ENCODE_RELAX_SUBTYPE (RELAX_SUBTYPE_FORCED_SHORT_JUMP, RELAX_SUBTYPE_SHORT_JUMP),
                              symbol,
@@ -2273,30 +2596,7 @@ static void output_intersegment_jump (void) {
 }
 
 static struct templates *find_templates (const char *name) {
-
-    struct hashtab_name *key;
-    struct templates *templates;
-    
-    char *p = to_lower (name);
-    
-    if (p == NULL) {
-        return NULL;
-    }
-    
-    if ((key = hashtab_alloc_name (p)) == NULL) {
-    
-        free (p);
-        return NULL;
-    
-    }
-    
-    templates = hashtab_get (&templates_hashtab, key);
-    
-    free (key);
-    free (p);
-    
-    return templates;
-
+    return hashtab_get_lowercase (&templates_hashtab, name);
 }
 
 /**
@@ -3686,131 +3986,264 @@ static int parse_operands (char **p_line) {
 
 #define MATCH(overlap, operand_type)    (((overlap) & ~JUMP_ABSOLUTE) && (((operand_type) & (BASE_INDEX | JUMP_ABSOLUTE)) == ((overlap) & (BASE_INDEX | JUMP_ABSOLUTE))))
 
-static int match_template (void) {
+/**
+ * Maps operand type bits to coarse operand classes.  Every bit except
+ * JUMP_ABSOLUTE belongs to exactly one class so two types that overlap
+ * (as required by MATCH) always share at least one class.
+ */
+static uint32_t operand_classes (uint32_t type) {
 
-    const struct template *template;
+    uint32_t classes = 0;
     
-    uint32_t found_reverse_match = 0;
-    uint32_t suffix_check = 0;
-    
-    switch (instruction.suffix) {
-    
-        case BYTE_SUFFIX:
-        
-            suffix_check = NO_BSUF;
-            break;
-        
-        case WORD_SUFFIX:
-        
-            suffix_check = NO_WSUF;
-            break;
-        
-        case SHORT_SUFFIX:
-        
-            suffix_check = NO_SSUF;
-            break;
-        
-        case DWORD_SUFFIX:
-        
-            suffix_check = NO_LSUF;
-            break;
-        
-        case QWORD_SUFFIX:
-        
-            suffix_check = NO_QSUF;
-            break;
-        
-        case INTEL_SUFFIX:
-        
-            suffix_check = NO_INTELSUF;
-            break;
+    if (type & REG8) { classes |= OPERAND_CLASS_REG8; }
+    if (type & REG16) { classes |= OPERAND_CLASS_REG16; }
+    if (type & REG32) { classes |= OPERAND_CLASS_REG32; }
+    if (type & ACC) { classes |= OPERAND_CLASS_ACC; }
+    if (type & (SEGMENT1 | SEGMENT2)) { classes |= OPERAND_CLASS_SREG; }
+    if (type & IMM) { classes |= OPERAND_CLASS_IMM; }
+    if (type & ANY_MEM) { classes |= OPERAND_CLASS_MEM; }
     
+    if (type & ~(REG | ACC | SEGMENT1 | SEGMENT2 | IMM | ANY_MEM | JUMP_ABSOLUTE)) {
+        classes |= OPERAND_CLASS_OTHER;
     }
     
-    if (current_templates[0].start->base_opcode == 0xCD && instruction.operands == 1 && instruction.types[0] & IMM) {
+    return classes;
 
-        if (instruction.imms[0]->type == EXPR_TYPE_CONSTANT && instruction.imms[0]->add_number == 3) {
-        
-            instruction.template.base_opcode = 0xCC;
-            instruction.operands--;
-            
-            return 0;
-        
-        }
+}
+
+static struct template_index *build_template_index (struct templates *templates) {
+
+    struct template_index *index;
+    struct template *template;
     
-    }
+    uint32_t bit, classes;
+    int32_t operand, c;
     
-    for (template = current_templates->start ; template < current_templates->end; template++) {
+    if (templates->end - templates->start > 32) {
+        return NULL;
+    }
     
-        uint32_t operand_type_overlap0, operand_type_overlap1, operand_type_overlap2;
-        
-        if (instruction.operands != template->operands) {
-            continue;
+    index = &templates->index_storage;
+    
+    for (template = templates->start, bit = 1; template < templates->end; template++, bit <<= 1) {
+    
+        if (template->operands < 0 || template->operands > MAX_OPERANDS) {
+            return NULL;
         }
         
-        if (template->opcode_modifier & suffix_check) {
-            continue;
-        }
+        index->operand_count[template->operands] |= bit;
+        
+        for (operand = 0; operand < template->operands; operand++) {
+        
+            classes = operand_classes (template->operand_types[operand]);
+            
+            /* Reversed operands are tried for D and FLOAT_D templates, in which case the
+             * third operand is not checked at all. */
+            if (template->operands > 1 && (template->opcode_modifier & (D | FLOAT_D))) {
+            
+                if (operand < 2) {
+                    classes = operand_classes (template->operand_types[0] | template->operand_types[1]);
+                } else {
+                    classes = ~((uint32_t) 0);
+                }
+            
+            }
+            
+            for (c = 0; c < OPERAND_CLASSES; c++) {
+            
+                if (classes & (1U << c)) {
+                    index->accepts[operand][c] |= bit;
+                }
+            
+            }
         
-        if (instruction.operands == 0) {
-            break;
         }
+    
+    }
+    
+    return index;
+
+}
+
+static int template_matches (const struct template *template, uint32_t suffix_check, uint32_t *found_reverse_match) {
+
+    uint32_t operand_type_overlap0, operand_type_overlap1, operand_type_overlap2;
+    
+    if (instruction.operands != template->operands) {
+        return 0;
+    }
+    
+    if (template->opcode_modifier & suffix_check) {
+        return 0;
+    }
+    
+    if (instruction.operands == 0) {
+        return 1;
+    }
+    
+    operand_type_overlap0 = instruction.types[0] & template->operand_types[0];
+    
+    switch (template->operands) {
+    
+        case 1:
         
-        operand_type_overlap0 = instruction.types[0] & template->operand_types[0];
+            if (!MATCH (operand_type_overlap0, instruction.types[0])) {
+                return 0;
+            }
+            
+            if (operand_type_overlap0 == 0) {
+                return 0;
+            }
+            
+            break;
         
-        switch (template->operands) {
+        case 2:
+        case 3:
         
-            case 1:
+            operand_type_overlap1 = instruction.types[1] & template->operand_types[1];
+            
+            if (!MATCH (operand_type_overlap0, instruction.types[0]) || !MATCH (operand_type_overlap1, instruction.types[1])) {
             
-                if (!MATCH (operand_type_overlap0, instruction.types[0])) {
-                    continue;
+                if ((template->opcode_modifier & (D | FLOAT_D)) == 0) {
+                    return 0;
                 }
                 
-                if (operand_type_overlap0 == 0) {
-                    continue;
+                operand_type_overlap0 = instruction.types[0] & template->operand_types[1];
+                operand_type_overlap1 = instruction.types[1] & template->operand_types[0];
+                
+                if (!MATCH (operand_type_overlap0, instruction.types[0]) || !MATCH (operand_type_overlap1, instruction.types[1])) {
+                    return 0;
                 }
                 
-                break;
+                *found_reverse_match = template->opcode_modifier & (D | FLOAT_D);
             
-            case 2:
-            case 3:
+            } else if (instruction.operands == 3) {
             
-                operand_type_overlap1 = instruction.types[1] & template->operand_types[1];
-                
-                if (!MATCH (operand_type_overlap0, instruction.types[0]) || !MATCH (operand_type_overlap1, instruction.types[1])) {
-                
-                    if ((template->opcode_modifier & (D | FLOAT_D)) == 0) {
-                        continue;
-                    }
-                    
-                    operand_type_overlap0 = instruction.types[0] & template->operand_types[1];
-                    operand_type_overlap1 = instruction.types[1] & template->operand_types[0];
-                    
-                    if (!MATCH (operand_type_overlap0, instruction.types[0]) || !MATCH (operand_type_overlap1, instruction.types[1])) {
-                        continue;
-                    }
-                    
-                    found_reverse_match = template->opcode_modifier & (D | FLOAT_D);
-                
-                } else if (instruction.operands == 3) {
-                
-                    operand_type_overlap2 = instruction.types[2] & template->operand_types[2];
-                    
-                    if (!MATCH (operand_type_overlap2, instruction.types[2])) {
-                        continue;
-                    }
+                operand_type_overlap2 = instruction.types[2] & template->operand_types[2];
                 
+                if (!MATCH (operand_type_overlap2, instruction.types[2])) {
+                    return 0;
                 }
-                
-                break;
+            
+            }
+            
+            break;
+    
+    }
+    
+    return 1;
+
+}
+
+static const struct template *find_matching_template (uint32_t suffix_check, uint32_t *found_reverse_match) {
+
+    const struct template_index *index = current_templates->index;
+    const struct template *template;
+    
+    uint32_t candidates, accepted, classes;
+    int32_t operand, c;
+    
+    if (index == NULL || instruction.operands < 0 || instruction.operands > MAX_OPERANDS) {
+    
+        for (template = current_templates->start; template < current_templates->end; template++) {
+        
+            if (template_matches (template, suffix_check, found_reverse_match)) {
+                return template;
+            }
+        
+        }
+        
+        return NULL;
+    
+    }
+    
+    candidates = index->operand_count[instruction.operands];
+    
+    for (operand = 0; candidates && operand < instruction.operands; operand++) {
+    
+        classes = operand_classes (instruction.types[operand]);
+        accepted = 0;
+        
+        for (c = 0; c < OPERAND_CLASSES; c++) {
+        
+            if (classes & (1U << c)) {
+                accepted |= index->accepts[operand][c];
+            }
+        
+        }
         
+        candidates &= accepted;
+    
+    }
+    
+    /* Candidates are visited in table order so the first match is the same as a linear scan. */
+    for (template = current_templates->start; candidates; template++, candidates >>= 1) {
+    
+        if ((candidates & 1) && template_matches (template, suffix_check, found_reverse_match)) {
+            return template;
         }
+    
+    }
+    
+    return NULL;
+
+}
+
+static int match_template (void) {
+
+    const struct template *template;
+    
+    uint32_t found_reverse_match = 0;
+    uint32_t suffix_check = 0;
+    
+    switch (instruction.suffix) {
+    
+        case BYTE_SUFFIX:
+        
+            suffix_check = NO_BSUF;
+            break;
+        
+        case WORD_SUFFIX:
+        
+            suffix_check = NO_WSUF;
+            break;
+        
+        case SHORT_SUFFIX:
+        
+            suffix_check = NO_SSUF;
+            break;
+        
+        case DWORD_SUFFIX:
+        
+            suffix_check = NO_LSUF;
+            break;
+        
+        case QWORD_SUFFIX:
+        
+            suffix_check = NO_QSUF;
+            break;
+        
+        case INTEL_SUFFIX:
+        
+            suffix_check = NO_INTELSUF;
+            break;
+    
+    }
+    
+    if (current_templates[0].start->base_opcode == 0xCD && instruction.operands == 1 && instruction.types[0] & IMM) {
+
+        if (instruction.imms[0]->type == EXPR_TYPE_CONSTANT && instruction.imms[0]->add_number == 3) {
+        
+            instruction.template.base_opcode = 0xCC;
+            instruction.operands--;
+            
+            return 0;
         
-        break;
+        }
     
     }
     
-    if (template == current_templates->end) {
+    if ((template = find_matching_template (suffix_check, &found_reverse_match)) == NULL) {
     
         /* No match was found. */
         report (REPORT_ERROR, "operands invalid for '%s'", current_templates->name);
@@ -4103,7 +4536,8 @@ static void output_imms (void) {
 
 enum expr_type machine_dependent_parse_operator (char **pp, char *name, char *original_saved_c, uint32_t operands) {
 
-    size_t i;
+    const struct intel_operator *operator;
+    const struct intel_type *type;
     
     if (!intel_syntax) {
         return EXPR_TYPE_ABSENT;
@@ -4133,15 +4567,7 @@ enum expr_type machine_dependent_parse_operator (char **pp, char *name, char *or
     
     }
     
-    for (i = 0; intel_types[i].name; i++) {
-    
-        if (xstrcasecmp (name, intel_types[i].name) == 0) {
-            break;
-        }
-    
-    }
-    
-    if (intel_types[i].name && *original_saved_c == ' ') {
+    if ((type = find_intel_type (name)) != NULL && *original_saved_c == ' ') {
     
         char *second_name;
         char c;
@@ -4155,7 +4581,7 @@ enum expr_type machine_dependent_parse_operator (char **pp, char *name, char *or
             second_name[-1] = *original_saved_c;
             *original_saved_c = c;
             
-            return intel_types[i].expr_type;
+            return type->expr_type;
         
         }
         
@@ -4166,183 +4592,1035 @@ enum expr_type machine_dependent_parse_operator (char **pp, char *name, char *or
     
     }
     
-    for (i = 0; intel_operators[i].name; i++) {
+    if ((operator = find_intel_operator (name)) != NULL) {
+    
+        if (operands != operator->operands) {
+            return EXPR_TYPE_INVALID;
+        }
+        
+        return operator->expr_type;
+    
+    }
+    
+    return EXPR_TYPE_ABSENT;
+
+}
+
+section_t machine_dependent_simplified_expression_read_into (char **pp, struct expr *expr) {
+
+    int ret;
+    section_t ret_section;
+    
+    if (!intel_syntax) {
+        return expression_read_into (pp, expr);
+    }
+    
+    memset (&intel_state, 0, sizeof (intel_state));
+    intel_state.operand_modifier = EXPR_TYPE_ABSENT;
+    
+    instruction.operands = -1;
+    
+    intel_syntax = -1;
+    
+    ret_section = expression_read_into (pp, expr);
+    ret = intel_simplify_expr (expr);
+    
+    intel_syntax = 1;
+    
+    if (!ret) {
+    
+        report (REPORT_ERROR, "bad machine-dependent expression");
+        expr->type = EXPR_TYPE_INVALID;
+    
+    }
+    
+    return ret_section;
+
+}
+
+/**
+ * A "mov reg, 0" is emitted as written and its frag closed.  If the next
+ * instruction sets every flag without reading any and nothing has been
+ * added after the mov in the meantime, the mov is shrunk in place into an
+ * "xor reg, reg"; labels between them belong to the next frag, so their
+ * addresses follow, and that frag's chain position is moved back with
+ * them.
+ */
+struct pending_mov {
+
+    struct frag *frag;
+    section_t section;
+    
+    value_t opcode_offset;
+    int reg_number, imm_size;
+
+};
+
+static struct pending_mov pending_mov = { 0 };
+
+static int sets_all_flags (const char *name) {
+
+    static const char *names[] = { "add", "and", "cmp", "or", "sub", "test", "xor", NULL };
+    int i;
+    
+    for (i = 0; names[i]; ++i) {
+    
+        if (strcmp (name, names[i]) == 0) {
+            return 1;
+        }
+    
+    }
+    
+    return 0;
+
+}
+
+static void resolve_pending_mov (int flags_set) {
+
+    struct frag *frag = pending_mov.frag, *next;
+    unsigned char *p;
+    
+    if (frag == NULL) {
+        return;
+    }
+    
+    pending_mov.frag = NULL;
+    
+    /* Whether shrunk or not, the size of the mov is final now, so the frags after it no longer have to count it as variant. */
+    for (next = frag->next; next; next = next->next) {
+    
+        if (next->last_variant_seq == frag->seq) {
+            next->last_variant_seq = frag->last_variant_seq;
+        }
+    
+    }
+    
+    if (!flags_set || current_frag != frag->next || current_frag->fixed_size != 0) {
+        return;
+    }
+    
+    p = frag->buf + pending_mov.opcode_offset;
+    
+    p[0] = 0x31;
+    p[1] = 0xC0 | (pending_mov.reg_number << 3) | pending_mov.reg_number;
+    
+    frag->fixed_size = pending_mov.opcode_offset + 2;
+    
+    /* The empty frag after it is the only one so far, and the ones to come take their position from it. */
+    current_frag->chain_offset = frag->chain_offset + frag->fixed_size;
+    note_bytes_saved (pending_mov.section, pending_mov.imm_size - 1);
+    
+    if (collect_stats) {
+        instructions_bytes -= pending_mov.imm_size - 1;
+    }
+
+}
+
+static int has_only_data_prefix (void) {
+
+    uint32_t i;
+    
+    for (i = 0; i < ARRAY_SIZE (instruction.prefixes); i++) {
+    
+        if (i != DATA_PREFIX && instruction.prefixes[i]) {
+            return 0;
+        }
+    
+    }
+    
+    return 1;
+
+}
+
+static int is_constant_zero (const struct expr *expr) {
+    return expr && expr->type == EXPR_TYPE_CONSTANT && expr->add_number == 0;
+}
+
+/** Turns "cmp reg, 0" into "test reg, reg" (operands in AT&T order). */
+static void optimize_compare_with_zero (void) {
+
+    const struct reg_entry *reg = instruction.regs[1];
+    
+    if (strcmp (current_templates->name, "cmp") || instruction.operands != 2) {
+        return;
+    }
+    
+    if (!(instruction.types[0] & IMM) || !is_constant_zero (instruction.imms[0]) || !(instruction.types[1] & REG) || reg == NULL) {
+        return;
+    }
+    
+    /* "cmp al, 0" is already two bytes long. */
+    if ((reg->type & REG8) && reg->number == 0) {
+        return;
+    }
+    
+    current_templates = find_templates ("test");
+    
+    instruction.types[0] = instruction.types[1];
+    instruction.regs[0] = reg;
+    instruction.imms[0] = NULL;
+    instruction.reg_operands = 2;
+    
+    note_bytes_saved (current_section, 1);
+    instruction_bytes_saved++;
+
+}
+
+/** Remembers a "mov reg, 0" that has just been emitted, see pending_mov. */
+static void note_move_of_zero (void) {
+
+    int imm_size;
+    
+    if (strcmp (current_templates->name, "mov") || instruction.operands != 2 || !(instruction.template.opcode_modifier & SHORT_FORM)) {
+        return;
+    }
+    
+    if ((instruction.template.base_opcode & ~7) != 0xB8 || !is_constant_zero (instruction.imms[0]) || !has_only_data_prefix ()) {
+        return;
+    }
+    
+    if (instruction.suffix == WORD_SUFFIX) {
+        imm_size = 2;
+    } else if (instruction.suffix == DWORD_SUFFIX) {
+        imm_size = 4;
+    } else {
+        return;
+    }
+    
+    pending_mov.frag = current_frag;
+    pending_mov.section = current_section;
+    pending_mov.opcode_offset = current_frag->fixed_size - imm_size - 1;
+    pending_mov.reg_number = instruction.template.base_opcode & 7;
+    pending_mov.imm_size = imm_size;
+    
+    frag_new_after_shrinkable ();
+
+}
+
+/**
+ * Matches the operands collected in instruction against the templates
+ * in current_templates and appends the encoding to the current frag.
+ * Operands are swapped into template order first when reverse is set.
+ * Returns 1 if an error has been reported.
+ */
+static int encode_instruction (int reverse) {
+
+    uint32_t opcode, extension;
+    
+    struct frag *start_frag;
+    value_t start, end;
+    
+    if (current_templates[0].start->base_opcode == 0xC0 && instruction.operands == 2 && instruction.types[1] & IMM) {
+    
+        if (instruction.imms[1]->type == EXPR_TYPE_CONSTANT && instruction.imms[1]->add_number == 1) {
+            instruction.operands--;
+        }
+    
+    }
+    
+    /**
+     * All Intel instructions have reversed operands except "bound" and some other.
+     * "ljmp" and "lcall" with 2 immediate operands also do not have operands reversed.
+     */
+    if (reverse && instruction.operands > 1 && strcmp (current_templates->name, "bound") && !((instruction.types[0] & IMM) && (instruction.types[1] & IMM))) {
+        swap_operands ();
+    }
+    
+    if (state->optimize) {
+    
+        resolve_pending_mov (sets_all_flags (current_templates->name));
+        optimize_compare_with_zero ();
+    
+    }
+    
+    optimize_size_of_disps ();
+    optimize_size_of_imms ();
+    
+    if (match_template ()) {
+        return 1;
+    }
+    
+    opcode = instruction.template.base_opcode;
+    extension = instruction.template.extension_opcode;
+    
+    if (process_suffix () || finalize_imms ()) {
+        return 1;
+    }
+    
+    if (instruction.template.opcode_modifier & ADD_FWAIT) {
+    
+        if (!add_prefix (FWAIT_OPCODE)) {
+            return 1;
+        }
+    
+    }
+    
+    if (cpu_level < 3) {
+    
+        if (instruction.suffix == DWORD_SUFFIX || instruction.template.minimum_cpu > cpu_level) {
+        
+            report (REPORT_ERROR, "no instruction for cpu level %d", cpu_level);
+            return 1;
+        
+        }
+    
+    }
+    
+    if (instruction.template.operand_types[0] & IMPLICIT_REGISTER) {
+        instruction.reg_operands--;
+    }
+    
+    if (instruction.template.operand_types[1] & IMPLICIT_REGISTER) {
+        instruction.reg_operands--;
+    }
+    
+    if (instruction.operands) {
+    
+        if (process_operands ()) {
+            return 1;
+        }
+    
+    }
+    
+    start_frag = current_frag;
+    start = current_frag->fixed_size;
+    
+    if (instruction.template.opcode_modifier & JUMP) {
+        output_jump ();
+    } else if (instruction.template.opcode_modifier & (CALL | JUMPBYTE)) {
+        output_call_or_jumpbyte ();
+    } else if (instruction.template.opcode_modifier & JUMPINTERSEGMENT) {
+        output_intersegment_jump ();
+    } else {
+    
+        uint32_t i;
+
+        for (i = 0; i < ARRAY_SIZE (instruction.prefixes); i++) {
+        
+            if (instruction.prefixes[i]) {
+                frag_append_1_char (instruction.prefixes[i]);
+            }
+        
+        }
+        
+        /*if (instruction.template.base_opcode == 0xff && instruction.template.extension_opcode < 6 && state->model >= 4) {
+            frag_append_1_char (0x2E);
+        }*/
+        
+        if (instruction.template.base_opcode & 0xff00) {
+            frag_append_1_char ((instruction.template.base_opcode >> 8) & 0xff);
+        }
+        
+        frag_append_1_char (instruction.template.base_opcode & 0xff);
+        
+        if (instruction.template.opcode_modifier & MODRM) {
+        
+            frag_append_1_char (((instruction.modrm.regmem << 0) | (instruction.modrm.reg << 3) | (instruction.modrm.mode << 6)));
+            
+            if ((instruction.modrm.regmem == MODRM_REGMEM_TWO_BYTE_ADDRESSING) && (instruction.modrm.mode != 3) && !(instruction.base_reg && (instruction.base_reg->type & REG16))) {
+                frag_append_1_char (((instruction.sib.base << 0) | (instruction.sib.index << 3) | (instruction.sib.scale << 6)));
+            }
+        
+        }
+        
+        output_disps ();
+        output_imms ();
+        
+        if (state->optimize) {
+            note_move_of_zero ();
+        }
+    
+    }
+    
+    if (collect_stats) {
+    
+        end = (current_frag == start_frag) ? current_frag->fixed_size : start_frag->fixed_size;
+        
+        last_instruction_stat = find_instruction_stat (current_templates->name, opcode, extension);
+        count_instruction (last_instruction_stat, start_frag->buf + start, end - start);
+    
+    }
+    
+    return 0;
+
+}
+
+static char *assemble_line (char *line) {
+
+    memset (&instruction, 0, sizeof (instruction));
+    memset (operand_exprs, 0, sizeof (operand_exprs));
+    
+    line = parse_instruction (line);
+    
+    if (current_templates == NULL || parse_operands (&line)) {
+        goto skip;
+    }
+    
+    if (encode_instruction (intel_syntax)) {
+        goto skip;
+    }
+    
+    return line;
+    
+skip:
+    
+    while (*line != '\0') {
+    
+        if (line[0] == '#') {
+            break;
+        }
+        
+        ++(line);
+    
+    }
+    
+    return line;
+
+}
+
+const struct templates *machine_dependent_find_mnemonic (const char *name) {
+    return find_templates (name);
+}
+
+const struct reg_entry *machine_dependent_find_register (const char *name) {
+
+    const struct reg_entry *reg;
+    
+    if ((reg = find_reg_entry (name)) == NULL || !check_reg (reg)) {
+        return NULL;
+    }
+    
+    return reg;
+
+}
+
+/**
+ * Assembles an instruction from a mnemonic and operands that have already
+ * been resolved, without going through the text parser.  The operands are
+ * given in Intel order (destination first).  Returns 1 if an error has
+ * been reported.
+ */
+int machine_dependent_emit_instruction (const struct templates *mnemonic, const struct machine_dependent_operand *operands, int nb_operands) {
+
+    char description[2 * MAX_REG_NAME_SIZE + 4];
+    int i;
+    
+    memset (&instruction, 0, sizeof (instruction));
+    memset (operand_exprs, 0, sizeof (operand_exprs));
+    
+    if ((current_templates = mnemonic) == NULL || nb_operands > MAX_OPERANDS) {
+        return 1;
+    }
+    
+    for (i = 0; i < nb_operands; ++i) {
+    
+        const struct machine_dependent_operand *operand = &operands[i];
+        struct expr *expr = &operand_exprs[i];
+        
+        instruction.operands = i;
+        
+        switch (operand->kind) {
+        
+            case MACHINE_DEPENDENT_OPERAND_REGISTER:
+            
+                instruction.types[i] |= operand->reg->type & ~BASE_INDEX;
+                instruction.regs[i] = operand->reg;
+                
+                instruction.reg_operands++;
+                break;
+            
+            case MACHINE_DEPENDENT_OPERAND_IMMEDIATE:
+            
+                expr->type = EXPR_TYPE_CONSTANT;
+                expr->add_number = operand->value;
+                
+                instruction.imms[i] = expr;
+                finalize_immediate (expr, NULL);
+                break;
+            
+            case MACHINE_DEPENDENT_OPERAND_MEMORY:
+            
+                if (instruction.mem_operands >= 1) {
+                
+                    report (REPORT_ERROR, "too many memory references for '%s'", current_templates->name);
+                    return 1;
+                
+                }
+                
+                instruction.base_reg = operand->reg;
+                instruction.index_reg = operand->index_reg;
+                
+                if (instruction.base_reg || instruction.index_reg) {
+                    instruction.types[i] |= BASE_INDEX;
+                }
+                
+                if (operand->value || !(instruction.types[i] & BASE_INDEX)) {
+                
+                    expr->type = EXPR_TYPE_CONSTANT;
+                    expr->add_number = operand->value;
+                    
+                    instruction.disps[i] = expr;
+                    instruction.disp_operands++;
+                    
+                    if ((bits == 16) ^ !instruction.prefixes[ADDR_PREFIX]) {
+                        instruction.types[i] |= DISP32;
+                    } else {
+                        instruction.types[i] |= DISP16;
+                    }
+                
+                }
+                
+                sprintf (description, "[%s%s%s]", operand->reg ? operand->reg->name : "", (operand->reg && operand->index_reg) ? "+" : "", operand->index_reg ? operand->index_reg->name : "");
+                
+                if (base_index_check (description)) {
+                    return 1;
+                }
+                
+                instruction.mem_operands++;
+                break;
+            
+            default:
+            
+                return 1;
+        
+        }
+    
+    }
+    
+    instruction.operands = nb_operands;
+    return encode_instruction (1);
+
+}
+
+/**
+ * Encoding cache.
+ *
+ * Instructions whose operands are made only of registers, numbers, size
+ * keywords and operators always encode to the same bytes for a given
+ * mode, so the bytes of the first occurrence are remembered (keyed on the
+ * whitespace-normalized text and the mode) and later occurrences are
+ * emitted with one copy.  Lines that turn out not to be cacheable are
+ * remembered too so they are not examined again.
+ */
+#define     ENCODING_CACHE_MAX_ENTRIES  32768
+#define     MAX_ENCODING_SIZE           16
+
+struct encoding {
+
+    unsigned long size;
+    unsigned char bytes[MAX_ENCODING_SIZE];
+    
+    unsigned long bytes_saved;
+    int flags_set;
+    
+    struct instruction_stat *stat;
+
+};
+
+static struct hashtab encoding_cache = { 0 };
+
+static char *encoding_key = NULL;
+static unsigned long encoding_key_size = 0;
+
+static unsigned long encoding_lookups = 0;
+static unsigned long encoding_hits = 0;
+static unsigned long encoding_stores = 0;
+static unsigned long encoding_flushes = 0;
+
+static int is_encoding_cache_keyword (const char *name) {
+    return (find_intel_type (name) != NULL || find_intel_operator (name) != NULL);
+}
+
+static void flush_encoding_cache (void) {
+
+    unsigned long i;
+    
+    if (encoding_cache.count == 0) {
+        return;
+    }
+    
+    for (i = 0; i < encoding_cache.capacity; i++) {
+    
+        struct hashtab_entry *entry = &encoding_cache.entries[i];
+        
+        if (entry->key == NULL) {
+            continue;
+        }
+        
+        free ((char *) entry->key->chars);
+        free (entry->key);
+        free (entry->value);
+    
+    }
+    
+    mem_account (MEM_HASHTABS, 0, sizeof (*encoding_cache.entries) * encoding_cache.capacity);
+    free (encoding_cache.entries);
+    memset (&encoding_cache, 0, sizeof (encoding_cache));
+    
+    encoding_flushes++;
+
+}
+
+/**
+ * Builds the cache key for line: the mode followed by the line with each
+ * whitespace run removed unless it ends the first word or separates two
+ * name characters (or two signs).
+ */
+static const char *make_encoding_key (const char *line) {
+
+    unsigned long needed = strlen (line) + 64;
+    int first_word = 1;
+    char *p;
+    
+    if (encoding_key_size < needed) {
+    
+        encoding_key = xrealloc (encoding_key, needed);
+        encoding_key_size = needed;
+    
+    }
+    
+    sprintf (encoding_key, "%d:%d:%d:%d:%d:", bits, cpu_level, intel_syntax, state->model, state->procs.length > 0);
+    p = encoding_key + strlen (encoding_key);
+    
+    line = skip_whitespace ((char *) line);
+    
+    while (*line) {
+    
+        if (*line == ' ' || *line == '\t') {
+        
+            line = skip_whitespace ((char *) line);
+            
+            if (*line == '\0') {
+                break;
+            }
+            
+            if (first_word || ((isalnum ((int) p[-1]) || p[-1] == '_') && (isalnum ((int) *line) || *line == '_')) || (strchr ("+-", p[-1]) && strchr ("+-", *line))) {
+                *p++ = ' ';
+            }
+            
+            first_word = 0;
+            continue;
+        
+        }
+        
+        *p++ = *line++;
+    
+    }
+    
+    *p = '\0';
+    return encoding_key;
+
+}
+
+/**
+ * Checks that the operands of the normalized line key cannot refer to
+ * anything whose value may change later: every name must be a register,
+ * a size keyword or an operator, and none of them may be shadowed by a
+ * macro.
+ */
+static int encoding_is_cacheable (const char *key) {
+
+    char name[MAX_REG_NAME_SIZE + 8];
+    const char *p, *word;
+    
+    struct templates *templates;
+    unsigned long len;
+    
+    p = strchr (key, ':') + 1;
+    p = strchr (p, ':') + 1;
+    p = strchr (p, ':') + 1;
+    p = strchr (p, ':') + 1;
+    p = strchr (p, ':') + 1;
+    
+    /* Skip any prefixes and the mnemonic the same way parse_instruction does. */
+    for (;;) {
+    
+        for (word = p; isalnum ((int) *p); p++) {
+            ;
+        }
+        
+        if ((len = p - word) == 0 || len >= sizeof (name) || (*p != ' ' && *p != '\0')) {
+            return 0;
+        }
+        
+        for (len = 0; word + len < p; len++) {
+            name[len] = tolower ((int) word[len]);
+        }
+        
+        name[len] = '\0';
+        
+        if (*p == '\0') {
+            return 1;
+        }
+        
+        p++;
+        
+        if ((templates = find_templates (name)) == NULL || !(templates->start->opcode_modifier & IS_PREFIX)) {
+            break;
+        }
+    
+    }
+    
+    while (*p) {
+    
+        if (isalpha ((int) *p) || *p == '_') {
+        
+            for (word = p; isalnum ((int) *p) || *p == '_'; p++) {
+                ;
+            }
+            
+            if ((len = p - word) >= sizeof (name)) {
+                return 0;
+            }
+            
+            memcpy (name, word, len);
+            name[len] = '\0';
+            
+            if (has_macro (name)) {
+                return 0;
+            }
+            
+            if (!machine_dependent_is_register (name) && !is_encoding_cache_keyword (name)) {
+                return 0;
+            }
+            
+            continue;
+        
+        }
+        
+        if (isdigit ((int) *p)) {
+        
+            while (isalnum ((int) *p)) {
+                p++;
+            }
+            
+            continue;
+        
+        }
+        
+        if (!strchr (" ,[]+-*():", *p)) {
+            return 0;
+        }
+        
+        p++;
+    
+    }
+    
+    return 1;
+
+}
+
+char *machine_dependent_assemble_line (char *line) {
+
+    struct hashtab_name *key;
+    struct encoding *encoding;
+    
+    struct frag_chain *frag_chain;
+    unsigned long nb_fixups;
+    struct frag *frag;
+    
+    unsigned long errors, warnings;
+    value_t fixed_size;
+    
+    if (!state->encoding_cache) {
+        return assemble_line (line);
+    }
+    
+    if ((key = hashtab_alloc_name (make_encoding_key (line))) == NULL) {
+        return assemble_line (line);
+    }
+    
+    encoding_lookups++;
+    
+    if ((encoding = hashtab_get (&encoding_cache, key)) != NULL) {
+    
+        free (key);
+        
+        if (encoding->size == 0) {
+            return assemble_line (line);
+        }
+        
+        encoding_hits++;
+        
+        if (state->optimize) {
+        
+            resolve_pending_mov (encoding->flags_set);
+            
+            if (encoding->bytes_saved) {
+                note_bytes_saved (current_section, encoding->bytes_saved);
+            }
+        
+        }
+        
+        memcpy (frag_increase_fixed_size (encoding->size), encoding->bytes, encoding->size);
+        
+        if (collect_stats) {
+            count_instruction (encoding->stat, encoding->bytes, encoding->size);
+        }
+        
+        return line + strlen (line);
+    
+    }
+    
+    frag_chain = current_frag_chain;
+    nb_fixups = frag_chain->nb_fixups;
+    
+    frag = current_frag;
+    fixed_size = frag->fixed_size;
+    
+    errors = get_error_count ();
+    warnings = get_warning_count ();
+    
+    instruction_bytes_saved = 0;
+    last_instruction_stat = NULL;
+    
+    line = assemble_line (line);
+    
+    if (encoding_cache.count >= ENCODING_CACHE_MAX_ENTRIES) {
+    
+        free (key);
+        return line;
+    
+    }
+    
+    encoding = xmalloc (sizeof (*encoding));
     
-        if (xstrcasecmp (name, intel_operators[i].name) == 0) {
+    if (*line == '\0' && current_frag_chain == frag_chain && frag_chain->nb_fixups == nb_fixups && current_frag == frag
+        && get_error_count () == errors && get_warning_count () == warnings
+        && frag->fixed_size > fixed_size && frag->fixed_size - fixed_size <= MAX_ENCODING_SIZE
+        && encoding_is_cacheable (key->chars)) {
+    
+        encoding->size = frag->fixed_size - fixed_size;
+        memcpy (encoding->bytes, frag->buf + fixed_size, encoding->size);
         
-            if (operands != intel_operators[i].operands) {
-                return EXPR_TYPE_INVALID;
-            }
-            
-            return intel_operators[i].expr_type;
+        encoding->bytes_saved = instruction_bytes_saved;
+        encoding->flags_set = sets_all_flags (current_templates->name);
+        encoding->stat = last_instruction_stat;
         
-        }
+        encoding_stores++;
     
     }
     
-    return EXPR_TYPE_ABSENT;
+    key->chars = xstrdup (key->chars);
+    
+    if (hashtab_put (&encoding_cache, key, encoding)) {
+    
+        free ((char *) key->chars);
+        free (key);
+        free (encoding);
+    
+    }
+    
+    return line;
 
 }
 
-section_t machine_dependent_simplified_expression_read_into (char **pp, struct expr *expr) {
+void machine_dependent_macro_defined (const char *name) {
 
-    int ret;
-    section_t ret_section;
-    
-    if (!intel_syntax) {
-        return expression_read_into (pp, expr);
+    if (encoding_cache.count == 0) {
+        return;
     }
     
-    memset (&intel_state, 0, sizeof (intel_state));
-    intel_state.operand_modifier = EXPR_TYPE_ABSENT;
-    
-    instruction.operands = -1;
+    if (machine_dependent_is_register (name) || is_encoding_cache_keyword (name)) {
+        flush_encoding_cache ();
+    }
+
+}
+
+static int compare_instruction_stats (const void *a, const void *b) {
+
+    const struct instruction_stat *stat1 = *(const struct instruction_stat * const *) a;
+    const struct instruction_stat *stat2 = *(const struct instruction_stat * const *) b;
     
-    intel_syntax = -1;
+    int ret;
     
-    ret_section = expression_read_into (pp, expr);
-    ret = intel_simplify_expr (expr);
+    if ((ret = strcmp (stat1->mnemonic, stat2->mnemonic)) != 0) {
+        return ret;
+    }
     
-    intel_syntax = 1;
+    if (stat1->count != stat2->count) {
+        return (stat1->count > stat2->count) ? -1 : 1;
+    }
     
-    if (!ret) {
+    if (stat1->opcode != stat2->opcode) {
+        return (stat1->opcode < stat2->opcode) ? -1 : 1;
+    }
     
-        report (REPORT_ERROR, "bad machine-dependent expression");
-        expr->type = EXPR_TYPE_INVALID;
+    return (stat1->extension < stat2->extension) ? -1 : (stat1->extension > stat2->extension);
+
+}
+
+/** Returns the end of the run of templates sharing the mnemonic of instruction_stats[start]. */
+static unsigned long mnemonic_end (unsigned long start, unsigned long *count_p) {
+
+    unsigned long end;
+    *count_p = 0;
     
+    for (end = start; end < nb_instruction_stats && strcmp (instruction_stats[end]->mnemonic, instruction_stats[start]->mnemonic) == 0; end++) {
+        *count_p += instruction_stats[end]->count;
     }
     
-    return ret_section;
+    return end;
 
 }
 
-char *machine_dependent_assemble_line (char *line) {
+static void print_template (FILE *fp, const struct instruction_stat *stat) {
 
-    memset (&instruction, 0, sizeof (instruction));
-    memset (operand_exprs, 0, sizeof (operand_exprs));
-    
-    line = parse_instruction (line);
+    fprintf (fp, "%02lx", (unsigned long) stat->opcode);
     
-    if (current_templates == NULL || parse_operands (&line)) {
-        goto skip;
+    if (stat->extension != NONE) {
+        fprintf (fp, "/%lu", (unsigned long) stat->extension);
     }
+
+}
+
+static void print_name_counts (FILE *fp, const char **names, const unsigned long *counts, unsigned long nb, int json) {
+
+    unsigned long i;
     
-    if (current_templates[0].start->base_opcode == 0xC0 && instruction.operands == 2 && instruction.types[1] & IMM) {
+    for (i = 0; i < nb; i++) {
     
-        if (instruction.imms[1]->type == EXPR_TYPE_CONSTANT && instruction.imms[1]->add_number == 1) {
-            instruction.operands--;
+        if (json) {
+            fprintf (fp, "%s\"%s\": %lu", i ? ", " : "{ ", names[i], counts[i]);
+        } else {
+            fprintf (fp, "%s%s %lu", i ? ", " : "", names[i], counts[i]);
         }
     
     }
     
-    /**
-     * All Intel instructions have reversed operands except "bound" and some other.
-     * "ljmp" and "lcall" with 2 immediate operands also do not have operands reversed.
-     */
-    if (intel_syntax && instruction.operands > 1 && strcmp (current_templates->name, "bound") && !((instruction.types[0] & IMM) && (instruction.types[1] & IMM))) {
-        swap_operands ();
-    }
+    fprintf (fp, json ? " }" : "\n");
+
+}
+
+static void print_instruction_stats (FILE *fp) {
+
+    unsigned long i, j, end, count;
     
-    optimize_size_of_disps ();
-    optimize_size_of_imms ();
+    fprintf (fp, "instructions: %lu, %lu bytes", instructions_count, instructions_bytes);
     
-    if (match_template () || process_suffix () || finalize_imms ()) {
-        goto skip;
+    if (instructions_count) {
+        fprintf (fp, " (%lu.%02lu bytes on average)", instructions_bytes / instructions_count, ((instructions_bytes % instructions_count) * 100) / instructions_count);
     }
     
-    if (instruction.template.opcode_modifier & ADD_FWAIT) {
+    fprintf (fp, "\nprefixes: ");
+    print_name_counts (fp, prefix_stat_names, prefix_stats, ARRAY_SIZE (prefix_stat_names), 0);
     
-        if (!add_prefix (FWAIT_OPCODE)) {
-            goto skip;
-        }
+    fprintf (fp, "jumps emitted: ");
+    print_name_counts (fp, jump_type_names, jumps_emitted, ARRAY_SIZE (jump_type_names), 0);
     
-    }
+    fprintf (fp, "jumps relaxed: ");
+    print_name_counts (fp, jump_stat_names, jump_stats, ARRAY_SIZE (jump_stat_names), 0);
     
-    if (cpu_level < 3) {
+    qsort (instruction_stats, nb_instruction_stats, sizeof (*instruction_stats), &compare_instruction_stats);
     
-        if (instruction.suffix == DWORD_SUFFIX || instruction.template.minimum_cpu > cpu_level) {
+    for (i = 0; i < nb_instruction_stats; i = end) {
+    
+        end = mnemonic_end (i, &count);
+        fprintf (fp, "mnemonic %s: %lu (", instruction_stats[i]->mnemonic, count);
         
-            report (REPORT_ERROR, "no instruction for cpu level %d", cpu_level);
-            goto skip;
+        for (j = i; j < end; j++) {
+        
+            fprintf (fp, "%s", (j > i) ? ", " : "");
+            print_template (fp, instruction_stats[j]);
+            fprintf (fp, " %lu", instruction_stats[j]->count);
         
         }
+        
+        fprintf (fp, ")\n");
     
     }
+
+}
+
+void machine_dependent_print_stats_json (FILE *fp) {
+
+    unsigned long i, j, end, count;
     
-    if (instruction.template.operand_types[0] & IMPLICIT_REGISTER) {
-        instruction.reg_operands--;
-    }
-    
-    if (instruction.template.operand_types[1] & IMPLICIT_REGISTER) {
-        instruction.reg_operands--;
+    if (state->encoding_cache) {
+        fprintf (fp, ",\n    \"encoding_cache\": { \"lookups\": %lu, \"hits\": %lu, \"stored\": %lu, \"flushes\": %lu }", encoding_lookups, encoding_hits, encoding_stores, encoding_flushes);
     }
     
-    if (instruction.operands) {
+    if (state->optimize) {
     
-        if (process_operands ()) {
-            goto skip;
+        fprintf (fp, ",\n    \"optimize\": [");
+        
+        for (i = 0; i < nb_savings; ++i) {
+        
+            fprintf (fp, "%s\n        { \"section\": ", i ? "," : "");
+            print_json_string (fp, section_get_name (savings[i]->section));
+            fprintf (fp, ", \"bytes_saved\": %lu }", savings[i]->bytes);
+        
         }
+        
+        fprintf (fp, "%s]", nb_savings ? "\n    " : "");
     
     }
     
-    if (instruction.template.opcode_modifier & JUMP) {
-        output_jump ();
-    } else if (instruction.template.opcode_modifier & (CALL | JUMPBYTE)) {
-        output_call_or_jumpbyte ();
-    } else if (instruction.template.opcode_modifier & JUMPINTERSEGMENT) {
-        output_intersegment_jump ();
-    } else {
+    fprintf (fp, ",\n    \"instructions\": { \"count\": %lu, \"bytes\": %lu }", instructions_count, instructions_bytes);
     
-        uint32_t i;
-
-        for (i = 0; i < ARRAY_SIZE (instruction.prefixes); i++) {
-        
-            if (instruction.prefixes[i]) {
-                frag_append_1_char (instruction.prefixes[i]);
-            }
-        
-        }
-        
-        /*if (instruction.template.base_opcode == 0xff && instruction.template.extension_opcode < 6 && state->model >= 4) {
-            frag_append_1_char (0x2E);
-        }*/
-        
-        if (instruction.template.base_opcode & 0xff00) {
-            frag_append_1_char ((instruction.template.base_opcode >> 8) & 0xff);
-        }
+    fprintf (fp, ",\n    \"prefixes\": ");
+    print_name_counts (fp, prefix_stat_names, prefix_stats, ARRAY_SIZE (prefix_stat_names), 1);
+    
+    fprintf (fp, ",\n    \"jumps_emitted\": ");
+    print_name_counts (fp, jump_type_names, jumps_emitted, ARRAY_SIZE (jump_type_names), 1);
+    
+    fprintf (fp, ",\n    \"jumps_relaxed\": ");
+    print_name_counts (fp, jump_stat_names, jump_stats, ARRAY_SIZE (jump_stat_names), 1);
+    
+    qsort (instruction_stats, nb_instruction_stats, sizeof (*instruction_stats), &compare_instruction_stats);
+    fprintf (fp, ",\n    \"mnemonics\": [");
+    
+    for (i = 0; i < nb_instruction_stats; i = end) {
+    
+        end = mnemonic_end (i, &count);
         
-        frag_append_1_char (instruction.template.base_opcode & 0xff);
+        fprintf (fp, "%s\n        { \"mnemonic\": ", i ? "," : "");
+        print_json_string (fp, instruction_stats[i]->mnemonic);
+        fprintf (fp, ", \"count\": %lu, \"templates\": [", count);
         
-        if (instruction.template.opcode_modifier & MODRM) {
+        for (j = i; j < end; j++) {
         
-            frag_append_1_char (((instruction.modrm.regmem << 0) | (instruction.modrm.reg << 3) | (instruction.modrm.mode << 6)));
-            
-            if ((instruction.modrm.regmem == MODRM_REGMEM_TWO_BYTE_ADDRESSING) && (instruction.modrm.mode != 3) && !(instruction.base_reg && (instruction.base_reg->type & REG16))) {
-                frag_append_1_char (((instruction.sib.base << 0) | (instruction.sib.index << 3) | (instruction.sib.scale << 6)));
-            }
+            fprintf (fp, "%s{ \"opcode\": \"", (j > i) ? ", " : " ");
+            print_template (fp, instruction_stats[j]);
+            fprintf (fp, "\", \"count\": %lu }", instruction_stats[j]->count);
         
         }
         
-        output_disps ();
-        output_imms ();
+        fprintf (fp, " ] }");
     
     }
     
-    return line;
+    fprintf (fp, "%s]", nb_instruction_stats ? "\n    " : "");
+
+}
+
+void machine_dependent_print_stats (FILE *fp) {
+
+    unsigned long percent = 0, i;
     
-skip:
+    if (state->encoding_cache) {
     
-    while (*line != '\0') {
+        if (encoding_lookups) {
+            percent = (encoding_hits * 100) / encoding_lookups;
+        }
+        
+        fprintf (fp, "encoding cache: %lu lookups, %lu hits (%lu%%), %lu entries stored, %lu flushes\n", encoding_lookups, encoding_hits, percent, encoding_stores, encoding_flushes);
     
-        if (line[0] == '#') {
-            break;
+    }
+    
+    if (state->optimize) {
+    
+        if (nb_savings == 0) {
+            fprintf (fp, "optimize: no bytes saved\n");
         }
         
-        ++(line);
+        for (i = 0; i < nb_savings; ++i) {
+            fprintf (fp, "optimize: %lu bytes saved in section %s\n", savings[i]->bytes, section_get_name (savings[i]->section));
+        }
     
     }
     
-    return line;
+    print_instruction_stats (fp);
 
 }
 
@@ -4359,30 +5637,7 @@ int machine_dependent_get_cpu (void) {
 }
 
 int machine_dependent_is_register (const char *p) {
-
-    struct hashtab_name *key;
-    
-    char *new_p = to_lower (p);
-    int is_reg = 0;
-    
-    if (new_p == NULL) {
-        return is_reg;
-    }
-    
-    if ((key = hashtab_alloc_name (new_p)) == NULL) {
-    
-        free (new_p);
-        return is_reg;
-    
-    }
-    
-    is_reg = (hashtab_get (&reg_entry_hashtab, key) != NULL);
-    
-    free (key);
-    free (new_p);
-    
-    return is_reg;
-
+    return (hashtab_get_lowercase (&reg_entry_hashtab, p) != NULL);
 }
 
 int machine_dependent_need_index_operator (void) {
@@ -4424,6 +5679,23 @@ int machine_dependent_parse_name (char **pp, struct expr *expr, char *name, char
 
 }
 
+/** Relaxation is shared by all outputs, so COFF restrictions apply as soon as any output is COFF. */
+static int coff_output_requested (void) {
+
+    unsigned long i;
+    
+    for (i = 0; i < state->nb_outputs; ++i) {
+    
+        if (strcmp (state->outputs[i]->format, "coff") == 0) {
+            return 1;
+        }
+    
+    }
+    
+    return 0;
+
+}
+
 long machine_dependent_estimate_size_before_relax (struct frag *frag, section_t section) {
 
     if (symbol_get_section (frag->symbol) != section) {
@@ -4439,7 +5711,7 @@ long machine_dependent_estimate_size_before_relax (struct frag *frag, section_t
             
                 *opcode_pos = 0xE9;
                 
-                fixup_new (frag, frag->fixed_size, size, frag->symbol, frag->offset, 1, RELOC_TYPE_DEFAULT, 0);
+                fixup_new_in_section (section, frag, frag->fixed_size, size, frag->symbol, frag->offset, 1, RELOC_TYPE_DEFAULT, 0);
                 frag->fixed_size += size;
                 
                 break;
@@ -4456,7 +5728,7 @@ long machine_dependent_estimate_size_before_relax (struct frag *frag, section_t
                     opcode_pos[2] = 0xE9;
                     
                     frag->fixed_size += 4;
-                    fixup_new (frag, old_frag_fixed_size + 2, size, frag->symbol, frag->offset, 1, RELOC_TYPE_DEFAULT, 0);
+                    fixup_new_in_section (section, frag, old_frag_fixed_size + 2, size, frag->symbol, frag->offset, 1, RELOC_TYPE_DEFAULT, 0);
                     
                     break;
                 
@@ -4469,14 +5741,14 @@ long machine_dependent_estimate_size_before_relax (struct frag *frag, section_t
                 opcode_pos[1] = opcode_pos[0] + 0x10;
                 opcode_pos[0] = TWOBYTE_OPCODE;
                 
-                fixup_new (frag, frag->fixed_size + 1, size, frag->symbol, frag->offset, 1, RELOC_TYPE_DEFAULT, 0);
+                fixup_new_in_section (section, frag, frag->fixed_size + 1, size, frag->symbol, frag->offset, 1, RELOC_TYPE_DEFAULT, 0);
                 frag->fixed_size += size + 1;
                 
                 break;
             
             case RELAX_SUBTYPE_FORCED_SHORT_JUMP:
             
-                if (strcmp (state->format, "coff") == 0) {
+                if (coff_output_requested ()) {
                 
                     report_at (frag->filename, frag->line_number, REPORT_FATAL_ERROR, "forced short jump with target in different section (origin section %s and target section %s) is not supported for COFF", section_get_name (section), section_get_name (symbol_get_section (frag->symbol)));
                     exit (EXIT_FAILURE);
@@ -4485,7 +5757,7 @@ long machine_dependent_estimate_size_before_relax (struct frag *frag, section_t
                 
                 size = 1;
                 
-                fixup_new (frag, frag->fixed_size, size, frag->symbol, frag->offset, 1, RELOC_TYPE_DEFAULT, 0);
+                fixup_new_in_section (section, frag, frag->fixed_size, size, frag->symbol, frag->offset, 1, RELOC_TYPE_DEFAULT, 0);
                 frag->fixed_size += size;
                 
                 break;
@@ -4498,6 +5770,14 @@ long machine_dependent_estimate_size_before_relax (struct frag *frag, section_t
         }
         
         frag->relax_type = RELAX_TYPE_NONE_NEEDED;
+        
+        if (collect_stats) {
+        
+            instructions_bytes += frag->fixed_size - old_frag_fixed_size;
+            jump_stats[JUMP_STAT_OTHER_SECTION]++;
+        
+        }
+        
         return frag->fixed_size - old_frag_fixed_size;
     
     }
@@ -4563,6 +5843,27 @@ long machine_dependent_relax_frag (struct frag *frag, section_t section, long ch
 
 }
 
+/**
+ * Starts the relaxation of frag from subtype instead of the shortest form
+ * if subtype is one of the forms frag can grow into.  Returns 0 otherwise.
+ */
+int machine_dependent_relax_frag_seed (struct frag *frag, relax_subtype_t subtype) {
+
+    relax_subtype_t new_subtype;
+    
+    for (new_subtype = frag->relax_subtype; new_subtype != subtype; new_subtype = relax_table[new_subtype].next_subtype) {
+    
+        if (!relax_table[new_subtype].next_subtype) {
+            return 0;
+        }
+    
+    }
+    
+    frag->relax_subtype = subtype;
+    return 1;
+
+}
+
 void machine_dependent_apply_fixup (struct fixup *fixup, unsigned long value) {
 
     unsigned char *p = fixup->frag->buf + fixup->where;
@@ -4610,6 +5911,115 @@ void machine_dependent_apply_fixup (struct fixup *fixup, unsigned long value) {
 
 }
 
+/**
+ * No-ops used to pad code up to an alignment, indexed by length.  16-bit
+ * code gets forms every 8086 executes, 32-bit code the lea forms of the
+ * 386 and the 686 the 0F 1F long no-ops, so that padding is decoded as
+ * few instructions as possible.
+ */
+static const unsigned char nop16_1[] = { 0x90 };                                                            /* nop */
+static const unsigned char nop16_2[] = { 0x89, 0xF6 };                                                      /* mov si, si */
+static const unsigned char nop16_3[] = { 0x8D, 0x74, 0x00 };                                                /* lea si, [si + 0] */
+static const unsigned char nop16_4[] = { 0x8D, 0xB4, 0x00, 0x00 };                                          /* lea si, [si + word 0] */
+
+static const unsigned char nop32_1[] = { 0x90 };                                                            /* nop */
+static const unsigned char nop32_2[] = { 0x66, 0x90 };                                                      /* xchg ax, ax */
+static const unsigned char nop32_3[] = { 0x8D, 0x76, 0x00 };                                                /* lea esi, [esi + 0] */
+static const unsigned char nop32_4[] = { 0x8D, 0x74, 0x26, 0x00 };                                          /* lea esi, [esi * 1 + 0] */
+static const unsigned char nop32_6[] = { 0x8D, 0xB6, 0x00, 0x00, 0x00, 0x00 };                              /* lea esi, [esi + dword 0] */
+static const unsigned char nop32_7[] = { 0x8D, 0xB4, 0x26, 0x00, 0x00, 0x00, 0x00 };                        /* lea esi, [esi * 1 + dword 0] */
+
+static const unsigned char nop686_16_1[] = { 0x90 };                                                        /* nop */
+static const unsigned char nop686_16_2[] = { 0x66, 0x90 };                                                  /* xchg eax, eax */
+static const unsigned char nop686_16_3[] = { 0x0F, 0x1F, 0x00 };                                            /* nop word [bx + si] */
+static const unsigned char nop686_16_4[] = { 0x0F, 0x1F, 0x40, 0x00 };                                      /* nop word [bx + si + 0] */
+static const unsigned char nop686_16_5[] = { 0x0F, 0x1F, 0x80, 0x00, 0x00 };                                /* nop word [bx + si + word 0] */
+static const unsigned char nop686_16_6[] = { 0x66, 0x0F, 0x1F, 0x80, 0x00, 0x00 };                          /* nop dword [bx + si + word 0] */
+
+static const unsigned char nop686_32_1[] = { 0x90 };                                                        /* nop */
+static const unsigned char nop686_32_2[] = { 0x66, 0x90 };                                                  /* xchg ax, ax */
+static const unsigned char nop686_32_3[] = { 0x0F, 0x1F, 0x00 };                                            /* nop dword [eax] */
+static const unsigned char nop686_32_4[] = { 0x0F, 0x1F, 0x40, 0x00 };                                      /* nop dword [eax + 0] */
+static const unsigned char nop686_32_5[] = { 0x0F, 0x1F, 0x44, 0x00, 0x00 };                                /* nop dword [eax + eax * 1 + 0] */
+static const unsigned char nop686_32_6[] = { 0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00 };                          /* nop word [eax + eax * 1 + 0] */
+static const unsigned char nop686_32_7[] = { 0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00 };                    /* nop dword [eax + dword 0] */
+static const unsigned char nop686_32_8[] = { 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 };              /* nop dword [eax + eax * 1 + dword 0] */
+static const unsigned char nop686_32_9[] = { 0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 };        /* nop word [eax + eax * 1 + dword 0] */
+
+static const unsigned char *const nops16[] = { NULL, nop16_1, nop16_2, nop16_3, nop16_4 };
+static const unsigned char *const nops32[] = { NULL, nop32_1, nop32_2, nop32_3, nop32_4, NULL, nop32_6, nop32_7 };
+static const unsigned char *const nops686_16[] = { NULL, nop686_16_1, nop686_16_2, nop686_16_3, nop686_16_4, nop686_16_5, nop686_16_6 };
+static const unsigned char *const nops686_32[] = { NULL, nop686_32_1, nop686_32_2, nop686_32_3, nop686_32_4, nop686_32_5, nop686_32_6, nop686_32_7, nop686_32_8, nop686_32_9 };
+
+/**
+ * Fills the count bytes of padding at p of a RELAX_TYPE_ALIGN_CODE frag
+ * with the longest no-ops allowed by the mode and cpu level in effect
+ * where the alignment was requested.  Padding that would need more than
+ * two no-ops is jumped over instead.
+ */
+void machine_dependent_fill_code_alignment (const struct frag *frag, unsigned char *p, offset_t count) {
+
+    const unsigned char *const *nops;
+    offset_t max_nop, size;
+    
+    if (frag->code_cpu >= 6) {
+    
+        nops = (frag->code_bits == 32) ? nops686_32 : nops686_16;
+        max_nop = (frag->code_bits == 32) ? (offset_t) ARRAY_SIZE (nops686_32) - 1 : (offset_t) ARRAY_SIZE (nops686_16) - 1;
+    
+    } else if (frag->code_bits == 32) {
+    
+        nops = nops32;
+        max_nop = ARRAY_SIZE (nops32) - 1;
+    
+    } else {
+    
+        nops = nops16;
+        max_nop = ARRAY_SIZE (nops16) - 1;
+    
+    }
+    
+    if (count > 2 * max_nop) {
+    
+        memset (p, 0x90, count);
+        
+        if (count - 2 <= 127) {
+        
+            p[0] = 0xEB;
+            p[1] = count - 2;
+        
+        } else if (frag->code_bits == 32) {
+        
+            p[0] = 0xE9;
+            machine_dependent_number_to_chars (p + 1, count - 5, 4);
+        
+        } else {
+        
+            p[0] = 0xE9;
+            machine_dependent_number_to_chars (p + 1, count - 3, 2);
+        
+        }
+        
+        return;
+    
+    }
+    
+    while (count > 0) {
+    
+        /* Splits what is left so that neither part needs a missing length. */
+        for (size = (count > max_nop ? max_nop : count); !nops[size] || count - size > max_nop || (count - size && !nops[count - size]); size--) {
+            ;
+        }
+        
+        memcpy (p, nops[size], size);
+        
+        p += size;
+        count -= size;
+    
+    }
+
+}
+
 void machine_dependent_finish_frag (struct frag *frag) {
 
     unsigned char *opcode_pos;
@@ -4683,12 +6093,28 @@ void machine_dependent_finish_frag (struct frag *frag) {
     
     size = DISPLACEMENT_SIZE_FROM_RELAX_SUBSTATE (frag->relax_subtype);
     displacement -= extension;
+    
+    count_jump_relaxed (frag->relax_subtype, extension);
 
     machine_dependent_number_to_chars (displacement_pos, displacement, size);
     frag->fixed_size += extension;
 
 }
 
+static void add_intel_keyword (struct hashtab *table, const char *name, const void *entry) {
+
+    struct hashtab_name *key;
+    char *p;
+    
+    if ((p = to_lower (name)) == NULL || (key = hashtab_alloc_name (p)) == NULL || hashtab_put (table, key, (void *) entry) < 0) {
+    
+        report_at (program_name, 0, REPORT_INTERNAL_ERROR, "failed to insert %s into keyword table", name);
+        exit (EXIT_FAILURE);
+    
+    }
+
+}
+
 void machine_dependent_init (void) {
 
     struct template *template;
@@ -4700,6 +6126,7 @@ void machine_dependent_init (void) {
     
     int c;
     
+    collect_stats = (state->stats || state->stats_json);
     template = template_table;
     
     templates = xmalloc (sizeof (*templates));
@@ -4713,6 +6140,7 @@ void machine_dependent_init (void) {
         if (template->name == NULL || strcmp (template->name, (template - 1)->name)) {
         
             templates->end = template;
+            templates->index = build_template_index (templates);
             
             if ((key = hashtab_alloc_name (templates->name)) == NULL) {
                 continue;
@@ -4784,6 +6212,14 @@ void machine_dependent_init (void) {
     
     }
     
+    for (c = 0; intel_types[c].name; c++) {
+        add_intel_keyword (&intel_types_hashtab, intel_types[c].name, &intel_types[c]);
+    }
+    
+    for (c = 0; intel_operators[c].name; c++) {
+        add_intel_keyword (&intel_operators_hashtab, intel_operators[c].name, &intel_operators[c]);
+    }
+    
     /* Fills lexical table. */
     for (c = 0; c < 256; c++) {
     
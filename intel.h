@@ -166,9 +166,37 @@ struct sib_byte {
 #define     BWL_SUF                     (NO_SSUF | NO_QSUF | NO_INTELSUF)
 #define     SL_SUF                      (NO_BSUF | NO_WSUF | NO_QSUF | NO_INTELSUF)
 
+#include    <stdio.h>
+
 #include    "expr.h"
 #include    "types.h"
 
+#define     MACHINE_DEPENDENT_OPERAND_REGISTER          1
+#define     MACHINE_DEPENDENT_OPERAND_IMMEDIATE         2
+#define     MACHINE_DEPENDENT_OPERAND_MEMORY            3
+
+/**
+ * Operand of machine_dependent_emit_instruction.  Register operands use
+ * reg, immediates use value and memory operands use reg and index_reg as
+ * the base and index registers (either may be NULL) and value as the
+ * displacement.
+ */
+struct machine_dependent_operand {
+
+    int kind;
+    
+    const struct reg_entry *reg, *index_reg;
+    value_t value;
+
+};
+
+struct templates;
+
+const struct reg_entry *machine_dependent_find_register (const char *name);
+const struct templates *machine_dependent_find_mnemonic (const char *name);
+
+int machine_dependent_emit_instruction (const struct templates *mnemonic, const struct machine_dependent_operand *operands, int nb_operands);
+
 enum expr_type machine_dependent_parse_operator (char **pp, char *name, char *original_saved_c, uint32_t operands);
 section_t machine_dependent_simplified_expression_read_into (char **pp, struct expr *expr);
 
@@ -180,6 +208,7 @@ int machine_dependent_get_cpu (void);
 int machine_dependent_is_register (const char *p);
 int machine_dependent_need_index_operator (void);
 int machine_dependent_parse_name (char **pp, struct expr *expr, char *name, char *original_saved_c);
+int machine_dependent_relax_frag_seed (struct frag *frag, relax_subtype_t subtype);
 
 long machine_dependent_estimate_size_before_relax (struct frag *frag, section_t section);
 long machine_dependent_pcrel_from (struct fixup *fixup);
@@ -187,9 +216,13 @@ long machine_dependent_relax_frag (struct frag *frag, section_t section, long ch
 
 void machine_dependent_number_to_chars (unsigned char *p, unsigned long number, unsigned long size);
 void machine_dependent_apply_fixup (fixup_t fixup, unsigned long value);
+void machine_dependent_fill_code_alignment (const struct frag *frag, unsigned char *p, offset_t count);
 void machine_dependent_finish_frag (frag_t frag);
 void machine_dependent_init (void);
+void machine_dependent_macro_defined (const char *name);
 void machine_dependent_parse_operand (char **pp, struct expr *expr);
+void machine_dependent_print_stats (FILE *fp);
+void machine_dependent_print_stats_json (FILE *fp);
 void machine_dependent_set_bits (int bits);
 void machine_dependent_set_cpu (int bits);
 
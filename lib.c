@@ -10,8 +10,13 @@
 #include    "as.h"
 #include    "cstr.h"
 #include    "lib.h"
+#include    "parallel.h"
 #include    "report.h"
 
+#if     defined (__unix__) || defined (__APPLE__)
+# include   <sys/resource.h>
+#endif
+
 struct option {
 
     const char *name;
@@ -26,30 +31,60 @@ enum options {
 
     OPTION_IGNORED = 0,
     OPTION_DEFINE,
+    OPTION_DIAG_JSON,
+    OPTION_ENCODING_CACHE,
+    OPTION_ERROR_LIMIT,
     OPTION_FORMAT,
     OPTION_HELP,
     OPTION_INCLUDE,
+    OPTION_JOBS,
     OPTION_KEEP_LOCALS,
     OPTION_LISTING,
+    OPTION_MD,
+    OPTION_MF,
+    OPTION_MP,
     OPTION_NOWARN,
-    OPTION_OUTFILE
+    OPTION_OPTIMIZE,
+    OPTION_OUTFILE,
+    OPTION_RELAX_HINTS,
+    OPTION_STATS,
+    OPTION_STATS_JSON,
+    OPTION_TRACE,
+    OPTION_WARNING_LIMIT,
+    OPTION_WRITE_IF_CHANGED
 
 };
 
 static struct option opts[] = {
 
-    { "D",              OPTION_DEFINE,      OPTION_HAS_ARG  },
-    { "I",              OPTION_INCLUDE,     OPTION_HAS_ARG  },
-    { "L",              OPTION_KEEP_LOCALS, OPTION_NO_ARG   },
-    
-    { "f",              OPTION_FORMAT,      OPTION_HAS_ARG  },
-    { "l",              OPTION_LISTING,     OPTION_HAS_ARG  },
-    { "o",              OPTION_OUTFILE,     OPTION_HAS_ARG  },
-    
-    { "-keep-locals",   OPTION_KEEP_LOCALS, OPTION_NO_ARG   },
-    { "-nowarn",        OPTION_NOWARN,      OPTION_NO_ARG   },
-    { "-help",          OPTION_HELP,        OPTION_NO_ARG   },
-    { 0,                0,                  0               }
+    { "D",                  OPTION_DEFINE,            OPTION_HAS_ARG  },
+    { "I",                  OPTION_INCLUDE,           OPTION_HAS_ARG  },
+    { "L",                  OPTION_KEEP_LOCALS,       OPTION_NO_ARG   },
+    
+    { "MD",                 OPTION_MD,                OPTION_NO_ARG   },
+    { "MF",                 OPTION_MF,                OPTION_HAS_ARG  },
+    { "MP",                 OPTION_MP,                OPTION_NO_ARG   },
+    
+    { "O",                  OPTION_OPTIMIZE,          OPTION_NO_ARG   },
+    
+    { "f",                  OPTION_FORMAT,            OPTION_HAS_ARG  },
+    { "j",                  OPTION_JOBS,              OPTION_HAS_ARG  },
+    { "l",                  OPTION_LISTING,           OPTION_HAS_ARG  },
+    { "o",                  OPTION_OUTFILE,           OPTION_HAS_ARG  },
+    
+    { "-diag-json",         OPTION_DIAG_JSON,         OPTION_HAS_ARG  },
+    { "-encoding-cache",    OPTION_ENCODING_CACHE,    OPTION_NO_ARG   },
+    { "-error-limit",       OPTION_ERROR_LIMIT,       OPTION_HAS_ARG  },
+    { "-keep-locals",       OPTION_KEEP_LOCALS,       OPTION_NO_ARG   },
+    { "-nowarn",            OPTION_NOWARN,            OPTION_NO_ARG   },
+    { "-relax-hints",       OPTION_RELAX_HINTS,       OPTION_HAS_ARG  },
+    { "-stats-json",        OPTION_STATS_JSON,        OPTION_HAS_ARG  },
+    { "-stats",             OPTION_STATS,             OPTION_NO_ARG   },
+    { "-trace",             OPTION_TRACE,             OPTION_HAS_ARG  },
+    { "-warning-limit",     OPTION_WARNING_LIMIT,     OPTION_HAS_ARG  },
+    { "-write-if-changed",  OPTION_WRITE_IF_CHANGED,  OPTION_NO_ARG   },
+    { "-help",              OPTION_HELP,              OPTION_NO_ARG   },
+    { 0,                    0,                        0               }
 
 };
 
@@ -84,6 +119,49 @@ static void add_include_path (const char *pathname) {
 
 }
 
+static void add_output (const char *format, const char *filename) {
+
+    struct output *output;
+    unsigned long i;
+    
+    for (i = 0; i < state->nb_outputs; ++i) {
+    
+        if (strcmp (state->outputs[i]->filename, filename) == 0) {
+        
+            report_at (program_name, 0, REPORT_ERROR, "output file '%s' provided more than once", filename);
+            exit (EXIT_FAILURE);
+        
+        }
+    
+    }
+    
+    output = xmalloc (sizeof (*output));
+    
+    output->format = format;
+    output->filename = xstrdup (filename);
+    
+    dynarray_add (&state->outputs, &state->nb_outputs, output);
+
+}
+
+static unsigned long parse_limit (const char *option, const char *arg) {
+
+    unsigned long limit;
+    char *end;
+    
+    limit = strtoul (arg, &end, 10);
+    
+    if (end == arg || *end != '\0') {
+    
+        report_at (program_name, 0, REPORT_ERROR, "invalid number '%s' for '%s'", arg, option);
+        exit (EXIT_FAILURE);
+    
+    }
+    
+    return limit;
+
+}
+
 static void print_help (void) {
 
     if (!program_name) {
@@ -97,12 +175,34 @@ static void print_help (void) {
     fprintf (stderr, "    -I DIR                Add DIR to search list for .include directives\n");
     fprintf (stderr, "    -L, --keep-locals     Keep local symbols (e.g. starting with `L')\n");
     
+    fprintf (stderr, "    -MD                   Write a make dependency file next to the object file\n");
+    fprintf (stderr, "    -MF FILE              Write the make dependency file to FILE\n");
+    fprintf (stderr, "    -MP                   Add an empty rule for each included file\n");
+    
+    fprintf (stderr, "    -O                    Pick shorter encodings where the effect is the same\n");
+    fprintf (stderr, "                              and pad code alignment with multi-byte no-ops\n");
+    
     fprintf (stderr, "    -f FORMAT             Create an output file in format FORMAT (default a.out)\n");
     fprintf (stderr, "                              Supported formats are: a.out, coff\n");
+    fprintf (stderr, "    -f FORMAT=OBJFILE     Also write OBJFILE in format FORMAT (may be repeated)\n");
+    
+#if     defined (AS86_THREADS)
+    fprintf (stderr, "    -j JOBS               Relax and fix up as many as JOBS sections at once\n");
+#endif
+    
     fprintf (stderr, "    -l FILE               Print listings to file FILE\n");
     fprintf (stderr, "    -o OBJFILE            Name the object-file output OBJFILE (default a.out)\n");
     
+    fprintf (stderr, "    --diag-json FILE      Also write each diagnostic to FILE as a line of JSON\n");
+    fprintf (stderr, "    --encoding-cache      Reuse the encoding of repeated register/constant-only instructions\n");
+    fprintf (stderr, "    --error-limit N       Stop showing errors after the first N (0 for no limit)\n");
     fprintf (stderr, "    --nowarn              Suppress warnings\n");
+    fprintf (stderr, "    --relax-hints FILE    Start jump relaxation from the sizes saved in FILE and update it\n");
+    fprintf (stderr, "    --stats               Print assembler statistics to stderr\n");
+    fprintf (stderr, "    --stats-json FILE     Write the same statistics to FILE as JSON\n");
+    fprintf (stderr, "    --trace FILE          Write the time spent in each file and phase to FILE as Chrome trace events\n");
+    fprintf (stderr, "    --warning-limit N     Stop showing warnings after the first N (0 for no limit)\n");
+    fprintf (stderr, "    --write-if-changed    Leave object files alone when their contents would not change\n");
     fprintf (stderr, "    --help                Print this help information\n");
     fprintf (stderr, "\n");
     
@@ -112,6 +212,38 @@ _exit:
 
 }
 
+/** Returns a copy of filename with its extension, if any, replaced by ext. */
+char *replace_extension (const char *filename, const char *ext) {
+
+    const char *base = filename, *old_ext = NULL, *p;
+    char *new_filename;
+    
+    for (p = filename; *p; ++p) {
+    
+        if (*p == '/' || *p == '\\' || *p == ':') {
+        
+            base = p + 1;
+            old_ext = NULL;
+        
+        } else if (*p == '.' && p != base) {
+            old_ext = p;
+        }
+    
+    }
+    
+    if (!old_ext) {
+        old_ext = p;
+    }
+    
+    new_filename = xmalloc ((old_ext - filename) + strlen (ext) + 1);
+    
+    memcpy (new_filename, filename, old_ext - filename);
+    strcpy (new_filename + (old_ext - filename), ext);
+    
+    return new_filename;
+
+}
+
 char *skip_whitespace (char *p) {
     return *p == ' ' ? (p + 1) : p;
 }
@@ -135,12 +267,7 @@ char *to_lower (const char *str) {
 }
 
 char *xstrdup (const char *str) {
-
-    char *ptr = xmalloc (strlen (str) + 1);
-    strcpy (ptr, str);
-    
-    return ptr;
-
+    return xstrdup_for (MEM_OTHER, str);
 }
 
 int strstart (const char *val, const char **str) {
@@ -216,7 +343,80 @@ int xstrncasecmp (const char *s1, const char *s2, unsigned long n) {
 
 }
 
-void *xmalloc (unsigned long size) {
+/**
+ * Heap accounting.
+ *
+ * Allocations made through the *_for variants are charged to a category,
+ * and the owner reports what it frees with mem_account, so that the bytes
+ * held and their peak are known for each category.  Everything else is
+ * charged to MEM_OTHER, whose frees are not seen; only the number of
+ * allocations and the bytes requested are meaningful for it.
+ */
+struct mem_category {
+
+    unsigned long allocations, requested;
+    unsigned long bytes, peak;
+
+};
+
+static const char *mem_category_names[MEM_CATEGORIES] = {
+
+    "other",
+    "frags",
+    "frag_buffers",
+    "fixups",
+    "symbols",
+    "expr_symbols",
+    "listing",
+    "macros",
+    "hash_tables",
+    "load_line"
+
+};
+
+static struct mem_category mem_categories[MEM_CATEGORIES];
+static unsigned long mem_bytes = 0, mem_peak = 0;
+
+void mem_account (int category, unsigned long allocated, unsigned long freed) {
+
+    struct mem_category *cat = &mem_categories[category];
+    
+    /* Sections being worked on side by side still allocate through here. */
+    parallel_lock ();
+    
+    if (allocated) {
+    
+        cat->allocations++;
+        cat->requested += allocated;
+    
+    }
+    
+    if (category == MEM_OTHER) {
+    
+        parallel_unlock ();
+        return;
+    
+    }
+    
+    cat->bytes += allocated;
+    mem_bytes += allocated;
+    
+    cat->bytes -= (freed < cat->bytes ? freed : cat->bytes);
+    mem_bytes -= (freed < mem_bytes ? freed : mem_bytes);
+    
+    if (cat->bytes > cat->peak) {
+        cat->peak = cat->bytes;
+    }
+    
+    if (mem_bytes > mem_peak) {
+        mem_peak = mem_bytes;
+    }
+    
+    parallel_unlock ();
+
+}
+
+void *xmalloc_for (int category, unsigned long size) {
 
     void *ptr = malloc (size);
     
@@ -228,11 +428,13 @@ void *xmalloc (unsigned long size) {
     }
     
     memset (ptr, 0, size);
+    mem_account (category, size, 0);
+    
     return ptr;
 
 }
 
-void *xrealloc (void *ptr, unsigned long size) {
+void *xrealloc_for (int category, void *ptr, unsigned long old_size, unsigned long size) {
 
     void *new_ptr = realloc (ptr, size);
     
@@ -243,10 +445,111 @@ void *xrealloc (void *ptr, unsigned long size) {
     
     }
     
+    mem_account (category, size, old_size);
     return new_ptr;
 
 }
 
+char *xstrdup_for (int category, const char *str) {
+
+    char *ptr = xmalloc_for (category, strlen (str) + 1);
+    strcpy (ptr, str);
+    
+    return ptr;
+
+}
+
+void *xmalloc (unsigned long size) {
+    return xmalloc_for (MEM_OTHER, size);
+}
+
+void *xrealloc (void *ptr, unsigned long size) {
+    return xrealloc_for (MEM_OTHER, ptr, 0, size);
+}
+
+/** Returns the peak resident set size of the process in kilobytes, or 0 where it is not known. */
+static unsigned long peak_rss (void) {
+
+#if     defined (__unix__) || defined (__APPLE__)
+
+    struct rusage usage;
+    
+    if (getrusage (RUSAGE_SELF, &usage)) {
+        return 0;
+    }
+    
+#if     defined (__APPLE__)
+    return (unsigned long) usage.ru_maxrss / 1024;
+#else
+    return (unsigned long) usage.ru_maxrss;
+#endif
+
+#else
+
+    return 0;
+
+#endif
+
+}
+
+void mem_print_stats (FILE *fp) {
+
+    unsigned long rss = peak_rss ();
+    int i;
+    
+    for (i = 0; i < MEM_CATEGORIES; ++i) {
+    
+        struct mem_category *cat = &mem_categories[i];
+        
+        if (i == MEM_OTHER) {
+            fprintf (fp, "memory %s: %lu allocations, %lu bytes requested\n", mem_category_names[i], cat->allocations, cat->requested);
+        } else {
+            fprintf (fp, "memory %s: %lu allocations, %lu bytes held, %lu bytes peak\n", mem_category_names[i], cat->allocations, cat->bytes, cat->peak);
+        }
+    
+    }
+    
+    fprintf (fp, "memory peak: %lu bytes in the categories above", mem_peak);
+    
+    if (rss) {
+        fprintf (fp, ", %lu KB resident", rss);
+    }
+    
+    fprintf (fp, "\n");
+
+}
+
+void mem_print_stats_json (FILE *fp) {
+
+    unsigned long rss = peak_rss ();
+    int i;
+    
+    fprintf (fp, ",\n    \"memory\": {");
+    
+    for (i = 0; i < MEM_CATEGORIES; ++i) {
+    
+        struct mem_category *cat = &mem_categories[i];
+        
+        if (i == MEM_OTHER) {
+            fprintf (fp, "\n        \"%s\": { \"allocations\": %lu, \"requested\": %lu },", mem_category_names[i], cat->allocations, cat->requested);
+        } else {
+            fprintf (fp, "\n        \"%s\": { \"allocations\": %lu, \"bytes\": %lu, \"peak\": %lu },", mem_category_names[i], cat->allocations, cat->bytes, cat->peak);
+        }
+    
+    }
+    
+    fprintf (fp, "\n        \"peak\": %lu,\n        \"peak_rss_kb\": ", mem_peak);
+    
+    if (rss) {
+        fprintf (fp, "%lu", rss);
+    } else {
+        fprintf (fp, "null");
+    }
+    
+    fprintf (fp, "\n    }");
+
+}
+
 void dynarray_add (void *ptab, unsigned long *nb_ptr, void *data) {
 
     int32_t nb, nb_alloc;
@@ -346,21 +649,51 @@ void parse_args (int *pargc, char ***pargv, int optind) {
             
             }
             
+            case OPTION_DIAG_JSON: {
+            
+                state->diag_json = xstrdup (optarg);
+                break;
+            
+            }
+            
+            case OPTION_ENCODING_CACHE: {
+            
+                state->encoding_cache = 1;
+                break;
+            
+            }
+            
+            case OPTION_ERROR_LIMIT: {
+            
+                state->error_limit = parse_limit (r, optarg);
+                break;
+            
+            }
+            
             case OPTION_FORMAT: {
             
-                char *format = to_lower (optarg);
+                char *format = to_lower (optarg), *filename;
+                
+                if ((filename = strchr (format, '='))) {
+                    *filename = '\0';
+                }
                 
-                if (strcmp (format, "a.out") == 0) {
-                    state->format = format;
-                } else if (strcmp (format, "coff") == 0) {
-                    state->format = format;
-                } else {
+                if (strcmp (format, "a.out") != 0 && strcmp (format, "coff") != 0) {
                 
-                    report_at (program_name, 0, REPORT_ERROR, "unsupported format '%s' specified", optarg);
+                    report_at (program_name, 0, REPORT_ERROR, "unsupported format '%s' specified", format);
                     exit (EXIT_FAILURE);
                 
                 }
                 
+                if (filename) {
+                
+                    /* Takes the file name from optarg as to_lower has lowercased the copy. */
+                    add_output (format, optarg + (filename - format) + 1);
+                    break;
+                
+                }
+                
+                state->format = format;
                 break;
             
             }
@@ -379,6 +712,20 @@ void parse_args (int *pargc, char ***pargv, int optind) {
             
             }
             
+            case OPTION_JOBS: {
+            
+                state->jobs = parse_limit (r, optarg);
+                
+#if     !defined (AS86_THREADS)
+                if (state->jobs > 1) {
+                    report_at (program_name, 0, REPORT_WARNING, "'%s' has no effect as threads are not supported by this build", r);
+                }
+#endif
+                
+                break;
+            
+            }
+            
             case OPTION_KEEP_LOCALS: {
             
                 state->keep_locals = 1;
@@ -400,6 +747,36 @@ void parse_args (int *pargc, char ***pargv, int optind) {
             
             }
             
+            case OPTION_MD: {
+            
+                state->make_deps = 1;
+                break;
+            
+            }
+            
+            case OPTION_MF: {
+            
+                if (state->dep_file) {
+                
+                    report_at (program_name, 0, REPORT_ERROR, "multiple dependency files provided");
+                    exit (EXIT_FAILURE);
+                
+                }
+                
+                state->dep_file = xstrdup (optarg);
+                state->make_deps = 1;
+                
+                break;
+            
+            }
+            
+            case OPTION_MP: {
+            
+                state->dep_phony = 1;
+                break;
+            
+            }
+            
             case OPTION_NOWARN: {
             
                 state->nowarn = 1;
@@ -407,6 +784,13 @@ void parse_args (int *pargc, char ***pargv, int optind) {
             
             }
             
+            case OPTION_OPTIMIZE: {
+            
+                state->optimize = 1;
+                break;
+            
+            }
+            
             case OPTION_OUTFILE: {
             
                 if (state->outfile) {
@@ -421,6 +805,55 @@ void parse_args (int *pargc, char ***pargv, int optind) {
             
             }
             
+            case OPTION_RELAX_HINTS: {
+            
+                if (state->relax_hints) {
+                
+                    report_at (program_name, 0, REPORT_ERROR, "multiple relaxation hint files provided");
+                    exit (EXIT_FAILURE);
+                
+                }
+                
+                state->relax_hints = xstrdup (optarg);
+                break;
+            
+            }
+            
+            case OPTION_STATS: {
+            
+                state->stats = 1;
+                break;
+            
+            }
+            
+            case OPTION_STATS_JSON: {
+            
+                state->stats_json = xstrdup (optarg);
+                break;
+            
+            }
+            
+            case OPTION_TRACE: {
+            
+                state->trace = xstrdup (optarg);
+                break;
+            
+            }
+            
+            case OPTION_WARNING_LIMIT: {
+            
+                state->warning_limit = parse_limit (r, optarg);
+                break;
+            
+            }
+            
+            case OPTION_WRITE_IF_CHANGED: {
+            
+                state->write_if_changed = 1;
+                break;
+            
+            }
+            
             default: {
             
                 report_at (program_name, 0, REPORT_ERROR, "unsupported option '%s'", r);
@@ -432,7 +865,58 @@ void parse_args (int *pargc, char ***pargv, int optind) {
     
     }
     
-    if (!state->format) { state->format = "a.out"; }
-    if (!state->outfile) { state->outfile = "a.out"; }
+    /**
+     * A plain -f/-o pair is still an output of its own when -f FORMAT=OBJFILE
+     * is also used, and it goes first as its format decides the pseudo-ops.
+     */
+    if (state->nb_outputs == 0 || state->format || state->outfile) {
+    
+        struct output *output;
+        unsigned long i;
+        
+        if (!state->format) { state->format = "a.out"; }
+        if (!state->outfile) { state->outfile = "a.out"; }
+        
+        add_output (state->format, state->outfile);
+        output = state->outputs[state->nb_outputs - 1];
+        
+        for (i = state->nb_outputs - 1; i > 0; --i) {
+            state->outputs[i] = state->outputs[i - 1];
+        }
+        
+        state->outputs[0] = output;
+    
+    }
+    
+    state->format = state->outputs[0]->format;
+    state->outfile = state->outputs[0]->filename;
+    
+    /* -MD without -MF names the dependency file after the object file, as in "foo.o" -> "foo.d". */
+    if (state->make_deps && !state->dep_file) {
+        state->dep_file = replace_extension (state->outfile, ".d");
+    }
+
+}
+
+/** Writes str as a JSON string literal, quotes included. */
+void print_json_string (FILE *fp, const char *str) {
+
+    const unsigned char *p;
+    
+    fputc ('"', fp);
+    
+    for (p = (const unsigned char *) str; *p; ++p) {
+    
+        if (*p == '"' || *p == '\\') {
+            fprintf (fp, "\\%c", *p);
+        } else if (*p < 0x20) {
+            fprintf (fp, "\\u%04x", *p);
+        } else {
+            fputc (*p, fp);
+        }
+    
+    }
+    
+    fputc ('"', fp);
 
 }
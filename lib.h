@@ -11,10 +11,30 @@
 #endif
 
 #include    <stddef.h>
+#include    <stdio.h>
 
+/* Categories that allocations are charged to for the --stats memory report. */
+enum {
+
+    MEM_OTHER = 0,
+    MEM_FRAGS,
+    MEM_FRAG_BUFFERS,
+    MEM_FIXUPS,
+    MEM_SYMBOLS,
+    MEM_EXPR_SYMBOLS,
+    MEM_LISTING,
+    MEM_MACROS,
+    MEM_HASHTABS,
+    MEM_LOAD_LINE,
+    MEM_CATEGORIES
+
+};
+
+char *replace_extension (const char *filename, const char *ext);
 char *skip_whitespace (char *p);
 char *to_lower (const char *str);
 char *xstrdup (const char *str);
+char *xstrdup_for (int category, const char *str);
 
 int strstart (const char *val, const char **str);
 int xstrcasecmp (const char *s1, const char *s2);
@@ -23,7 +43,15 @@ int xstrncasecmp (const char *s1, const char *s2, unsigned long n);
 void *xmalloc (unsigned long size);
 void *xrealloc (void *ptr, unsigned long size);
 
+void *xmalloc_for (int category, unsigned long size);
+void *xrealloc_for (int category, void *ptr, unsigned long old_size, unsigned long size);
+
 void dynarray_add (void *ptab, unsigned long *nb_ptr, void *data);
 void parse_args (int *pargc, char ***pargv, int optind);
+void print_json_string (FILE *fp, const char *str);
+
+void mem_account (int category, unsigned long allocated, unsigned long freed);
+void mem_print_stats (FILE *fp);
+void mem_print_stats_json (FILE *fp);
 
 #endif      /* _LIB_H */
@@ -42,7 +42,7 @@ static struct ll *last_line = NULL;
 
 static void internal_add_line (char *line, const char *filename, unsigned long line_number) {
 
-    struct ll *ll = xmalloc (sizeof (*ll));
+    struct ll *ll = xmalloc_for (MEM_LISTING, sizeof (*ll));
     
     ll->line = line;
     ll->filename = filename;
@@ -78,7 +78,7 @@ void add_listing_line (char *real_line, unsigned long real_line_len, const char
     
         if (real_line[i] == '\n') {
         
-            line = xmalloc (i - start + 1);
+            line = xmalloc_for (MEM_LISTING, i - start + 1);
             
             memcpy (line, real_line + start, i - start);
             line[i - start] = '\0';
@@ -96,7 +96,7 @@ void add_listing_line (char *real_line, unsigned long real_line_len, const char
     
     }
     
-    line = xmalloc (i - start + 1);
+    line = xmalloc_for (MEM_LISTING, i - start + 1);
     
     memcpy (line, real_line + start, i - start);
     line[i - start + 1] = '\0';
@@ -113,7 +113,7 @@ void add_listing_message (char *message, const char *filename, unsigned long lin
     
         if (ll->line_number == line_number && strcmp (ll->filename, filename) == 0) {
         
-            struct listing_message *lm = xmalloc (sizeof (*lm));
+            struct listing_message *lm = xmalloc_for (MEM_LISTING, sizeof (*lm));
             
             lm->message = message;
             lm->next = NULL;
@@ -227,7 +227,7 @@ void generate_listing (void) {
         unsigned long defined_symbols = 0;
         unsigned long undefined_symbols = 0;
         
-        for (symbol = symbols; symbol; symbol = symbol->next) {
+        for (symbol = symbols; symbol; symbol = symbol_next (symbol)) {
         
             if (symbol_is_section_symbol (symbol)) {
                 continue;
@@ -245,7 +245,7 @@ void generate_listing (void) {
         
             fprintf (f, "\nDEFINED SYMBOLS:\n\n");
             
-            for (symbol = symbols; symbol; symbol = symbol->next) {
+            for (symbol = symbols; symbol; symbol = symbol_next (symbol)) {
             
                 if (symbol_is_section_symbol (symbol)) {
                     continue;
@@ -267,7 +267,7 @@ void generate_listing (void) {
         
             fprintf (f, "\nUNDEFINED SYMBOLS:\n\n");
             
-            for (symbol = symbols; symbol; symbol = symbol->next) {
+            for (symbol = symbols; symbol; symbol = symbol_next (symbol)) {
             
                 if (symbol_is_section_symbol (symbol)) {
                     continue;
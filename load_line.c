@@ -6,6 +6,7 @@
 #include    <stdlib.h>
 #include    <string.h>
 
+#include    "lib.h"
 #include    "load_line.h"
 #include    "report.h"
 
@@ -21,6 +22,24 @@ struct load_line_data {
 #define     CAPACITY_INCREMENT          256
 extern void get_filename_and_line_number (const char **filename_p, unsigned long *line_number_p);
 
+static int grow_buffers (struct load_line_data *ll_data) {
+
+    unsigned long old_bytes = (ll_data->line ? ll_data->capacity * 2 + 3 : 0);
+    ll_data->capacity += CAPACITY_INCREMENT;
+    
+    if ((ll_data->line = realloc (ll_data->line, ll_data->capacity + 2)) == NULL) {
+        return -1;
+    }
+    
+    if ((ll_data->real_line = realloc (ll_data->real_line, ll_data->capacity + 1)) == NULL) {
+        return -1;
+    }
+    
+    mem_account (MEM_LOAD_LINE, ll_data->capacity * 2 + 3, old_bytes);
+    return 0;
+
+}
+
 int load_line (char **line_p, char **line_end_p, char **real_line_p, unsigned long *real_line_len_p, unsigned long *newlines_p, FILE *ifp, void **load_line_internal_data_p) {
 
     struct load_line_data *ll_data = *load_line_internal_data_p;
@@ -40,18 +59,8 @@ int load_line (char **line_p, char **line_end_p, char **real_line_p, unsigned lo
     
     while (1) {
     
-        if (pos_in_line >= ll_data->capacity || pos_in_real_line >= ll_data->capacity) {
-        
-            ll_data->capacity += CAPACITY_INCREMENT;
-            
-            if ((ll_data->line = realloc (ll_data->line, ll_data->capacity + 2)) == NULL) {
-                return -2;
-            }
-            
-            if ((ll_data->real_line = realloc (ll_data->real_line, ll_data->capacity + 1)) == NULL) {
-                return -2;
-            }
-        
+        if ((pos_in_line >= ll_data->capacity || pos_in_real_line >= ll_data->capacity) && grow_buffers (ll_data)) {
+            return -2;
         }
         
         if (pos_in_real_line >= ll_data->read_size) {
@@ -322,6 +331,80 @@ int load_line (char **line_p, char **line_end_p, char **real_line_p, unsigned lo
 
 }
 
+/**
+ * Skips whole physical lines for which keep_line returns zero, without
+ * copying or stripping them, and returns the number of lines skipped.
+ * Lines containing a backslash or the start of a block comment are kept
+ * as well, so a skipped line never changes the state load_line starts
+ * the next line with.  The kept line and everything after it are left
+ * for load_line.
+ */
+unsigned long load_line_skip (FILE *ifp, void *load_line_internal_data, int (*keep_line) (const char *line, unsigned long len)) {
+
+    struct load_line_data *ll_data = load_line_internal_data;
+    unsigned long skipped = 0, start, len;
+    
+    char *line, *end;
+    
+    for (;;) {
+    
+        if (ll_data->end_of_prev_real_line) {
+        
+            memmove (ll_data->real_line, ll_data->real_line + ll_data->end_of_prev_real_line, ll_data->read_size - ll_data->end_of_prev_real_line);
+            
+            ll_data->read_size -= ll_data->end_of_prev_real_line;
+            ll_data->end_of_prev_real_line = 0;
+        
+        }
+        
+        for (start = 0; (end = memchr (ll_data->real_line + start, '\n', ll_data->read_size - start)) != NULL; start += len + 1) {
+        
+            line = ll_data->real_line + start;
+            len = end - line;
+            
+            if (memchr (line, '\\', len) || keep_line (line, len)) {
+            
+                ll_data->end_of_prev_real_line = start;
+                return skipped;
+            
+            }
+            
+            for (end = line; (end = memchr (end, '/', len - (end - line))) != NULL && end[1] != '*'; end++) {
+                ;
+            }
+            
+            if (end != NULL) {
+            
+                ll_data->end_of_prev_real_line = start;
+                return skipped;
+            
+            }
+            
+            ++skipped;
+        
+        }
+        
+        ll_data->end_of_prev_real_line = start;
+        
+        if (feof (ifp) || ferror (ifp)) {
+            return skipped;
+        }
+        
+        if (start == 0 && ll_data->read_size >= ll_data->capacity && grow_buffers (ll_data)) {
+            return skipped;
+        }
+        
+        if (start) {
+            continue;
+        }
+        
+        ll_data->read_size += fread (ll_data->real_line + ll_data->read_size, 1, ll_data->capacity - ll_data->read_size, ifp);
+        ll_data->real_line[ll_data->read_size] = '\0';
+    
+    }
+
+}
+
 void *load_line_create_internal_data (unsigned long *new_line_number_p) {
 
     struct load_line_data *ll_data;
@@ -330,6 +413,8 @@ void *load_line_create_internal_data (unsigned long *new_line_number_p) {
         return NULL;
     }
     
+    mem_account (MEM_LOAD_LINE, sizeof (*ll_data), 0);
+    
     ll_data->capacity = 0;
     ll_data->line = NULL;
     ll_data->real_line = NULL;
@@ -349,6 +434,7 @@ void load_line_destory_internal_data (void *load_line_internal_data) {
     if (load_line_internal_data) {
     
         ll_data = load_line_internal_data;
+        mem_account (MEM_LOAD_LINE, 0, sizeof (*ll_data) + (ll_data->line ? ll_data->capacity * 2 + 3 : 0));
         
         free (ll_data->line);
         free (ll_data->real_line);
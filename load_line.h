@@ -7,6 +7,7 @@
 #include    <stddef.h>
 #include    <stdio.h>
 
+unsigned long load_line_skip (FILE *ifp, void *load_line_internal_data, int (*keep_line) (const char *line, unsigned long len));
 int load_line (char **line_p, char **line_end_p, char **real_line_p, unsigned long *real_line_len_p, unsigned long *newlines_p, FILE *ifp, void **load_line_internal_data_p);
 
 void *load_line_create_internal_data (unsigned long *new_line_number_p);
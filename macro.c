@@ -2,29 +2,163 @@
  * @file            macro.c
  *****************************************************************************/
 #include    <stdlib.h>
+#include    <string.h>
 
 #include    "hashtab.h"
+#include    "intel.h"
 #include    "lib.h"
 #include    "macro.h"
+#include    "report.h"
 
-struct hashtab hashtab_macros = { 0 };
+static struct hashtab hashtab_macros = { 0 };
+
+/**
+ * Every value in hashtab_macros is a struct macro owning its key and
+ * value.  A scoped definition (a proc argument) keeps the binding it
+ * shadows and is recorded in the innermost frame; popping the frame
+ * puts the shadowed bindings back and frees the scoped ones, so the
+ * table only ever holds live definitions.
+ */
+struct macro {
+
+    struct hashtab_name *key;
+    char *value;
+    
+    struct macro *shadowed;
+    struct macro *next_in_frame;
+
+};
+
+struct macro_frame {
+
+    struct macro *macros;
+    struct macro_frame *prev;
+
+};
+
+static struct macro_frame *current_frame = NULL;
 
 extern char is_end_of_line[];
-extern void ignore_rest_of_line (char **pp);
 
-int has_macro (char *p) {
+static struct macro *find_macro_entry (const char *name) {
 
     struct hashtab_name *key;
-    int exists = 0;
+    struct macro *macro;
     
-    if ((key = hashtab_alloc_name (p)) == NULL) {
-        return exists;
+    if ((key = hashtab_alloc_name (name)) == NULL) {
+        return NULL;
     }
     
-    exists = (hashtab_get (&hashtab_macros, key) != NULL);
+    macro = hashtab_get (&hashtab_macros, key);
     free (key);
     
-    return exists;
+    return macro;
+
+}
+
+static void define_macro (const char *name, const char *value, int scoped) {
+
+    struct macro *shadowed = find_macro_entry (name), *macro;
+    
+    if (!current_frame) {
+        scoped = 0;
+    }
+    
+    /* A plain define of a visible name changes its value in place. */
+    if (shadowed && !scoped) {
+    
+        mem_account (MEM_MACROS, 0, strlen (shadowed->value) + 1);
+        free (shadowed->value);
+        
+        shadowed->value = xstrdup_for (MEM_MACROS, value);
+        
+        machine_dependent_macro_defined (shadowed->key->chars);
+        return;
+    
+    }
+    
+    macro = xmalloc_for (MEM_MACROS, sizeof (*macro));
+    macro->shadowed = shadowed;
+    macro->value = xstrdup_for (MEM_MACROS, value);
+    
+    if ((macro->key = hashtab_alloc_name (xstrdup_for (MEM_MACROS, name))) == NULL || hashtab_put (&hashtab_macros, macro->key, macro) < 0) {
+    
+        report_at (NULL, 0, REPORT_ERROR, "memory full (malloc)");
+        exit (EXIT_FAILURE);
+    
+    }
+    
+    if (scoped) {
+    
+        macro->next_in_frame = current_frame->macros;
+        current_frame->macros = macro;
+    
+    }
+    
+    machine_dependent_macro_defined (macro->key->chars);
+
+}
+
+char *find_macro (const char *name) {
+
+    struct macro *macro = find_macro_entry (name);
+    return (macro ? macro->value : NULL);
+
+}
+
+int has_macro (char *p) {
+    return (find_macro_entry (p) != NULL);
+}
+
+void define_scoped_macro (const char *name, const char *value) {
+    define_macro (name, value, 1);
+}
+
+void push_macro_frame (void) {
+
+    struct macro_frame *frame = xmalloc_for (MEM_MACROS, sizeof (*frame));
+    
+    frame->macros = NULL;
+    frame->prev = current_frame;
+    
+    current_frame = frame;
+
+}
+
+void pop_macro_frame (void) {
+
+    struct macro_frame *frame = current_frame;
+    struct macro *macro, *next;
+    
+    if (frame == NULL) {
+        return;
+    }
+    
+    for (macro = frame->macros; macro; macro = next) {
+    
+        next = macro->next_in_frame;
+        
+        if (macro->shadowed) {
+            hashtab_put (&hashtab_macros, macro->shadowed->key, macro->shadowed);
+        } else {
+            hashtab_remove (&hashtab_macros, macro->key);
+        }
+        
+        machine_dependent_macro_defined (macro->key->chars);
+        
+        mem_account (MEM_MACROS, 0, macro->key->bytes + 1 + strlen (macro->value) + 1 + sizeof (*macro));
+        
+        free ((char *) macro->key->chars);
+        free (macro->key);
+        free (macro->value);
+        free (macro);
+    
+    }
+    
+    current_frame = frame->prev;
+    
+    mem_account (MEM_MACROS, 0, sizeof (*frame));
+    free (frame);
 
 }
 
@@ -33,7 +167,6 @@ void handler_define (char **pp) {
     char *name;
     char *value;
     
-    struct hashtab_name *key;
     char saved_ch;
     
     *pp = skip_whitespace (*pp);
@@ -46,15 +179,6 @@ void handler_define (char **pp) {
     saved_ch = **pp;
     **pp = '\0';
     
-    if ((key = hashtab_alloc_name (xstrdup (name))) == NULL) {
-    
-        **pp = saved_ch;
-        
-        ignore_rest_of_line (pp);
-        return;
-    
-    }
-    
     *pp = skip_whitespace (*pp + 1);
     value = *pp;
     
@@ -66,7 +190,7 @@ void handler_define (char **pp) {
     **pp = '\0';
     
     if (!*value) { value = "1"; }
-    hashtab_put (&hashtab_macros, key, xstrdup (value));
+    define_macro (name, value, 0);
     
     **pp = saved_ch;
 
@@ -4,11 +4,13 @@
 #ifndef     _MACRO_H
 #define     _MACRO_H
 
-#include    "hashtab.h"
-
-extern struct hashtab hashtab_macros;
-
+char *find_macro (const char *name);
 int has_macro (char *p);
+
+void define_scoped_macro (const char *name, const char *value);
 void handler_define (char **pp);
 
+void push_macro_frame (void);
+void pop_macro_frame (void);
+
 #endif
@@ -0,0 +1,438 @@
+/******************************************************************************
+ * @file            parallel.c
+ *****************************************************************************/
+#if     defined (AS86_THREADS)
+# define    _XOPEN_SOURCE               500
+#endif
+
+#include    <stddef.h>
+#include    <stdio.h>
+#include    <stdlib.h>
+#include    <string.h>
+
+#include    "as.h"
+#include    "parallel.h"
+#include    "report.h"
+#include    "section.h"
+#include    "write.h"
+
+#if     defined (AS86_THREADS)
+# include   <pthread.h>
+#endif
+
+#if     defined (AS86_THREADS) && (defined (__unix__) || defined (__APPLE__))
+# include   <sys/types.h>
+# include   <unistd.h>
+#endif
+
+/**
+ * Per-section phases of writing the object file.
+ *
+ * When the assembler is built with AS86_THREADS (THREADS=1 with
+ * Makefile.unix) and -j asks for more than one job, a phase that may run
+ * concurrently is run on up to that many threads, each taking the next
+ * section nobody has taken yet.  What the sections share (symbols and
+ * the memory accounting) is only touched under one recursive lock.
+ * Diagnostics are held back per section and reported in section order
+ * once every thread is done, so both the object and the messages come
+ * out as from the serial loop.  Errors that end the run are reported at
+ * once.
+ *
+ * Where pwrite is available, the blocks of an object file are written at
+ * their offsets by the same number of threads.
+ */
+#if     defined (AS86_THREADS)
+
+struct deferred_report {
+
+    struct deferred_report *next;
+    
+    const char *filename;
+    unsigned long line_number;
+    
+    int type;
+    char *message;
+
+};
+
+struct section_job {
+
+    section_t section;
+    struct deferred_report *first, **last;
+
+};
+
+static pthread_mutex_t lock;
+static pthread_key_t current_job;
+
+static int initialized = 0;
+static int running = 0;
+
+static section_phase_t current_phase = NULL;
+
+static struct section_job *jobs = NULL;
+static unsigned long nb_jobs = 0, next_job = 0;
+
+void parallel_lock (void) {
+
+    if (running) {
+        pthread_mutex_lock (&lock);
+    }
+
+}
+
+void parallel_unlock (void) {
+
+    if (running) {
+        pthread_mutex_unlock (&lock);
+    }
+
+}
+
+static int initialize (void) {
+
+    pthread_mutexattr_t attr;
+    
+    if (initialized) {
+        return 1;
+    }
+    
+    if (pthread_mutexattr_init (&attr)) {
+        return 0;
+    }
+    
+    if (pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE) || pthread_mutex_init (&lock, &attr)) {
+    
+        pthread_mutexattr_destroy (&attr);
+        return 0;
+    
+    }
+    
+    pthread_mutexattr_destroy (&attr);
+    
+    if (pthread_key_create (&current_job, NULL)) {
+    
+        pthread_mutex_destroy (&lock);
+        return 0;
+    
+    }
+    
+    initialized = 1;
+    return 1;
+
+}
+
+static void *run_jobs (void *arg) {
+
+    struct section_job *job;
+    
+    (void) arg;
+    
+    for (;;) {
+    
+        pthread_mutex_lock (&lock);
+        job = (next_job < nb_jobs) ? &jobs[next_job++] : NULL;
+        pthread_mutex_unlock (&lock);
+        
+        if (job == NULL) {
+            break;
+        }
+        
+        pthread_setspecific (current_job, job);
+        (*current_phase) (job->section);
+    
+    }
+    
+    pthread_setspecific (current_job, NULL);
+    return NULL;
+
+}
+
+/** Runs phase over every section on up to state->jobs threads; returns 0 if no thread could be set up. */
+static int run_concurrently (section_phase_t phase) {
+
+    struct deferred_report *deferred, *next;
+    section_t section;
+    
+    pthread_t *threads;
+    unsigned long nb_threads = 0, i;
+    
+    if (!initialize ()) {
+        return 0;
+    }
+    
+    nb_jobs = sections_get_count ();
+    
+    if ((jobs = malloc (sizeof (*jobs) * nb_jobs)) == NULL) {
+        return 0;
+    }
+    
+    if ((threads = malloc (sizeof (*threads) * (state->jobs - 1))) == NULL) {
+    
+        free (jobs);
+        return 0;
+    
+    }
+    
+    for (section = sections, i = 0; section; section = section_get_next_section (section), i++) {
+    
+        jobs[i].section = section;
+        jobs[i].first = NULL;
+        jobs[i].last = &jobs[i].first;
+    
+    }
+    
+    current_phase = phase;
+    next_job = 0;
+    running = 1;
+    
+    /* This thread takes sections as well, so it is one of the jobs; threads that fail to start are simply not waited for. */
+    for (i = 0; i < state->jobs - 1 && i < nb_jobs - 1; i++) {
+    
+        if (pthread_create (&threads[nb_threads], NULL, &run_jobs, NULL) == 0) {
+            nb_threads++;
+        }
+    
+    }
+    
+    run_jobs (NULL);
+    
+    for (i = 0; i < nb_threads; i++) {
+        pthread_join (threads[i], NULL);
+    }
+    
+    running = 0;
+    
+    for (i = 0; i < nb_jobs; i++) {
+    
+        for (deferred = jobs[i].first; deferred; deferred = next) {
+        
+            next = deferred->next;
+            report_at (deferred->filename, deferred->line_number, deferred->type, "%s", deferred->message);
+            
+            free (deferred->message);
+            free (deferred);
+        
+        }
+    
+    }
+    
+    free (threads);
+    free (jobs);
+    
+    jobs = NULL;
+    nb_jobs = 0;
+    
+    return 1;
+
+}
+
+#endif
+
+/**
+ * Runs phase over the sections in order, or, if concurrent is set and
+ * threads are available and asked for, over all of them at once.
+ */
+void parallel_for_each_section (section_phase_t phase, int concurrent) {
+
+    section_t section;
+
+#if     defined (AS86_THREADS)
+
+    if (concurrent && state->jobs > 1 && sections && section_get_next_section (sections) && run_concurrently (phase)) {
+        return;
+    }
+
+#else
+
+    (void) concurrent;
+
+#endif
+
+    for (section = sections; section; section = section_get_next_section (section)) {
+        (*phase) (section);
+    }
+
+}
+
+/**
+ * Keeps a diagnostic reported by a thread working on a section until the
+ * phase is over.  Returns 0 if it has to be reported now instead.
+ */
+int parallel_defer_report (const char *filename, unsigned long line_number, int type, const char *message) {
+
+#if     defined (AS86_THREADS)
+
+    struct deferred_report *deferred;
+    struct section_job *job;
+    
+    if (!running || (job = pthread_getspecific (current_job)) == NULL) {
+        return 0;
+    }
+    
+    if (type == REPORT_FATAL_ERROR || type == REPORT_INTERNAL_ERROR) {
+        return 0;
+    }
+    
+    if ((deferred = malloc (sizeof (*deferred))) == NULL) {
+        return 0;
+    }
+    
+    if ((deferred->message = malloc (strlen (message) + 1)) == NULL) {
+    
+        free (deferred);
+        return 0;
+    
+    }
+    
+    strcpy (deferred->message, message);
+    
+    deferred->next = NULL;
+    deferred->filename = filename;
+    deferred->line_number = line_number;
+    deferred->type = type;
+    
+    *job->last = deferred;
+    job->last = &deferred->next;
+    
+    return 1;
+
+#else
+
+    (void) filename;
+    (void) line_number;
+    (void) type;
+    (void) message;
+    
+    return 0;
+
+#endif
+
+}
+
+#if     defined (AS86_THREADS) && (defined (__unix__) || defined (__APPLE__))
+
+static const struct object_block *write_blocks = NULL, *failed_block = NULL;
+static unsigned long nb_write_blocks = 0, next_write_block = 0;
+
+static int write_fd = -1;
+
+static void *run_writes (void *arg) {
+
+    const struct object_block *block;
+    
+    const char *p;
+    unsigned long left;
+    
+    (void) arg;
+    
+    for (;;) {
+    
+        pthread_mutex_lock (&lock);
+        block = (next_write_block < nb_write_blocks) ? &write_blocks[next_write_block++] : NULL;
+        pthread_mutex_unlock (&lock);
+        
+        if (block == NULL) {
+            break;
+        }
+        
+        for (p = block->data, left = block->size; left > 0; ) {
+        
+            ssize_t written = pwrite (write_fd, p, left, (off_t) (block->offset + (p - (const char *) block->data)));
+            
+            if (written <= 0) {
+            
+                pthread_mutex_lock (&lock);
+                
+                if (failed_block == NULL || block < failed_block) {
+                    failed_block = block;
+                }
+                
+                pthread_mutex_unlock (&lock);
+                break;
+            
+            }
+            
+            p += written;
+            left -= written;
+        
+        }
+    
+    }
+    
+    return NULL;
+
+}
+
+#endif
+
+/**
+ * Writes the blocks to outfile at their offsets from up to state->jobs
+ * threads, where positional writes are available.  Sets *failed_p to the
+ * first block that could not be written.  Returns 0 if nothing was
+ * written, so that the caller writes the blocks in order itself.
+ */
+int parallel_write_blocks (FILE *outfile, const struct object_block *blocks, unsigned long nb_blocks, const struct object_block **failed_p) {
+
+#if     defined (AS86_THREADS) && (defined (__unix__) || defined (__APPLE__))
+
+    pthread_t *threads;
+    unsigned long nb_threads = 0, i;
+    
+    if (state->jobs <= 1 || nb_blocks < 2 || !initialize ()) {
+        return 0;
+    }
+    
+    if ((threads = malloc (sizeof (*threads) * (state->jobs - 1))) == NULL) {
+        return 0;
+    }
+    
+    /* Nothing has been written through outfile yet, so its descriptor is written to directly. */
+    if (fflush (outfile) != 0) {
+    
+        free (threads);
+        return 0;
+    
+    }
+    
+    write_fd = fileno (outfile);
+    write_blocks = blocks;
+    nb_write_blocks = nb_blocks;
+    
+    next_write_block = 0;
+    failed_block = NULL;
+    
+    for (i = 0; i < state->jobs - 1 && i < nb_blocks - 1; i++) {
+    
+        if (pthread_create (&threads[nb_threads], NULL, &run_writes, NULL) == 0) {
+            nb_threads++;
+        }
+    
+    }
+    
+    run_writes (NULL);
+    
+    for (i = 0; i < nb_threads; i++) {
+        pthread_join (threads[i], NULL);
+    }
+    
+    *failed_p = failed_block;
+    
+    write_blocks = NULL;
+    nb_write_blocks = 0;
+    
+    free (threads);
+    return 1;
+
+#else
+
+    (void) outfile;
+    (void) blocks;
+    (void) nb_blocks;
+    (void) failed_p;
+    
+    return 0;
+
+#endif
+
+}
@@ -0,0 +1,26 @@
+/******************************************************************************
+ * @file            parallel.h
+ *****************************************************************************/
+#ifndef     _PARALLEL_H
+#define     _PARALLEL_H
+
+#include    <stdio.h>
+
+#include    "types.h"
+
+struct object_block;
+typedef void (*section_phase_t) (section_t section);
+
+void parallel_for_each_section (section_phase_t phase, int concurrent);
+int parallel_defer_report (const char *filename, unsigned long line_number, int type, const char *message);
+int parallel_write_blocks (FILE *outfile, const struct object_block *blocks, unsigned long nb_blocks, const struct object_block **failed_p);
+
+#if     defined (AS86_THREADS)
+void parallel_lock (void);
+void parallel_unlock (void);
+#else
+# define    parallel_lock()
+# define    parallel_unlock()
+#endif
+
+#endif      /* _PARALLEL_H */
@@ -8,6 +8,7 @@
 #include    <string.h>
 
 #include    "as.h"
+#include    "depend.h"
 #include    "frag.h"
 #include    "hashtab.h"
 #include    "intel.h"
@@ -21,6 +22,7 @@
 #include    "report.h"
 #include    "section.h"
 #include    "symbol.h"
+#include    "trace.h"
 #include    "vector.h"
 
 static const char *filename = 0;
@@ -559,7 +561,7 @@ void handler_include (char **pp) {
                 ++(*pp);
                 break;
             
-            } else if (ch == '\'') {
+            } else if (ch == '\'' && !double_quotes) {
             
                 ++(*pp);
                 break;
@@ -578,7 +580,7 @@ void handler_include (char **pp) {
             ignore_rest_of_line (pp);
             return;
         
-        } else if (ch != '\'') {
+        } else if (!double_quotes && ch != '\'') {
         
             report (REPORT_ERROR, "unterminated string");
             
@@ -623,7 +625,7 @@ void handler_include (char **pp) {
     
     for (i = 0; i < state->nb_inc_paths; i++) {
     
-        tmp = xmalloc (strlen (state->inc_paths[i]) + len);
+        tmp = xmalloc (strlen (state->inc_paths[i]) + len + 1);
         
         strcpy (tmp, state->inc_paths[i]);
         strcat (tmp, p2);
@@ -652,12 +654,183 @@ done:
 
 }
 
+enum directive {
+
+    DIRECTIVE_NONE,
+    
+    DIRECTIVE_IF,
+    DIRECTIVE_IFDEF,
+    DIRECTIVE_IFNDEF,
+    DIRECTIVE_ELIF,
+    DIRECTIVE_ELIFDEF,
+    DIRECTIVE_ELIFNDEF,
+    DIRECTIVE_ELSE,
+    DIRECTIVE_ENDIF,
+    
+    DIRECTIVE_EXTERN,
+    DIRECTIVE_UNIMPLEMENTED,
+    
+    DIRECTIVE_EQU,
+    DIRECTIVE_LABEL,
+    DIRECTIVE_PROC,
+    DIRECTIVE_ENDP,
+    DIRECTIVE_SEGMENT,
+    DIRECTIVE_ENDS
+
+};
+
+struct directive_name {
+
+    const char *name;
+    enum directive directive;
+
+};
+
+/**
+ * The words process_file recognises itself, in lower case.  Each line's
+ * first word (and the word after a label) is classified once through
+ * this table instead of being compared against every spelling in turn.
+ */
+static const struct directive_name directive_names[] = {
+
+    { "%if",        DIRECTIVE_IF            },
+    { ".if",        DIRECTIVE_IF            },
+    { "if",         DIRECTIVE_IF            },
+    { "%ifdef",     DIRECTIVE_IFDEF         },
+    { ".ifdef",     DIRECTIVE_IFDEF         },
+    { "ifdef",      DIRECTIVE_IFDEF         },
+    { "%ifndef",    DIRECTIVE_IFNDEF        },
+    { ".ifndef",    DIRECTIVE_IFNDEF        },
+    { "ifndef",     DIRECTIVE_IFNDEF        },
+    { "%elif",      DIRECTIVE_ELIF          },
+    { ".elif",      DIRECTIVE_ELIF          },
+    { "elif",       DIRECTIVE_ELIF          },
+    { "%elifdef",   DIRECTIVE_ELIFDEF       },
+    { ".elifdef",   DIRECTIVE_ELIFDEF       },
+    { "elifdef",    DIRECTIVE_ELIFDEF       },
+    { "%elifndef",  DIRECTIVE_ELIFNDEF      },
+    { ".elifndef",  DIRECTIVE_ELIFNDEF      },
+    { "elifndef",   DIRECTIVE_ELIFNDEF      },
+    { "%else",      DIRECTIVE_ELSE          },
+    { "else",       DIRECTIVE_ELSE          },
+    { "%endif",     DIRECTIVE_ENDIF         },
+    { ".endif",     DIRECTIVE_ENDIF         },
+    { "endif",      DIRECTIVE_ENDIF         },
+    
+    { "extern",     DIRECTIVE_EXTERN        },
+    { "extrn",      DIRECTIVE_EXTERN        },
+    
+    { "assume",     DIRECTIVE_UNIMPLEMENTED },
+    { "dgroup",     DIRECTIVE_UNIMPLEMENTED },
+    { ".stack",     DIRECTIVE_UNIMPLEMENTED },
+    
+    { "equ",        DIRECTIVE_EQU           },
+    { "label",      DIRECTIVE_LABEL         },
+    { "proc",       DIRECTIVE_PROC          },
+    { "endp",       DIRECTIVE_ENDP          },
+    { "segment",    DIRECTIVE_SEGMENT       },
+    { "ends",       DIRECTIVE_ENDS          },
+    
+    { NULL,         DIRECTIVE_NONE          }
+
+};
+
+static struct hashtab directives_hashtab = { 0 };
+
+static void install_directives (void) {
+
+    const struct directive_name *entry;
+    struct hashtab_name *key;
+    
+    for (entry = directive_names; entry->name; ++entry) {
+    
+        if ((key = hashtab_alloc_name (entry->name)) == NULL || hashtab_put (&directives_hashtab, key, (void *) entry) < 0) {
+        
+            report_at (program_name, 0, REPORT_INTERNAL_ERROR, "failed to insert %s into directives_hashtab", entry->name);
+            exit (EXIT_FAILURE);
+        
+        }
+    
+    }
+
+}
+
+static enum directive find_directive (const char *name) {
+
+    const struct directive_name *entry = hashtab_get_lowercase (&directives_hashtab, name);
+    return (entry ? entry->directive : DIRECTIVE_NONE);
+
+}
+
+/**
+ * Emits an instruction of a procedure prologue or epilogue.  These only
+ * take register operands, so they are handed to the encoder directly
+ * instead of being formatted as text and parsed again.
+ */
+static void emit_register_instruction (const char *mnemonic, const struct reg_entry *dest, const struct reg_entry *src) {
+
+    struct machine_dependent_operand operands[2];
+    
+    memset (operands, 0, sizeof (operands));
+    
+    operands[0].kind = MACHINE_DEPENDENT_OPERAND_REGISTER;
+    operands[0].reg = dest;
+    
+    operands[1].kind = MACHINE_DEPENDENT_OPERAND_REGISTER;
+    operands[1].reg = src;
+    
+    machine_dependent_emit_instruction (machine_dependent_find_mnemonic (mnemonic), operands, src ? 2 : 1);
+
+}
+
+/**
+ * Used by load_line_skip while a conditional block is disabled: only the
+ * lines starting with a conditional directive (which process_file needs
+ * to track the nesting) are kept.
+ */
+static int is_conditional_line (const char *line, unsigned long len) {
+
+    const char *end = line + len;
+    char name[16];
+    
+    unsigned long i = 0;
+    enum directive directive;
+    
+    while (line < end && (*line == ' ' || *line == '\t')) {
+        line++;
+    }
+    
+    if (line < end && *line == '%') {
+        name[i++] = *line++;
+    }
+    
+    if (line >= end || !is_name_beginner ((int) *line)) {
+        return 0;
+    }
+    
+    while (line < end && is_name_part ((int) *line)) {
+    
+        if (i >= sizeof (name) - 1) {
+            return 0;
+        }
+        
+        name[i++] = *line++;
+    
+    }
+    
+    name[i] = '\0';
+    directive = find_directive (name);
+    
+    return (directive >= DIRECTIVE_IF && directive <= DIRECTIVE_ENDIF);
+
+}
+
 int process_file (const char *fname) {
 
     unsigned long new_line_number = 1;
     void *load_line_internal_data = NULL;
     
-    unsigned long newlines;
+    unsigned long newlines, skipped;
     char *line, *line_end;
     
     unsigned long real_line_len;
@@ -670,6 +843,7 @@ int process_file (const char *fname) {
         return 1;
     }
     
+    add_dependency (fname);
     filename = fname;
     line_number = 0;
     
@@ -677,6 +851,12 @@ int process_file (const char *fname) {
         return 1;
     }
     
+    trace_file_begin (fname);
+    
+    if (directives_hashtab.count == 0) {
+        install_directives ();
+    }
+    
     while (!load_line (&line, &line_end, &real_line, &real_line_len, &newlines, ifp, &load_line_internal_data)) {
     
         line_number = new_line_number;
@@ -692,6 +872,7 @@ int process_file (const char *fname) {
         while (line < line_end) {
         
             char saved_ch, *start_p;
+            enum directive directive;
             
             line = skip_whitespace (line);
             start_p = line;
@@ -701,8 +882,9 @@ int process_file (const char *fname) {
             }
             
             saved_ch = get_symbol_name_end (&line);
+            directive = find_directive (start_p);
             
-            if (xstrcasecmp (start_p, "%if") == 0 || xstrcasecmp (start_p, ".if") == 0 || xstrcasecmp (start_p, "if") == 0) {
+            if (directive == DIRECTIVE_IF) {
             
                 *line = saved_ch;
                 
@@ -711,7 +893,7 @@ int process_file (const char *fname) {
                 
                 continue;
             
-            } else if (xstrcasecmp (start_p, "%ifdef") == 0 || xstrcasecmp (start_p, ".ifdef") == 0 || xstrcasecmp (start_p, "ifdef") == 0) {
+            } else if (directive == DIRECTIVE_IFDEF) {
             
                 *line = saved_ch;
                 
@@ -720,7 +902,7 @@ int process_file (const char *fname) {
                 
                 continue;
             
-            } else if (xstrcasecmp (start_p, "%ifndef") == 0 || xstrcasecmp (start_p, ".ifndef") == 0 || xstrcasecmp (start_p, "ifndef") == 0) {
+            } else if (directive == DIRECTIVE_IFNDEF) {
             
                 *line = saved_ch;
                 
@@ -729,7 +911,7 @@ int process_file (const char *fname) {
                 
                 continue;
             
-            } else if (xstrcasecmp (start_p, "%elif") == 0 || xstrcasecmp (start_p, ".elif") == 0 || xstrcasecmp (start_p, "elif") == 0) {
+            } else if (directive == DIRECTIVE_ELIF) {
             
                 *line = saved_ch;
                 
@@ -738,7 +920,7 @@ int process_file (const char *fname) {
                 
                 continue;
             
-            } else if (xstrcasecmp (start_p, "%elifdef") == 0 || xstrcasecmp (start_p, ".elifdef") == 0 || xstrcasecmp (start_p, "elifdef") == 0) {
+            } else if (directive == DIRECTIVE_ELIFDEF) {
             
                 *line = saved_ch;
                 
@@ -747,7 +929,7 @@ int process_file (const char *fname) {
                 
                 continue;
             
-            } else if (xstrcasecmp (start_p, "%elifndef") == 0 || xstrcasecmp (start_p, ".elifndef") == 0 || xstrcasecmp (start_p, "elifndef") == 0) {
+            } else if (directive == DIRECTIVE_ELIFNDEF) {
             
                 *line = saved_ch;
                 
@@ -756,7 +938,7 @@ int process_file (const char *fname) {
                 
                 continue;
             
-            } else if (xstrcasecmp (start_p, "%else") == 0 || xstrcasecmp (start_p, "else") == 0 || xstrcasecmp (start_p, "else") == 0) {
+            } else if (directive == DIRECTIVE_ELSE) {
             
                 *line = saved_ch;
                 
@@ -765,7 +947,7 @@ int process_file (const char *fname) {
                 
                 continue;
             
-            } else if (xstrcasecmp (start_p, "%endif") == 0 || xstrcasecmp (start_p, ".endif") == 0 || xstrcasecmp (start_p, "endif") == 0) {
+            } else if (directive == DIRECTIVE_ENDIF) {
             
                 *line = saved_ch;
                 
@@ -794,7 +976,7 @@ int process_file (const char *fname) {
             
             saved_ch = get_symbol_name_end (&line);
             
-            if (xstrcasecmp (start_p, "extern") == 0 || xstrcasecmp (start_p, "extrn") == 0) {
+            if (directive == DIRECTIVE_EXTERN) {
             
                 struct hashtab_name *key;
                 line = skip_whitespace (line + 1);
@@ -827,7 +1009,7 @@ int process_file (const char *fname) {
                 ignore_rest_of_line (&line);
                 continue;
             
-            } else if (xstrcasecmp (start_p, "assume") == 0 || xstrcasecmp (start_p, "dgroup") == 0 || xstrcasecmp (start_p, ".stack") == 0) {
+            } else if (directive == DIRECTIVE_UNIMPLEMENTED) {
             
                 report (REPORT_WARNING, "%s unimplemented; ignored", start_p);
                 *line = saved_ch;
@@ -835,7 +1017,7 @@ int process_file (const char *fname) {
                 ignore_rest_of_line (&line);
                 continue;
             
-            } else if (xstrcasecmp (start_p, "proc") == 0 || xstrcasecmp (start_p, "endp") == 0) {
+            } else if (directive == DIRECTIVE_PROC || directive == DIRECTIVE_ENDP) {
             
                 report (REPORT_ERROR, "procedure must have a name");
                 *line = saved_ch;
@@ -866,7 +1048,7 @@ int process_file (const char *fname) {
                 
                 saved_ch = get_symbol_name_end (&line);
                 
-                if (xstrcasecmp (start_p, "equ") == 0) {
+                if (directive == DIRECTIVE_EQU) {
                 
                     report (REPORT_ERROR, "missing label for equ");
                     
@@ -902,6 +1084,7 @@ int process_file (const char *fname) {
                 if (saved_ch && (saved_ch == ':' || (*skip_whitespace (line + 1)) == ':')) {
                 
                     char temp_ch, *temp_line = line, *temp_start_p;
+                    enum directive temp_directive;
                     
                     if (saved_ch != ':') {
                         temp_line = skip_whitespace (line + 1);
@@ -911,8 +1094,9 @@ int process_file (const char *fname) {
                     temp_start_p = temp_line;
                     
                     temp_ch = get_symbol_name_end (&temp_line);
+                    temp_directive = find_directive (temp_start_p);
                     
-                    if (xstrcasecmp (temp_start_p, "equ") == 0) {
+                    if (temp_directive == DIRECTIVE_EQU) {
                     
                         line = skip_whitespace (temp_line + 1);
                         
@@ -938,11 +1122,13 @@ int process_file (const char *fname) {
                 if (saved_ch && saved_ch == ' ') {
                 
                     char temp_ch, *temp_line, *temp_start_p;
+                    enum directive temp_directive;
                     
                     temp_line = skip_whitespace (line + 1);
                     temp_start_p = temp_line;
                     
                     temp_ch = get_symbol_name_end (&temp_line);
+                    temp_directive = find_directive (temp_start_p);
                     
                     if (is_data_pseudo_op (temp_start_p)) {
                     
@@ -955,7 +1141,7 @@ int process_file (const char *fname) {
                     
                     }
                     
-                    if ((temp_ch && temp_ch == '=') || xstrcasecmp (temp_start_p, "equ") == 0) {
+                    if ((temp_ch && temp_ch == '=') || temp_directive == DIRECTIVE_EQU) {
                     
                         line = skip_whitespace (temp_line + 1);
                         
@@ -964,7 +1150,7 @@ int process_file (const char *fname) {
                     
                     }
                     
-                    if (xstrcasecmp (temp_start_p, "label") == 0) {
+                    if (temp_directive == DIRECTIVE_LABEL) {
                     
                         char *temp = xmalloc (13);
                         symbol_label (start_p);
@@ -999,7 +1185,7 @@ int process_file (const char *fname) {
                     
                     }
                     
-                    if (xstrcasecmp (temp_start_p, "proc") == 0) {
+                    if (temp_directive == DIRECTIVE_PROC) {
                     
                         struct proc *proc = xmalloc (sizeof (*proc));
                         
@@ -1007,6 +1193,7 @@ int process_file (const char *fname) {
                         int offset = 0, i;
                         
                         proc->name = xstrdup (start_p);
+                        push_macro_frame ();
                         
                         symbol_label (proc->name);
                         *temp_line = temp_ch;
@@ -1019,7 +1206,7 @@ int process_file (const char *fname) {
                         
                         if (xstrcasecmp (start_p, "uses") == 0) {
                         
-                            char *reg;
+                            const struct reg_entry *reg;
                             *line = saved_ch;
                             
                             while (!is_end_of_line[(int) *line] && *line == ' ') {
@@ -1033,8 +1220,11 @@ int process_file (const char *fname) {
                                 start_p = line;
                                 saved_ch = get_symbol_name_end (&line);
                                 
-                                reg = xstrdup (start_p);
-                                vec_push (&proc->regs, reg);
+                                if ((reg = machine_dependent_find_register (start_p)) == NULL) {
+                                    report (REPORT_ERROR, "bad register name '%s'", start_p);
+                                } else {
+                                    vec_push (&proc->regs, (void *) reg);
+                                }
                                 
                                 *line = saved_ch;
                             
@@ -1082,19 +1272,19 @@ int process_file (const char *fname) {
                             start_p = line;
                             saved_ch = get_symbol_name_end (&line);
                             
-                            temp = xmalloc (strlen (name) + 1 + 5 + 5 + 1 + 5 + 8 + 2);
+                            temp = xmalloc (strlen (start_p) + 5 + 5 + 1 + 5 + 8 + 2);
                             
                             if (xstrcasecmp (start_p, "byte") == 0 || xstrcasecmp (start_p, "word") == 0) {
                             
-                                sprintf (temp, "%s %s ptr [bp + %d]", name, start_p, offset);
+                                sprintf (temp, "%s ptr [bp + %d]", start_p, offset);
                                 offset += 2;
                             
                             } else if (xstrcasecmp (start_p, "dword") == 0) { 
                             
                                 if (state->sym_start) {
-                                    sprintf (temp, "%s [bp + %d]", name, offset);
+                                    sprintf (temp, "[bp + %d]", offset);
                                 } else {
-                                    sprintf (temp, "%s %s ptr [bp + %d]", name, start_p, offset);
+                                    sprintf (temp, "%s ptr [bp + %d]", start_p, offset);
                                 }
                                 
                                 offset += 4;
@@ -1103,12 +1293,12 @@ int process_file (const char *fname) {
                             
                                 if (machine_dependent_get_bits () == 32 || state->model >= 5) {
                                 
-                                    sprintf (temp, "%s [bp + %d]", name, offset);
+                                    sprintf (temp, "[bp + %d]", offset);
                                     offset += 4;
                                 
                                 } else {
                                 
-                                    sprintf (temp, "%s [bp + %d]", name, offset);
+                                    sprintf (temp, "[bp + %d]", offset);
                                     offset += 2;
                                 
                                 }
@@ -1117,6 +1307,8 @@ int process_file (const char *fname) {
                             
                                 report (REPORT_ERROR, "unsupported argument type");
                                 
+                                free (temp);
+                                
                                 *line = saved_ch;
                                 break;
                             
@@ -1124,8 +1316,9 @@ int process_file (const char *fname) {
                             
                             vec_push (&proc->args, xstrdup (start_p));
                             
-                            handler_define (&temp);
-                            /*free (temp);*/
+                            /* The arguments are only visible up to the matching endp. */
+                            define_scoped_macro (name, temp);
+                            free (temp);
                             
                             *line = saved_ch;
                             line = skip_whitespace (line);
@@ -1134,27 +1327,15 @@ int process_file (const char *fname) {
                         
                         if (proc->args.length > 0) {
                         
-                            char *temp = xmalloc (8);
-                            sprintf (temp, "push bp");
+                            const struct reg_entry *bp = machine_dependent_find_register ("bp");
                             
-                            machine_dependent_assemble_line (temp);
-                            
-                            temp = xmalloc (10);
-                            sprintf (temp, "mov bp, sp");
-                            
-                            machine_dependent_assemble_line (temp);
+                            emit_register_instruction ("push", bp, NULL);
+                            emit_register_instruction ("mov", bp, machine_dependent_find_register ("sp"));
                         
                         }
                         
                         for (i = 0; i < proc->regs.length; ++i) {
-                        
-                            char *temp, *reg = proc->regs.data[i];
-                            
-                            temp = xmalloc (4 + 1 + strlen (reg) + 1); 
-                            sprintf (temp, "push %s", reg);
-                            
-                            machine_dependent_assemble_line (temp);
-                        
+                            emit_register_instruction ("push", proc->regs.data[i], NULL);
                         }
                         
                         vec_push (&state->procs, (void *) proc);
@@ -1164,7 +1345,7 @@ int process_file (const char *fname) {
                     
                     }
                     
-                    if (xstrcasecmp (temp_start_p, "endp") == 0) {
+                    if (temp_directive == DIRECTIVE_ENDP) {
                     
                         if (state->procs.length == 0) {
                             report (REPORT_ERROR, "block nesting error");
@@ -1176,27 +1357,21 @@ int process_file (const char *fname) {
                             if (strcmp (start_p, proc->name)) {
                                 report (REPORT_ERROR, "procedure name does not match");
                             } else {
+                            
                                 state->procs.length = last;
+                                pop_macro_frame ();
+                            
                             }
                             
                             if (proc->regs.length > 0) {
                             
                                 unsigned char last_inst = current_frag->buf[current_frag->fixed_size - 1];
-                                
-                                char *temp, *reg;
                                 int32_t i;
                                 
                                 current_frag->fixed_size--;
                                 
                                 for (i = proc->regs.length - 1; i >= 0; --i) {
-                                
-                                    reg = proc->regs.data[i];
-                                    
-                                    temp = xmalloc (3 + 1 + strlen (reg) + 1);
-                                    sprintf (temp, "pop %s", reg);
-                                    
-                                    machine_dependent_assemble_line (temp);
-                                
+                                    emit_register_instruction ("pop", proc->regs.data[i], NULL);
                                 }
                                 
                                 frag_append_1_char (last_inst);
@@ -1218,6 +1393,10 @@ int process_file (const char *fname) {
                                 
                                 }
                                 
+                                for (i = 0; i < proc->args.length; ++i) {
+                                    free (proc->args.data[i]);
+                                }
+                                
                                 proc->args.length = 0;
                             
                             }
@@ -1232,7 +1411,7 @@ int process_file (const char *fname) {
                     
                     }
                     
-                    if (xstrcasecmp (temp_start_p, "segment") == 0) {
+                    if (temp_directive == DIRECTIVE_SEGMENT) {
                     
                         struct seg *seg = xmalloc (sizeof (*seg));
                         seg->name = xstrdup (start_p);
@@ -1248,7 +1427,7 @@ int process_file (const char *fname) {
                     
                     }
                     
-                    if (xstrcasecmp (temp_start_p, "ends") == 0) {
+                    if (temp_directive == DIRECTIVE_ENDS) {
                     
                         if (state->segs.length == 0) {
                             report (REPORT_ERROR, "block nesting error");
@@ -1315,6 +1494,19 @@ int process_file (const char *fname) {
             demand_empty_rest_of_line (&line);
         
         }
+        
+        /**
+         * The listing shows the lines of disabled blocks, so they are only
+         * skipped without one.  The last skipped line becomes the current
+         * one, so that a block running to the end of the file is reported
+         * at its last line, as when every line was loaded.
+         */
+        if (!enabled && !state->listing && (skipped = load_line_skip (ifp, load_line_internal_data, &is_conditional_line)) > 0) {
+        
+            new_line_number += skipped;
+            line_number = new_line_number - 1;
+        
+        }
     
     }
     
@@ -1323,6 +1515,8 @@ int process_file (const char *fname) {
     }
     
     load_line_destory_internal_data (load_line_internal_data);
+    
+    trace_file_end (new_line_number - 1, (unsigned long) ftell (ifp));
     fclose (ifp);
     
     if (cond_stack.length > 0) {
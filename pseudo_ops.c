@@ -547,49 +547,44 @@ static void handler_model (char **pp) {
         state->model = 7;
     } else {
     
-        struct hashtab_name *key;
-        char *entry;
+        const char *entry;
         
-        if ((key = hashtab_alloc_name (model)) != NULL) {
+        if ((entry = find_macro (model)) != NULL) {
         
-            if ((entry = (char *) hashtab_get (&hashtab_macros, key)) != NULL) {
+            if (xstrcasecmp (entry, "tiny") == 0) {
             
-                if (xstrcasecmp (entry, "tiny") == 0) {
-                
-                    state->model = 1;
-                    goto got_model;
-                
-                } else if (xstrcasecmp (entry, "small") == 0) {
-                
-                    state->model = 2;
-                    goto got_model;
-                
-                } else if (xstrcasecmp (entry, "compact") == 0) {
-                
-                    state->model = 3;
-                    goto got_model;
-                
-                } else if (xstrcasecmp (entry, "medium") == 0) {
-                
-                    state->model = 4;
-                    goto got_model;
-                
-                } else if (xstrcasecmp (entry, "large") == 0) {
-                
-                    state->model = 5;
-                    goto got_model;
-                
-                } else if (xstrcasecmp (entry, "huge") == 0) {
-                
-                    state->model = 6;
-                    goto got_model;
-                
-                } else if (xstrcasecmp (entry, "flat") == 0) {
-                
-                    state->model = 7;
-                    goto got_model;
-                
-                }
+                state->model = 1;
+                goto got_model;
+            
+            } else if (xstrcasecmp (entry, "small") == 0) {
+            
+                state->model = 2;
+                goto got_model;
+            
+            } else if (xstrcasecmp (entry, "compact") == 0) {
+            
+                state->model = 3;
+                goto got_model;
+            
+            } else if (xstrcasecmp (entry, "medium") == 0) {
+            
+                state->model = 4;
+                goto got_model;
+            
+            } else if (xstrcasecmp (entry, "large") == 0) {
+            
+                state->model = 5;
+                goto got_model;
+            
+            } else if (xstrcasecmp (entry, "huge") == 0) {
+            
+                state->model = 6;
+                goto got_model;
+            
+            } else if (xstrcasecmp (entry, "flat") == 0) {
+            
+                state->model = 7;
+                goto got_model;
             
             }
         
@@ -801,62 +796,18 @@ static struct hashtab pseudo_ops_hashtab = { 0 };
 
 struct pseudo_op *find_pseudo_op (const char *name) {
 
-    char *p = to_lower (name);
-    
-    struct hashtab_name *key;
     struct pseudo_op *poe;
     
-    if (p == NULL) {
-        return NULL;
+    if ((poe = hashtab_get_lowercase (&pseudo_ops_hashtab, name)) == NULL) {
+        poe = hashtab_get_lowercase (&data_pseudo_ops_hashtab, name);
     }
     
-    if ((key = hashtab_alloc_name (p)) == NULL) {
-    
-        free (p);
-        
-        report_at (program_name, 0, REPORT_ERROR, "memory full (malloc)");
-        exit (EXIT_FAILURE);
-    
-    }
-    
-    if ((poe = hashtab_get (&pseudo_ops_hashtab, key)) == NULL) {
-        poe = hashtab_get (&data_pseudo_ops_hashtab, key);
-    }
-    
-    free (key);
-    free (p);
-    
     return poe;
 
 }
 
 int is_data_pseudo_op (const char *name) {
-
-    char *p = to_lower (name);
-    
-    struct hashtab_name *key;
-    int ret = 0;
-    
-    if (p == NULL) {
-        return ret;
-    }
-    
-    if ((key = hashtab_alloc_name (p)) == NULL) {
-    
-        free (p);
-        
-        report_at (program_name, 0, REPORT_ERROR, "memory full (malloc)");
-        exit (EXIT_FAILURE);
-    
-    }
-    
-    ret = (hashtab_get (&data_pseudo_ops_hashtab, key) != NULL);
-    
-    free (key);
-    free (p);
-    
-    return ret;
-
+    return (hashtab_get_lowercase (&data_pseudo_ops_hashtab, name) != NULL);
 }
 
 void add_pseudo_op (struct pseudo_op *poe) {
@@ -0,0 +1,442 @@
+/******************************************************************************
+ * @file            relax_hints.c
+ *****************************************************************************/
+#include    <stddef.h>
+#include    <stdio.h>
+#include    <stdlib.h>
+#include    <string.h>
+
+#include    "as.h"
+#include    "frag.h"
+#include    "hashtab.h"
+#include    "lib.h"
+#include    "relax_hints.h"
+#include    "report.h"
+#include    "symbol.h"
+
+/**
+ * Relaxation hints.
+ *
+ * The final subtype of every jump that relaxation had to grow is saved to
+ * a side file and used as the starting subtype on the next run.  One
+ * pass over the seeded layout checks every hint, and only the jumps whose
+ * size comes out different are relaxed again from the shortest form.
+ * A jump is identified by the file it was assembled from, a hash of its
+ * target's name and its ordinal among the jumps of that file to that
+ * target, which unlike line numbers stays the same when lines are added
+ * or removed elsewhere in the file.
+ *
+ * Hints are only taken from files whose contents hash the same as when
+ * the hints were saved, and only if the options that change the code
+ * (-O and -D) are the same, so a hinted layout is normally the one the
+ * run would reach anyway.  A jump that passes the check keeps its size,
+ * which means two stale jumps that are only long because of each other
+ * would stay long; that needs the code between them to come from a file
+ * that changed while theirs did not.  Since alignment padding shrinks as
+ * the code before it grows, a seeded layout can also settle on other
+ * jump sizes than a run without hints, all of them in reach.
+ *
+ * After a header line naming the format and the hash of the options,
+ * "source hash filename" lines give the hash of every file hints were
+ * saved for and each remaining line is "subtype ordinal target-hash
+ * filename".
+ */
+#define     RELAX_HINTS_HEADER          "as86 relax hints 2"
+
+#define     FNV_OFFSET_BASIS            2166136261UL
+#define     FNV_PRIME                   16777619UL
+
+struct relax_hint {
+
+    struct hashtab_name *key;
+    relax_subtype_t subtype;
+
+};
+
+struct relax_target {
+
+    struct hashtab_name *key;
+    unsigned long count;
+
+};
+
+static struct hashtab hashtab_hints = { 0 };
+static struct hashtab hashtab_saved_sources = { 0 };
+static struct hashtab hashtab_unchanged_sources = { 0 };
+static struct hashtab hashtab_targets = { 0 };
+
+static struct relax_hint **saved_hints = NULL;
+static unsigned long nb_saved_hints = 0;
+
+static unsigned long hints_loaded = 0;
+static unsigned long hints_stale = 0;
+static unsigned long hints_applied = 0;
+static unsigned long frags_adjusted = 0;
+
+static unsigned long hash_bytes (unsigned long hash, const void *data, unsigned long size) {
+
+    const unsigned char *p = data;
+    
+    while (size--) {
+    
+        hash ^= *p++;
+        hash = (hash * FNV_PRIME) & 0xFFFFFFFFUL;
+    
+    }
+    
+    return hash;
+
+}
+
+static unsigned long hash_target (const struct frag *frag) {
+
+    if (frag->symbol == NULL) {
+        return 0;
+    }
+    
+    return hash_bytes (FNV_OFFSET_BASIS, frag->symbol->name, strlen (frag->symbol->name));
+
+}
+
+/** Hashes the options that change the code assembled from the same sources. */
+static unsigned long hash_options (void) {
+
+    unsigned long hash = FNV_OFFSET_BASIS, i;
+    
+    hash = hash_bytes (hash, state->optimize ? "O" : "", state->optimize ? 2 : 1);
+    
+    for (i = 0; i < state->nb_defs; ++i) {
+        hash = hash_bytes (hash, state->defs[i], strlen (state->defs[i]) + 1);
+    }
+    
+    return hash;
+
+}
+
+/** Hashes the contents of filename into *hash_p.  Returns 0 if it cannot be read. */
+static int hash_file (const char *filename, unsigned long *hash_p) {
+
+    unsigned long hash = FNV_OFFSET_BASIS, count;
+    char buf[4096];
+    
+    FILE *fp;
+    int failed;
+    
+    if ((fp = fopen (filename, "rb")) == NULL) {
+        return 0;
+    }
+    
+    while ((count = fread (buf, 1, sizeof (buf), fp)) > 0) {
+        hash = hash_bytes (hash, buf, count);
+    }
+    
+    failed = ferror (fp);
+    fclose (fp);
+    
+    *hash_p = hash;
+    return !failed;
+
+}
+
+/** Returns the file name at the end of a hint key. */
+static const char *key_filename (const char *key) {
+
+    const char *p;
+    
+    if ((p = strchr (key, ' ')) == NULL || (p = strchr (p + 1, ' ')) == NULL) {
+        return "";
+    }
+    
+    return p + 1;
+
+}
+
+static void add_source (struct hashtab *table, const char *filename) {
+
+    struct hashtab_name *key;
+    char *chars = xstrdup (filename);
+    
+    if ((key = hashtab_alloc_name (chars)) == NULL) {
+    
+        free (chars);
+        return;
+    
+    }
+    
+    if (hashtab_get (table, key) || hashtab_put (table, key, key)) {
+    
+        free ((char *) key->chars);
+        free (key);
+    
+    }
+
+}
+
+static int has_source (struct hashtab *table, const char *filename) {
+
+    struct hashtab_name *key;
+    void *found;
+    
+    if (table->count == 0 || (key = hashtab_alloc_name (filename)) == NULL) {
+        return 0;
+    }
+    
+    found = hashtab_get (table, key);
+    free (key);
+    
+    return found != NULL;
+
+}
+
+static char *make_key (unsigned long ordinal, unsigned long target, const char *filename) {
+
+    char *key = xmalloc (2 * 21 + strlen (filename) + 1);
+    
+    sprintf (key, "%lu %08lx %s", ordinal, target, filename);
+    return key;
+
+}
+
+/**
+ * Returns the identity of frag, counting the jumps seen so far from the
+ * same file to the same target.  Jumps have to be presented in the order
+ * they appear in the section.
+ */
+char *relax_hints_identify (const struct frag *frag) {
+
+    const char *filename = frag->filename ? frag->filename : "";
+    unsigned long target = hash_target (frag);
+    
+    struct relax_target *counter;
+    struct hashtab_name *key;
+    
+    if ((key = hashtab_alloc_name (make_key (0, target, filename))) == NULL) {
+        return make_key (0, target, filename);
+    }
+    
+    if ((counter = hashtab_get (&hashtab_targets, key)) != NULL) {
+    
+        free ((char *) key->chars);
+        free (key);
+        
+        return make_key (++counter->count, target, filename);
+    
+    }
+    
+    counter = xmalloc (sizeof (*counter));
+    counter->key = key;
+    counter->count = 0;
+    
+    if (hashtab_put (&hashtab_targets, key, counter)) {
+    
+        free ((char *) key->chars);
+        free (key);
+        free (counter);
+    
+    }
+    
+    return make_key (0, target, filename);
+
+}
+
+void relax_hints_load (void) {
+
+    unsigned long options;
+    int options_stale;
+    
+    FILE *fp;
+    char line[1024];
+    
+    if (!state->relax_hints || (fp = fopen (state->relax_hints, "r")) == NULL) {
+        return;
+    }
+    
+    if (fgets (line, sizeof (line), fp) == NULL || strncmp (line, RELAX_HINTS_HEADER, strlen (RELAX_HINTS_HEADER)) || sscanf (line + strlen (RELAX_HINTS_HEADER), "%lx", &options) != 1) {
+    
+        report_at (state->relax_hints, 0, REPORT_WARNING, "not a relaxation hint file, ignoring");
+        
+        fclose (fp);
+        return;
+    
+    }
+    
+    options_stale = (options != hash_options ());
+    
+    while (fgets (line, sizeof (line), fp)) {
+    
+        unsigned long subtype, ordinal, target, hash;
+        int filename_start = 0;
+        
+        struct relax_hint *hint;
+        char *p;
+        
+        if ((p = strchr (line, '\n')) != NULL) {
+            *p = '\0';
+        }
+        
+        if (sscanf (line, "source %lx %n", &hash, &filename_start) == 1 && filename_start > 0) {
+        
+            unsigned long current;
+            
+            if (hash_file (line + filename_start, &current) && current == hash) {
+                add_source (&hashtab_unchanged_sources, line + filename_start);
+            }
+            
+            continue;
+        
+        }
+        
+        if (sscanf (line, "%lx %lu %lx %n", &subtype, &ordinal, &target, &filename_start) < 3) {
+            continue;
+        }
+        
+        if (options_stale || !has_source (&hashtab_unchanged_sources, line + filename_start)) {
+        
+            hints_stale++;
+            continue;
+        
+        }
+        
+        hint = xmalloc (sizeof (*hint));
+        hint->subtype = subtype;
+        
+        if ((hint->key = hashtab_alloc_name (make_key (ordinal, target, line + filename_start))) == NULL) {
+        
+            free (hint);
+            continue;
+        
+        }
+        
+        if (hashtab_get (&hashtab_hints, hint->key) || hashtab_put (&hashtab_hints, hint->key, hint)) {
+        
+            free ((char *) hint->key->chars);
+            free (hint->key);
+            free (hint);
+            
+            continue;
+        
+        }
+        
+        hints_loaded++;
+    
+    }
+    
+    fclose (fp);
+
+}
+
+int relax_hints_find (const char *identity, relax_subtype_t *subtype_p) {
+
+    struct hashtab_name *key;
+    struct relax_hint *hint;
+    
+    if (hashtab_hints.count == 0 || (key = hashtab_alloc_name (identity)) == NULL) {
+        return 0;
+    }
+    
+    hint = hashtab_get (&hashtab_hints, key);
+    free (key);
+    
+    if (hint == NULL) {
+        return 0;
+    }
+    
+    *subtype_p = hint->subtype;
+    return 1;
+
+}
+
+/** Saves the subtype of the frag known as identity, which is taken over. */
+void relax_hints_add (char *identity, relax_subtype_t subtype) {
+
+    struct relax_hint *hint = xmalloc (sizeof (*hint));
+    
+    if ((hint->key = hashtab_alloc_name (identity)) == NULL) {
+    
+        free (identity);
+        free (hint);
+        
+        return;
+    
+    }
+    
+    hint->subtype = subtype;
+    dynarray_add (&saved_hints, &nb_saved_hints, hint);
+
+}
+
+void relax_hints_note_applied (void) {
+    hints_applied++;
+}
+
+void relax_hints_note_adjusted (void) {
+    frags_adjusted++;
+}
+
+void relax_hints_save (void) {
+
+    unsigned long i;
+    FILE *fp;
+    
+    if (!state->relax_hints) {
+        return;
+    }
+    
+    if ((fp = fopen (state->relax_hints, "w")) == NULL) {
+    
+        report_at (NULL, 0, REPORT_WARNING, "failed to open '%s' for writing", state->relax_hints);
+        return;
+    
+    }
+    
+    fprintf (fp, "%s %08lx\n", RELAX_HINTS_HEADER, hash_options ());
+    
+    for (i = 0; i < nb_saved_hints; ++i) {
+    
+        const char *filename = key_filename (saved_hints[i]->key->chars);
+        unsigned long hash;
+        
+        if (has_source (&hashtab_saved_sources, filename)) {
+            continue;
+        }
+        
+        add_source (&hashtab_saved_sources, filename);
+        
+        if (hash_file (filename, &hash)) {
+            fprintf (fp, "source %08lx %s\n", hash, filename);
+        }
+    
+    }
+    
+    for (i = 0; i < nb_saved_hints; ++i) {
+    
+        struct relax_hint *hint = saved_hints[i];
+        fprintf (fp, "%lx %s\n", (unsigned long) hint->subtype, hint->key->chars);
+    
+    }
+    
+    if (fclose (fp)) {
+        report_at (NULL, 0, REPORT_WARNING, "failed to write '%s'", state->relax_hints);
+    }
+
+}
+
+void relax_hints_print_stats (FILE *fp) {
+
+    if (!state->relax_hints) {
+        return;
+    }
+    
+    fprintf (fp, "relax hints: %lu loaded, %lu stale, %lu applied, %lu frags adjusted\n", hints_loaded, hints_stale, hints_applied, frags_adjusted);
+
+}
+
+void relax_hints_print_stats_json (FILE *fp) {
+
+    if (!state->relax_hints) {
+        return;
+    }
+    
+    fprintf (fp, ",\n    \"relax_hints\": { \"loaded\": %lu, \"stale\": %lu, \"applied\": %lu, \"frags_adjusted\": %lu }", hints_loaded, hints_stale, hints_applied, frags_adjusted);
+
+}
@@ -0,0 +1,22 @@
+/******************************************************************************
+ * @file            relax_hints.h
+ *****************************************************************************/
+#ifndef     _RELAX_HINTS_H
+#define     _RELAX_HINTS_H
+
+#include    <stdio.h>
+
+#include    "types.h"
+
+char *relax_hints_identify (const struct frag *frag);
+int relax_hints_find (const char *identity, relax_subtype_t *subtype_p);
+
+void relax_hints_add (char *identity, relax_subtype_t subtype);
+void relax_hints_load (void);
+void relax_hints_note_adjusted (void);
+void relax_hints_note_applied (void);
+void relax_hints_print_stats (FILE *fp);
+void relax_hints_print_stats_json (FILE *fp);
+void relax_hints_save (void);
+
+#endif      /* _RELAX_HINTS_H */
@@ -3,18 +3,96 @@
  *****************************************************************************/
 #include    <stdarg.h>
 #include    <stdio.h>
+#include    <stdlib.h>
+#include    <string.h>
 
 #include    "as.h"
+#include    "hashtab.h"
+#include    "lib.h"
+#include    "parallel.h"
 #include    "report.h"
 
+/**
+ * Diagnostics are formatted once into a message and then go through a
+ * sink: a message already given for the same place is dropped, errors
+ * and warnings past --error-limit and --warning-limit are counted but not
+ * shown, and the text is gathered in a buffer that is written to stderr
+ * when it fills, when report_flush is called and at exit.  With
+ * --diag-json each diagnostic shown is also written as one JSON object
+ * per line.
+ */
 extern void get_filename_and_line_number (const char **filename_p, unsigned long *line_number_p);
 static unsigned long errors = 0;
+static unsigned long warnings = 0;
+
+static unsigned long errors_shown = 0;
+static unsigned long warnings_shown = 0;
+
+static struct hashtab hashtab_reported = { 0 };
+
+static char sink[4096];
+static unsigned long sink_length = 0;
+static int flush_at_exit = 0;
+
+static FILE *json_fp = NULL;
 
 #ifndef     __PDOS__
 #if     defined (_WIN32)
+# include   <io.h>
 # include   <windows.h>
 static int OriginalConsoleColor = -1;
+#elif   defined (__unix__) || defined (__APPLE__)
+# include   <unistd.h>
+#endif
+
+static int use_color = -1;
+#endif
+
+static void sink_write (const char *str) {
+
+    unsigned long length = strlen (str);
+    
+    if (!flush_at_exit) {
+    
+        atexit (report_flush);
+        flush_at_exit = 1;
+    
+    }
+    
+    if (sink_length + length > sizeof (sink)) {
+        report_flush ();
+    }
+    
+    if (length >= sizeof (sink)) {
+    
+        fwrite (str, 1, length, stderr);
+        return;
+    
+    }
+    
+    memcpy (sink + sink_length, str, length);
+    sink_length += length;
+
+}
+
+#ifndef     __PDOS__
+static int color_enabled (void) {
+
+    if (use_color < 0) {
+    
+#if     defined (_WIN32)
+        use_color = _isatty (_fileno (stderr)) != 0;
+#elif   defined (__unix__) || defined (__APPLE__)
+        use_color = isatty (STDERR_FILENO) != 0;
+#else
+        use_color = 1;
 #endif
+    
+    }
+    
+    return use_color;
+
+}
 
 static void reset_console_color (void) {
 
@@ -24,12 +102,14 @@ static void reset_console_color (void) {
     
     if (OriginalConsoleColor == -1) { return; }
     
+    report_flush ();
+    
     SetConsoleTextAttribute (hStdError, OriginalConsoleColor);
     OriginalConsoleColor = -1;
 
 #else
 
-    fprintf (stderr, "\033[0m");
+    sink_write ("\033[0m");
 
 #endif
 
@@ -54,163 +134,463 @@ static void set_console_color (int color) {
     
     }
     
+    report_flush ();
+    
     wColor = (OriginalConsoleColor & 0xF0) + (color & 0xF);
     SetConsoleTextAttribute (hStdError, wColor);
 
 #else
 
-    fprintf (stderr, "\033[%dm", color);
+    char escape[16];
+    
+    sprintf (escape, "\033[%dm", color);
+    sink_write (escape);
 
 #endif
 
 }
 #endif
 
-unsigned long get_error_count (void) {
-    return errors;
+/**
+ * Returns an upper bound of the length of the text vsprintf produces for
+ * fmt and the arguments in ap, as C90 has no vsnprintf.
+ */
+static unsigned long format_length (const char *fmt, va_list ap) {
+
+    unsigned long length = 0;
+    const char *p;
+    
+    for (p = fmt; *p; ++p) {
+    
+        unsigned long width = 0, precision = 0, size;
+        int longs = 0;
+        
+        if (*p != '%') {
+        
+            length++;
+            continue;
+        
+        }
+        
+        for (++p; *p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0'; ++p) {
+            ;
+        }
+        
+        if (*p == '*') {
+        
+            int value = va_arg (ap, int);
+            
+            width = (unsigned long) (value < 0 ? -value : value);
+            p++;
+        
+        } else {
+        
+            for (; *p >= '0' && *p <= '9'; ++p) {
+                width = width * 10 + (*p - '0');
+            }
+        
+        }
+        
+        if (*p == '.') {
+        
+            if (*++p == '*') {
+            
+                int value = va_arg (ap, int);
+                
+                precision = (unsigned long) (value < 0 ? 0 : value);
+                p++;
+            
+            } else {
+            
+                for (; *p >= '0' && *p <= '9'; ++p) {
+                    precision = precision * 10 + (*p - '0');
+                }
+            
+            }
+        
+        }
+        
+        for (; *p == 'h' || *p == 'l' || *p == 'L'; ++p) {
+            longs += (*p != 'h');
+        }
+        
+        switch (*p) {
+        
+            case 'd':
+            case 'i':
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+            
+                if (longs) {
+                    (void) va_arg (ap, long);
+                } else {
+                    (void) va_arg (ap, int);
+                }
+                
+                size = sizeof (long) * 3 + 2;
+                break;
+            
+            case 'c':
+            
+                (void) va_arg (ap, int);
+                
+                size = 1;
+                break;
+            
+            case 's': {
+            
+                const char *str = va_arg (ap, const char *);
+                
+                size = str ? strlen (str) : 6;
+                break;
+            
+            }
+            
+            case 'p':
+            
+                (void) va_arg (ap, void *);
+                
+                size = sizeof (void *) * 2 + 4;
+                break;
+            
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'g':
+            case 'G':
+            
+                if (longs) {
+                    (void) va_arg (ap, long double);
+                } else {
+                    (void) va_arg (ap, double);
+                }
+                
+                size = 5000;
+                break;
+            
+            case 'n':
+            
+                (void) va_arg (ap, int *);
+                
+                size = 0;
+                break;
+            
+            case '\0':
+            
+                return length;
+            
+            default:
+            
+                size = 1;
+                break;
+        
+        }
+        
+        length += (width > size ? width : size) + precision;
+    
+    }
+    
+    return length;
+
 }
 
-void report (int type, const char *fmt, ...) {
+static const char *severity_name (int type) {
 
-    va_list ap;
+    switch (type) {
     
-    const char *filename;
-    unsigned long line_number;
+        case REPORT_FATAL_ERROR:
+        
+            return "fatal error";
+        
+        case REPORT_INTERNAL_ERROR:
+        
+            return "internal error";
+        
+        case REPORT_WARNING:
+        
+            return "warning";
+        
+        default:
+        
+            return "error";
     
-    if (type == REPORT_WARNING && state->nowarn) {
-        return;
     }
-    
-    get_filename_and_line_number (&filename, &line_number);
+
+}
+
+static void write_text (const char *filename, unsigned long line_number, int type, const char *message) {
+
+    char number[24];
     
     if (filename) {
     
-        if (line_number == 0) {
-            fprintf (stderr, "%s: ", filename);
-        } else {
-            fprintf (stderr, "%s:", filename);
-        }
+        sink_write (filename);
+        sink_write (line_number == 0 ? ": " : ":");
     
     }
     
     if (line_number > 0) {
-        fprintf (stderr, "%lu: ", line_number);
-    }
     
-    if (type == REPORT_ERROR || type == REPORT_FATAL_ERROR) {
+        sprintf (number, "%lu: ", line_number);
+        sink_write (number);
+    
+    }
     
 #ifndef     __PDOS__
-        set_console_color (COLOR_ERROR);
-#endif
-        
-        if (type == REPORT_ERROR) {
-            fprintf (stderr, "error:");
-        } else {
-            fprintf (stderr, "fatal error:");
+    if (color_enabled ()) {
+    
+        if (type == REPORT_ERROR || type == REPORT_FATAL_ERROR) {
+            set_console_color (COLOR_ERROR);
+        } else if (type == REPORT_INTERNAL_ERROR) {
+            set_console_color (COLOR_INTERNAL_ERROR);
+        } else if (type == REPORT_WARNING) {
+            set_console_color (COLOR_WARNING);
         }
     
-    } else if (type == REPORT_INTERNAL_ERROR) {
-    
-#ifndef     __PDOS__
-        set_console_color (COLOR_INTERNAL_ERROR);
+    }
 #endif
-        
-        fprintf (stderr, "internal error:");
     
-    } else if (type == REPORT_WARNING) {
+    sink_write (severity_name (type));
+    sink_write (":");
     
 #ifndef     __PDOS__
-        set_console_color (COLOR_WARNING);
+    if (color_enabled ()) {
+        reset_console_color ();
+    }
 #endif
+    
+    sink_write (" ");
+    sink_write (message);
+    sink_write ("\n");
+
+}
+
+static void write_json (const char *filename, unsigned long line_number, int type, const char *message) {
+
+    if (json_fp == NULL) {
+    
+        if (!state->diag_json) {
+            return;
+        }
         
-        fprintf (stderr, "warning:");
+        if ((json_fp = fopen (state->diag_json, "w")) == NULL) {
+        
+            const char *diag_json = state->diag_json;
+            state->diag_json = NULL;
+            
+            report_at (NULL, 0, REPORT_ERROR, "failed to open '%s' for writing", diag_json);
+            return;
+        
+        }
     
     }
     
-#ifndef     __PDOS__
-    reset_console_color ();
-#endif
+    fprintf (json_fp, "{ \"file\": ");
     
-    fprintf (stderr, " ");
+    if (filename) {
+        print_json_string (json_fp, filename);
+    } else {
+        fprintf (json_fp, "null");
+    }
     
-    va_start (ap, fmt);
-    vfprintf (stderr, fmt, ap);
-    va_end (ap);
+    fprintf (json_fp, ", \"line\": %lu, \"severity\": \"%s\", \"message\": ", line_number, severity_name (type));
+    print_json_string (json_fp, message);
+    fprintf (json_fp, " }\n");
+
+}
+
+/** Returns non-zero if the same diagnostic was already given for the same place. */
+static int already_reported (const char *filename, unsigned long line_number, int type, const char *message) {
+
+    struct hashtab_name *key;
+    char *chars;
+    
+    if (filename == NULL) {
+        filename = "";
+    }
+    
+    if ((chars = malloc (strlen (filename) + strlen (message) + 2 * 21 + 4)) == NULL) {
+        return 0;
+    }
+    
+    sprintf (chars, "%d:%lu:%s:%s", type, line_number, filename, message);
+    
+    if ((key = hashtab_alloc_name (chars)) == NULL) {
     
-    fprintf (stderr, "\n");
+        free (chars);
+        return 0;
     
+    }
+    
+    if (hashtab_get (&hashtab_reported, key)) {
+    
+        free (chars);
+        free (key);
+        
+        return 1;
+    
+    }
+    
+    if (hashtab_put (&hashtab_reported, key, key)) {
+    
+        free (chars);
+        free (key);
+    
+    }
+    
+    return 0;
+
+}
+
+/** Counts the diagnostic and passes it to the sink. */
+static void emit_now (const char *filename, unsigned long line_number, int type, const char *message) {
+
     if (type == REPORT_ERROR || type == REPORT_FATAL_ERROR || type == REPORT_INTERNAL_ERROR) {
         ++errors;
+    } else if (type == REPORT_WARNING) {
+        ++warnings;
+    }
+    
+    if (type == REPORT_ERROR || type == REPORT_WARNING) {
+    
+        unsigned long *shown = (type == REPORT_ERROR ? &errors_shown : &warnings_shown);
+        unsigned long limit = (type == REPORT_ERROR ? state->error_limit : state->warning_limit);
+        
+        if (already_reported (filename, line_number, type, message)) {
+            return;
+        }
+        
+        if (limit > 0 && *shown >= limit) {
+        
+            if (*shown == limit) {
+                write_text (program_name, 0, type, (type == REPORT_ERROR ? "too many errors, further errors are not shown" : "too many warnings, further warnings are not shown"));
+            }
+            
+            ++*shown;
+            return;
+        
+        }
+        
+        ++*shown;
+    
     }
+    
+    write_text (filename, line_number, type, message);
+    write_json (filename, line_number, type, message);
 
 }
 
-void report_at (const char *filename, unsigned long line_number, int type, const char *fmt, ...) {
+/** Holds the diagnostic back if a thread reports it for the section it works on. */
+static void emit (const char *filename, unsigned long line_number, int type, const char *message) {
 
-    va_list ap;
-    
-    if (type == REPORT_WARNING && state->nowarn) {
+    if (parallel_defer_report (filename, line_number, type, message)) {
         return;
     }
     
-    if (filename) {
+    parallel_lock ();
+    emit_now (filename, line_number, type, message);
+    parallel_unlock ();
+
+}
+
+unsigned long get_error_count (void) {
+    return errors;
+}
+
+unsigned long get_warning_count (void) {
+    return warnings;
+}
+
+/**
+ * Writes out the diagnostics held back so far.  The JSON file is created
+ * here if nothing was reported, so that a clean run leaves an empty file.
+ */
+void report_flush (void) {
+
+    if (sink_length > 0) {
     
-        if (line_number == 0) {
-            fprintf (stderr, "%s: ", filename);
-        } else {
-            fprintf (stderr, "%s:", filename);
-        }
+        fwrite (sink, 1, sink_length, stderr);
+        sink_length = 0;
     
     }
     
-    if (line_number > 0) {
-        fprintf (stderr, "%lu: ", line_number);
+    if (json_fp) {
+        fflush (json_fp);
+    } else if (state && state->diag_json && (json_fp = fopen (state->diag_json, "w")) == NULL) {
+    
+        const char *diag_json = state->diag_json;
+        state->diag_json = NULL;
+        
+        report_at (NULL, 0, REPORT_ERROR, "failed to open '%s' for writing", diag_json);
+    
     }
+
+}
+
+void report (int type, const char *fmt, ...) {
+
+    va_list ap;
     
-    if (type == REPORT_ERROR || type == REPORT_FATAL_ERROR) {
+    const char *filename;
+    unsigned long line_number;
     
-#ifndef     __PDOS__
-        set_console_color (COLOR_ERROR);
-#endif
-        
-        if (type == REPORT_ERROR) {
-            fprintf (stderr, "error:");
-        } else {
-            fprintf (stderr, "fatal error:");
-        }
+    char *message;
     
-    } else if (type == REPORT_INTERNAL_ERROR) {
+    if (type == REPORT_WARNING && state->nowarn) {
+        return;
+    }
     
-#ifndef     __PDOS__
-        set_console_color (COLOR_INTERNAL_ERROR);
-#endif
-        
-        fprintf (stderr, "internal error:");
+    get_filename_and_line_number (&filename, &line_number);
     
-    } else if (type == REPORT_WARNING) {
+    va_start (ap, fmt);
+    message = malloc (format_length (fmt, ap) + 1);
+    va_end (ap);
     
-#ifndef     __PDOS__
-        set_console_color (COLOR_WARNING);
-#endif
-        
-        fprintf (stderr, "warning:");
+    /* Out of memory, which is itself reported from here: give the format unexpanded. */
+    if (message == NULL) {
+    
+        emit (filename, line_number, type, fmt);
+        return;
     
     }
     
-#ifndef     __PDOS__
-    reset_console_color ();
-#endif
+    va_start (ap, fmt);
+    vsprintf (message, fmt, ap);
+    va_end (ap);
     
-    fprintf (stderr, " ");
+    emit (filename, line_number, type, message);
+    free (message);
+
+}
+
+void report_at (const char *filename, unsigned long line_number, int type, const char *fmt, ...) {
+
+    va_list ap;
+    char *message;
+    
+    if (type == REPORT_WARNING && state->nowarn) {
+        return;
+    }
     
     va_start (ap, fmt);
-    vfprintf (stderr, fmt, ap);
+    message = malloc (format_length (fmt, ap) + 1);
     va_end (ap);
     
-    fprintf (stderr, "\n");
+    /* Out of memory, which is itself reported from here: give the format unexpanded. */
+    if (message == NULL) {
+    
+        emit (filename, line_number, type, fmt);
+        return;
     
-    if (type == REPORT_ERROR || type == REPORT_FATAL_ERROR || type == REPORT_INTERNAL_ERROR) {
-        ++errors;
     }
+    
+    va_start (ap, fmt);
+    vsprintf (message, fmt, ap);
+    va_end (ap);
+    
+    emit (filename, line_number, type, message);
+    free (message);
 
 }
@@ -24,8 +24,10 @@ enum {
 #endif
 
 unsigned long get_error_count (void);
+unsigned long get_warning_count (void);
 
 void report (int type, const char *fmt, ...);
 void report_at (const char *filename, unsigned long line_number, int type, const char *fmt, ...);
+void report_flush (void);
 
 #endif      /* _REPORT_H */
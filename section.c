@@ -4,7 +4,9 @@
 #include    <stdlib.h>
 #include    <string.h>
 
+#include    "fixup.h"
 #include    "frag.h"
+#include    "hashtab.h"
 #include    "lib.h"
 #include    "report.h"
 #include    "section.h"
@@ -18,16 +20,20 @@ struct section {
     struct symbol *symbol;
     struct frag_chain *frag_chain;
     
+    /* Frag chain that was current when the section was last left. */
+    struct frag_chain *last_frag_chain;
+    
     unsigned int flags;
     section_t next;
     
     void *object_format_dependent_data;
-    uint32_t number;
+    
+    /* Creation order counted from 1; 0 for the internal sections, which are never numbered. */
+    uint32_t index;
 
 };
 
 static struct section internal_sections[4];
-static struct symbol section_symbols[4];
 
 section_t undefined_section;
 section_t absolute_section;
@@ -39,43 +45,75 @@ section_t bss_section;
 
 section_t sections = 0;
 
+/**
+ * Named sections are looked up through a hashtab, appended through the
+ * tail pointer and numbered by creation order, so neither switching nor
+ * counting walks the list.
+ */
+static struct hashtab hashtab_sections = { 0 };
+static section_t *last_section_next = &sections;
+
+static uint32_t nb_sections = 0;
+static uint32_t first_number = 0;
+
 section_t current_section;
 subsection_t current_subsection;
 
 static int frags_chained = 0;
 struct frag_chain *current_frag_chain;
 
-static section_t find_or_make_section_by_name (const char *name) {
+static section_t find_section_by_name (const char *name) {
 
-    section_t section, *p_next;
+    struct hashtab_name *key;
+    section_t section;
     
-    for (p_next = &sections, section = sections; section; p_next = &(section->next), section = *p_next) {
-        
-        if (strcmp (name, section->name) == 0) {
-            break;
-        }
+    if ((key = hashtab_alloc_name (name)) == NULL) {
+    
+        report_at (NULL, 0, REPORT_ERROR, "memory full (malloc)");
+        exit (EXIT_FAILURE);
     
     }
     
-    if (section == NULL) {
+    section = hashtab_get (&hashtab_sections, key);
+    free (key);
     
-        section = xmalloc (sizeof (*section));
-        section->name = xstrdup (name);
-        
-        section->symbol = symbol_create (name, section, 0, &zero_address_frag);
-        section->symbol->flags |= SYMBOL_FLAG_SECTION_SYMBOL;
-        symbol_add_to_chain (section->symbol);
-        
-        section->frag_chain = NULL;
-        section->next = NULL;
-        
-        section->object_format_dependent_data = NULL;
-        section->number = 0;
-        
-        *p_next = section;
+    return section;
+
+}
+
+static section_t find_or_make_section_by_name (const char *name) {
+
+    struct hashtab_name *key;
+    section_t section;
+    
+    if ((section = find_section_by_name (name)) != NULL) {
+        return section;
+    }
+    
+    section = xmalloc (sizeof (*section));
+    section->name = xstrdup (name);
+    
+    section->symbol = symbol_create (name, section, 0, &zero_address_frag);
+    section->symbol->flags |= SYMBOL_FLAG_SECTION_SYMBOL;
+    symbol_add_to_chain (section->symbol);
+    
+    section->frag_chain = NULL;
+    section->last_frag_chain = NULL;
+    section->next = NULL;
+    
+    section->object_format_dependent_data = NULL;
+    section->index = ++nb_sections;
+    
+    if ((key = hashtab_alloc_name (section->name)) == NULL || hashtab_put (&hashtab_sections, key, section) < 0) {
+    
+        report_at (NULL, 0, REPORT_ERROR, "memory full (malloc)");
+        exit (EXIT_FAILURE);
     
     }
     
+    *last_section_next = section;
+    last_section_next = &section->next;
+    
     return section;
 
 }
@@ -92,6 +130,11 @@ static void subsection_set (subsection_t subsection) {
     
     }
     
+    /* Switching back to the subsection a section was left in needs no search. */
+    if ((frag_chain = current_section->last_frag_chain) != NULL && frag_chain->subsection == subsection) {
+        goto found;
+    }
+    
     for (frag_chain = *(p_next = &(current_section->frag_chain)); frag_chain; frag_chain = *(p_next = &(frag_chain->next))) {
     
         if (frag_chain->subsection >= subsection) {
@@ -104,8 +147,7 @@ static void subsection_set (subsection_t subsection) {
     
         struct frag_chain *new_frag_chain = xmalloc (sizeof (*new_frag_chain));
         
-        new_frag_chain->last_frag  = new_frag_chain->first_frag  = frag_alloc ();
-        new_frag_chain->last_fixup = new_frag_chain->first_fixup = NULL;
+        new_frag_chain->last_frag  = new_frag_chain->first_frag  = frag_alloc_chain_first ();
         new_frag_chain->subsection = subsection;
         
         *p_next = new_frag_chain;
@@ -115,6 +157,10 @@ static void subsection_set (subsection_t subsection) {
     
     }
     
+found:
+    
+    current_section->last_frag_chain = frag_chain;
+    
     current_frag_chain = frag_chain;
     current_frag       = current_frag_chain->last_frag;
     
@@ -156,33 +202,23 @@ const char *section_get_name (section_t section) {
 }
 
 int section_find_by_name (const char *name) {
-
-    section_t section, *p_next;
-    
-    for (p_next = &sections, section = sections; section; p_next = &(section->next), section = *p_next) {
-        
-        if (strcmp (name, section->name) == 0) {
-            break;
-        }
-    
-    }
-    
-    return (section == NULL);
-
+    return (find_section_by_name (name) == NULL);
 }
 
 uint32_t sections_get_count (void) {
+    return nb_sections;
+}
 
-    section_t section;
-    uint32_t count;
-
-    for (section = sections, count = 0; section; section = section->next, count++);
-    return count;
+uint32_t section_get_number (section_t section) {
+    return (first_number && section->index) ? first_number + section->index - 1 : 0;
+}
 
+struct frag_chain *section_get_frag_chain (section_t section) {
+    return section->frag_chain;
 }
 
-uint32_t section_get_number (section_t section) {
-    return section->number;
+int sections_frags_chained (void) {
+    return frags_chained;
 }
 
 void sections_chain_subsection_frags (void) {
@@ -200,19 +236,11 @@ void sections_chain_subsection_frags (void) {
             section->frag_chain->last_frag->next = frag_chain->first_frag;
             section->frag_chain->last_frag = frag_chain->last_frag;
             
-            if (section->frag_chain->first_fixup) {
-            
-                section->frag_chain->last_fixup->next = frag_chain->first_fixup;
-                section->frag_chain->last_fixup = frag_chain->last_fixup;
-            
-            } else {
-            
-                section->frag_chain->first_fixup = frag_chain->first_fixup;
-                section->frag_chain->last_fixup = frag_chain->last_fixup;
-            
-            }
+            fixups_append_frag_chain (section->frag_chain, frag_chain);
         
         }
+        
+        section->last_frag_chain = section->frag_chain;
     
     }
     
@@ -225,11 +253,7 @@ void sections_init (void) {
 #define CREATE_INTERNAL_SECTION(section_var, section_name, section_index) \
     (section_var) = &internal_sections[(section_index)]; \
     (section_var)->name = (section_name); \
-    (section_var)->symbol = &section_symbols[(section_index)]; \
-    (section_var)->symbol->name    = (section_name); \
-    (section_var)->symbol->section = (section_var); \
-    (section_var)->symbol->frag    = &zero_address_frag; \
-    symbol_set_value ((section_var)->symbol, 0); \
+    (section_var)->symbol = symbol_create ((section_name), (section_var), 0, &zero_address_frag); \
     (section_var)->symbol->flags  |= SYMBOL_FLAG_SECTION_SYMBOL
 
     CREATE_INTERNAL_SECTION (undefined_section, "*UND*",  0);
@@ -254,13 +278,7 @@ void sections_init (void) {
 }
 
 void sections_number (uint32_t start_at) {
-
-    section_t section;
-    
-    for (section = sections; section; section = section->next) {
-        section->number = start_at++;
-    }
-
+    first_number = start_at;
 }
 
 void *section_get_object_format_dependent_data (section_t section) {
@@ -21,7 +21,12 @@
 struct frag_chain {
 
     frag_t first_frag, last_frag;
-    struct fixup *first_fixup, *last_fixup;
+    struct fixup *fixups;
+    unsigned long nb_fixups, fixups_capacity;
+    
+    /* End of the arena chunk holding the last frag, and the section image built after relaxation. */
+    unsigned char *chunk_end, *image;
+    value_t image_size;
     
     subsection_t subsection;
     struct frag_chain *next;
@@ -61,6 +66,8 @@ int section_find_by_name (const char *name);
 uint32_t sections_get_count (void);
 uint32_t section_get_number (section_t section);
 
+struct frag_chain *section_get_frag_chain (section_t section);
+int sections_frags_chained (void);
 void sections_chain_subsection_frags (void);
 void sections_init (void);
 void sections_number (uint32_t start_at);
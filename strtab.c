@@ -0,0 +1,206 @@
+/******************************************************************************
+ * @file            strtab.c
+ *****************************************************************************/
+#include    <stddef.h>
+#include    <stdlib.h>
+#include    <string.h>
+
+#include    "hashtab.h"
+#include    "lib.h"
+#include    "report.h"
+#include    "strtab.h"
+
+/**
+ * Orders strings by their bytes read from the end.  When one string is a
+ * suffix of the other, the longer one sorts first, so every string
+ * directly follows one that ends with it whenever such a string exists.
+ */
+static int compare_reversed (const void *a, const void *b) {
+
+    const struct strtab_string *s1 = *(const struct strtab_string * const *) a;
+    const struct strtab_string *s2 = *(const struct strtab_string * const *) b;
+    
+    const unsigned char *p1 = (const unsigned char *) s1->chars + s1->length;
+    const unsigned char *p2 = (const unsigned char *) s2->chars + s2->length;
+    
+    while (p1 > (const unsigned char *) s1->chars && p2 > (const unsigned char *) s2->chars) {
+    
+        --p1;
+        --p2;
+        
+        if (*p1 != *p2) {
+            return (*p1 < *p2) ? 1 : -1;
+        }
+    
+    }
+    
+    if (s1->length == s2->length) {
+        return 0;
+    }
+    
+    return (s1->length < s2->length) ? 1 : -1;
+
+}
+
+void strtab_init (struct strtab *strtab, unsigned long start) {
+
+    memset (strtab, 0, sizeof (*strtab));
+    strtab->start = start;
+
+}
+
+/** Interns prefix followed by name (prefix may be NULL) and returns its index. */
+unsigned long strtab_add (struct strtab *strtab, const char *prefix, const char *name) {
+
+    struct hashtab_name *key;
+    struct strtab_string *string;
+    
+    unsigned long prefix_length = prefix ? strlen (prefix) : 0;
+    unsigned long length = prefix_length + strlen (name);
+    
+    char *chars = xmalloc (length + 1);
+    
+    if (prefix) {
+        memcpy (chars, prefix, prefix_length);
+    }
+    
+    strcpy (chars + prefix_length, name);
+    
+    if ((key = hashtab_alloc_name (chars)) == NULL) {
+    
+        report_at (NULL, 0, REPORT_ERROR, "memory full (malloc)");
+        exit (EXIT_FAILURE);
+    
+    }
+    
+    if ((string = hashtab_get (&strtab->hashtab, key)) != NULL) {
+    
+        free (key);
+        free (chars);
+        
+        return string->index;
+    
+    }
+    
+    string = xmalloc (sizeof (*string));
+    
+    string->chars = chars;
+    string->length = length;
+    string->index = strtab->nb_strings;
+    
+    if (hashtab_put (&strtab->hashtab, key, string) < 0) {
+    
+        report_at (NULL, 0, REPORT_ERROR, "memory full (malloc)");
+        exit (EXIT_FAILURE);
+    
+    }
+    
+    dynarray_add (&strtab->strings, &strtab->nb_strings, string);
+    return string->index;
+
+}
+
+void strtab_finalize (struct strtab *strtab) {
+
+    struct strtab_string **sorted, **hosts, *prev = NULL;
+    unsigned long i, size = 0;
+    
+    unsigned char *p;
+    
+    if (strtab->nb_strings == 0) {
+        return;
+    }
+    
+    sorted = xmalloc (sizeof (*sorted) * strtab->nb_strings);
+    hosts = xmalloc (sizeof (*hosts) * strtab->nb_strings);
+    
+    for (i = 0; i < strtab->nb_strings; ++i) {
+        sorted[i] = strtab->strings[i];
+    }
+    
+    qsort (sorted, strtab->nb_strings, sizeof (*sorted), &compare_reversed);
+    
+    /*
+     * The sorted order only decides which strings are kept inside another
+     * one; the rest are laid out in the order they were added, so tables
+     * without shared suffixes come out exactly as they were written.
+     */
+    for (i = 0; i < strtab->nb_strings; ++i) {
+    
+        struct strtab_string *string = sorted[i];
+        
+        if (prev && prev->length >= string->length && memcmp (prev->chars + prev->length - string->length, string->chars, string->length) == 0) {
+        
+            hosts[string->index] = prev;
+            continue;
+        
+        }
+        
+        hosts[string->index] = NULL;
+        prev = string;
+    
+    }
+    
+    for (i = 0; i < strtab->nb_strings; ++i) {
+    
+        struct strtab_string *string = strtab->strings[i];
+        
+        if (hosts[i] == NULL) {
+        
+            string->offset = strtab->start + size;
+            size += string->length + 1;
+        
+        }
+    
+    }
+    
+    strtab->blob = p = xmalloc (size);
+    strtab->size = size;
+    
+    for (i = 0; i < strtab->nb_strings; ++i) {
+    
+        struct strtab_string *string = strtab->strings[i];
+        
+        if (hosts[i] == NULL) {
+        
+            memcpy (p, string->chars, string->length + 1);
+            p += string->length + 1;
+        
+        } else {
+            string->offset = hosts[i]->offset + (hosts[i]->length - string->length);
+        }
+    
+    }
+    
+    free (hosts);
+    free (sorted);
+
+}
+
+unsigned long strtab_get_offset (struct strtab *strtab, unsigned long index) {
+    return strtab->strings[index]->offset;
+}
+
+void strtab_free (struct strtab *strtab) {
+
+    unsigned long i;
+    
+    for (i = 0; i < strtab->hashtab.capacity; ++i) {
+        free (strtab->hashtab.entries[i].key);
+    }
+    
+    for (i = 0; i < strtab->nb_strings; ++i) {
+    
+        free (strtab->strings[i]->chars);
+        free (strtab->strings[i]);
+    
+    }
+    
+    mem_account (MEM_HASHTABS, 0, sizeof (*strtab->hashtab.entries) * strtab->hashtab.capacity);
+    free (strtab->hashtab.entries);
+    free (strtab->strings);
+    free (strtab->blob);
+    
+    memset (strtab, 0, sizeof (*strtab));
+
+}
@@ -0,0 +1,40 @@
+/******************************************************************************
+ * @file            strtab.h
+ *****************************************************************************/
+#ifndef     _STRTAB_H
+#define     _STRTAB_H
+
+#include    "hashtab.h"
+
+struct strtab_string {
+
+    char *chars;
+    unsigned long length, offset, index;
+
+};
+
+/**
+ * A string table for the object writers.  Strings are interned, and
+ * strtab_finalize lays them out as one blob in which a string that is a
+ * suffix of another ("foo" of "_foo") shares the longer one's bytes.
+ */
+struct strtab {
+
+    struct strtab_string **strings;
+    unsigned long nb_strings;
+    
+    struct hashtab hashtab;
+    
+    unsigned char *blob;
+    unsigned long start, size;
+
+};
+
+unsigned long strtab_add (struct strtab *strtab, const char *prefix, const char *name);
+unsigned long strtab_get_offset (struct strtab *strtab, unsigned long index);
+
+void strtab_finalize (struct strtab *strtab);
+void strtab_free (struct strtab *strtab);
+void strtab_init (struct strtab *strtab, unsigned long start);
+
+#endif      /* _STRTAB_H */
@@ -7,17 +7,116 @@
 
 #include    "expr.h"
 #include    "frag.h"
+#include    "hashtab.h"
 #include    "lib.h"
+#include    "parallel.h"
 #include    "report.h"
 #include    "section.h"
 #include    "symbol.h"
 #include    "types.h"
 
-static struct symbol **pointer_to_pointer_to_next_symbol = &symbols;
+struct symbol_cold {
+
+    struct expr value;
+    void *object_format_dependent_data;
+    
+    uint32_t symbol_table_index;
+    int size;
+
+};
+
+/**
+ * Symbols are numbered from 1 so that a next id of 0 ends the chain.
+ * Both arrays are split into fixed chunks so that records never move
+ * once handed out.
+ */
+#define     SYMBOL_CHUNK_SHIFT          9
+#define     SYMBOL_CHUNK_SIZE           (1UL << SYMBOL_CHUNK_SHIFT)
+
+static struct symbol **hot_chunks = NULL;
+static struct symbol_cold **cold_chunks = NULL;
+
+static unsigned long nb_chunks = 0;
+static uint32_t nb_symbols = 1;
+
+static struct symbol *last_symbol = NULL;
+
+static struct symbol **saved_hot_chunks = NULL;
+static struct symbol_cold **saved_cold_chunks = NULL;
+
+static unsigned long nb_saved_chunks = 0;
+static uint32_t nb_saved_symbols = 0;
+
+static struct symbol *saved_symbols = NULL, *saved_last_symbol = NULL;
+
+/**
+ * Chained symbols by name, as an open addressed table of ids and name
+ * hashes (8 bytes a slot, at most half full) rather than a hashtab, whose
+ * entries and keys would cost more than the symbol records themselves.
+ * Each name maps to its first symbol in the chain.  Names starting with
+ * DGROUP and a separator are rare, so those are also kept in a hashtab by
+ * the rest of the name.  Once a name turns up a second time, a rename
+ * rebuilds both tables rather than working out which symbol takes over.
+ */
+struct name_slot {
+
+    uint32_t hash, id;
+
+};
+
+struct dgroup_name {
+
+    struct hashtab_name key;
+    struct symbol *symbol;
+
+};
+
+#define     MIN_NAME_SLOTS              1024
+
+static struct name_slot *name_slots = NULL;
+static unsigned long nb_name_slots = 0, nb_names = 0;
+
+static struct hashtab hashtab_dgroup_names = { 0 };
+static int duplicate_names = 0;
 
 struct symbol *symbols = NULL;
 int finalize_symbols = 0;
 
+#define     symbol_from_id(id)          (&hot_chunks[(id) >> SYMBOL_CHUNK_SHIFT][(id) & (SYMBOL_CHUNK_SIZE - 1)])
+
+static struct symbol_cold *symbol_get_cold (struct symbol *symbol) {
+    return &cold_chunks[symbol->id >> SYMBOL_CHUNK_SHIFT][symbol->id & (SYMBOL_CHUNK_SIZE - 1)];
+}
+
+static struct symbol *symbol_alloc (void) {
+
+    struct symbol *symbol;
+    struct symbol_cold *cold;
+    
+    if ((nb_symbols >> SYMBOL_CHUNK_SHIFT) >= nb_chunks) {
+    
+        hot_chunks = xrealloc_for (MEM_SYMBOLS, hot_chunks, sizeof (*hot_chunks) * nb_chunks, sizeof (*hot_chunks) * (nb_chunks + 1));
+        cold_chunks = xrealloc_for (MEM_SYMBOLS, cold_chunks, sizeof (*cold_chunks) * nb_chunks, sizeof (*cold_chunks) * (nb_chunks + 1));
+        
+        hot_chunks[nb_chunks] = xmalloc_for (MEM_SYMBOLS, sizeof (**hot_chunks) * SYMBOL_CHUNK_SIZE);
+        cold_chunks[nb_chunks] = xmalloc_for (MEM_SYMBOLS, sizeof (**cold_chunks) * SYMBOL_CHUNK_SIZE);
+        
+        nb_chunks++;
+    
+    }
+    
+    symbol = symbol_from_id (nb_symbols);
+    memset (symbol, 0, sizeof (*symbol));
+    
+    symbol->id = nb_symbols++;
+    
+    cold = symbol_get_cold (symbol);
+    memset (cold, 0, sizeof (*cold));
+    
+    return symbol;
+
+}
+
 static void report_op_error (struct symbol *symbol, struct symbol *left, enum expr_type op, struct symbol *right) {
 
     const char *op_name;
@@ -151,7 +250,7 @@ static void report_op_error (struct symbol *symbol, struct symbol *left, enum ex
         }
     
     } else {
-        
+    
         if (left) {
             report_at (NULL, 0, REPORT_ERROR, "invalid operands (%s and %s sections) for `%s' when setting `%s'", section_get_name (left_section), section_get_name (right_section), op_name, symbol_get_name (symbol));
         } else {
@@ -163,14 +262,14 @@ static void report_op_error (struct symbol *symbol, struct symbol *left, enum ex
 }
 
 struct expr *symbol_get_value_expression (struct symbol *symbol) {
-    return &(symbol->value);
+    return &(symbol_get_cold (symbol)->value);
 }
 
 struct symbol *symbol_create (const char *name, section_t section, unsigned long value, frag_t frag) {
 
-    struct symbol *symbol = xmalloc (sizeof (*symbol));
+    struct symbol *symbol = symbol_alloc ();
     
-    symbol->name    = xstrdup (name);
+    symbol->name    = xstrdup_for (MEM_SYMBOLS, name);
     symbol->section = section;
     symbol->frag    = frag;
     
@@ -179,50 +278,302 @@ struct symbol *symbol_create (const char *name, section_t section, unsigned long
 
 }
 
-struct symbol *symbol_find (const char *name) {
+/** Charges the record and name of symbol, made for another subsystem, to category instead of MEM_SYMBOLS. */
+void symbol_account_to (struct symbol *symbol, int category) {
 
-    struct symbol *symbol;
+    unsigned long bytes = sizeof (struct symbol) + sizeof (struct symbol_cold) + strlen (symbol->name) + 1;
     
-    /* We need to skip DGROUP: in the provided name. */
+    mem_account (MEM_SYMBOLS, 0, bytes);
+    mem_account (category, bytes, 0);
+
+}
+
+/**
+ * Returns what follows DGROUP and its separator in name, or NULL if name
+ * does not start with DGROUP or is DGROUP__end or DGROUP__edata.
+ */
+static const char *dgroup_suffix (const char *name) {
+
     const char *temp = name;
     
-    if (strstart ("DGROUP", &temp)) {
+    if (strstart ("DGROUP", &temp) && *temp && strcmp (temp, "__end") && strcmp (temp, "__edata")) {
+        return temp + 1;
+    }
     
-        if (*temp && strcmp (temp, "__end") && strcmp (temp, "__edata")) {
-            name = temp + 1;
+    return NULL;
+
+}
+
+static uint32_t hash_name (const char *name) {
+
+    struct hashtab_name key;
+    
+    hashtab_init_name (&key, name);
+    return key.hash;
+
+}
+
+static struct name_slot *find_name_slot (const char *name, uint32_t hash) {
+
+    unsigned long mask = nb_name_slots - 1, index;
+    
+    for (index = hash & mask; ; index = (index + 1) & mask) {
+    
+        struct name_slot *slot = &name_slots[index];
+        
+        if (slot->id == 0 || (slot->hash == hash && strcmp (symbol_from_id (slot->id)->name, name) == 0)) {
+            return slot;
         }
     
     }
+
+}
+
+static void grow_name_slots (void) {
+
+    struct name_slot *old_slots = name_slots;
+    unsigned long old_count = nb_name_slots, i;
+    
+    nb_name_slots = old_count ? old_count * 2 : MIN_NAME_SLOTS;
+    name_slots = xmalloc_for (MEM_HASHTABS, sizeof (*name_slots) * nb_name_slots);
     
-    for (symbol = symbols; symbol && strcmp (symbol->name, name); symbol = symbol->next) {
+    for (i = 0; i < old_count; ++i) {
     
-        /**
-         * Okay, at this point we need to see if the symbol name starts with DGROUP:
-         * and replace the symbol name with the provided one if the the symbol
-         * name ends with the provided name.
-         */
-        temp = symbol->name;
+        unsigned long mask = nb_name_slots - 1, index;
         
-        if (strstart ("DGROUP", &temp)) {
+        if (old_slots[i].id == 0) {
+            continue;
+        }
         
-            if (!*temp || strcmp (temp, "__end") == 0 || strcmp (temp, "__edata") == 0) {
-                continue;
-            }
-            
-            if (strcmp (temp + 1, name) == 0) {
-            
-                free (symbol->name);
-                
-                symbol->name = xstrdup (name);
-                break;
-            
-            }
+        index = old_slots[i].hash & mask;
         
+        while (name_slots[index].id) {
+            index = (index + 1) & mask;
         }
+        
+        name_slots[index] = old_slots[i];
     
     }
     
-    return symbol;
+    mem_account (MEM_HASHTABS, 0, sizeof (*old_slots) * old_count);
+    free (old_slots);
+
+}
+
+static void remove_name_slot (struct name_slot *slot) {
+
+    unsigned long mask = nb_name_slots - 1, hole, index, home;
+    
+    hole = index = slot - name_slots;
+    
+    for (;;) {
+    
+        index = (index + 1) & mask;
+        
+        if (name_slots[index].id == 0) {
+            break;
+        }
+        
+        home = name_slots[index].hash & mask;
+        
+        /* Leave the slot alone if its home slot lies after the hole (cyclically). */
+        if (hole <= index ? (hole < home && home <= index) : (hole < home || home <= index)) {
+            continue;
+        }
+        
+        name_slots[hole] = name_slots[index];
+        hole = index;
+    
+    }
+    
+    name_slots[hole].id = 0;
+    nb_names--;
+
+}
+
+static void index_symbol (struct symbol *symbol) {
+
+    struct dgroup_name *dgroup;
+    struct name_slot *slot;
+    
+    uint32_t hash = hash_name (symbol->name);
+    const char *suffix;
+    
+    if (nb_names >= nb_name_slots / 2) {
+        grow_name_slots ();
+    }
+    
+    if ((slot = find_name_slot (symbol->name, hash))->id) {
+        duplicate_names = 1;
+    } else {
+    
+        slot->hash = hash;
+        slot->id = symbol->id;
+        
+        nb_names++;
+    
+    }
+    
+    if ((suffix = dgroup_suffix (symbol->name)) == NULL) {
+        return;
+    }
+    
+    dgroup = xmalloc_for (MEM_SYMBOLS, sizeof (*dgroup));
+    dgroup->symbol = symbol;
+    
+    hashtab_init_name (&dgroup->key, suffix);
+    
+    if (hashtab_get (&hashtab_dgroup_names, &dgroup->key)) {
+    
+        duplicate_names = 1;
+        
+        mem_account (MEM_SYMBOLS, 0, sizeof (*dgroup));
+        free (dgroup);
+    
+    } else if (hashtab_put (&hashtab_dgroup_names, &dgroup->key, dgroup)) {
+    
+        report_at (NULL, 0, REPORT_ERROR, "memory full (malloc)");
+        exit (EXIT_FAILURE);
+    
+    }
+
+}
+
+static void unindex_symbol (struct symbol *symbol) {
+
+    struct dgroup_name *dgroup;
+    struct name_slot *slot;
+    
+    struct hashtab_name key;
+    const char *suffix;
+    
+    if ((slot = find_name_slot (symbol->name, hash_name (symbol->name)))->id == symbol->id) {
+        remove_name_slot (slot);
+    }
+    
+    if ((suffix = dgroup_suffix (symbol->name)) == NULL) {
+        return;
+    }
+    
+    hashtab_init_name (&key, suffix);
+    
+    if ((dgroup = hashtab_get (&hashtab_dgroup_names, &key)) != NULL && dgroup->symbol == symbol) {
+    
+        hashtab_remove (&hashtab_dgroup_names, &key);
+        
+        mem_account (MEM_SYMBOLS, 0, sizeof (*dgroup));
+        free (dgroup);
+    
+    }
+
+}
+
+static void rebuild_index (void) {
+
+    struct symbol *symbol;
+    unsigned long i;
+    
+    for (i = 0; i < hashtab_dgroup_names.capacity; ++i) {
+    
+        if (hashtab_dgroup_names.entries[i].key) {
+        
+            mem_account (MEM_SYMBOLS, 0, sizeof (struct dgroup_name));
+            free (hashtab_dgroup_names.entries[i].value);
+        
+        }
+    
+    }
+    
+    mem_account (MEM_HASHTABS, 0, sizeof (*hashtab_dgroup_names.entries) * hashtab_dgroup_names.capacity);
+    free (hashtab_dgroup_names.entries);
+    
+    memset (&hashtab_dgroup_names, 0, sizeof (hashtab_dgroup_names));
+    
+    if (name_slots) {
+        memset (name_slots, 0, sizeof (*name_slots) * nb_name_slots);
+    }
+    
+    nb_names = 0;
+    duplicate_names = 0;
+    
+    for (symbol = symbols; symbol; symbol = symbol_next (symbol)) {
+        index_symbol (symbol);
+    }
+
+}
+
+/** Returns whether a is ahead of b in the chain; only needed when both hold the name being looked up. */
+static int comes_before (struct symbol *a, struct symbol *b) {
+
+    struct symbol *symbol;
+    
+    for (symbol = symbols; symbol; symbol = symbol_next (symbol)) {
+    
+        if (symbol == a || symbol == b) {
+            break;
+        }
+    
+    }
+    
+    return symbol == a;
+
+}
+
+struct symbol *symbol_find (const char *name) {
+
+    struct symbol *symbol, *dgroup_symbol;
+    struct dgroup_name *dgroup;
+    struct name_slot *slot;
+    
+    struct hashtab_name key;
+    const char *suffix;
+    
+    /* We need to skip DGROUP: in the provided name. */
+    if ((suffix = dgroup_suffix (name)) != NULL) {
+        name = suffix;
+    }
+    
+    if (nb_names && (slot = find_name_slot (name, hash_name (name)))->id) {
+        symbol = symbol_from_id (slot->id);
+    } else {
+        symbol = NULL;
+    }
+    
+    if (hashtab_dgroup_names.count == 0) {
+        return symbol;
+    }
+    
+    hashtab_init_name (&key, name);
+    
+    if ((dgroup = hashtab_get (&hashtab_dgroup_names, &key)) == NULL) {
+        return symbol;
+    }
+    
+    dgroup_symbol = dgroup->symbol;
+    
+    if (symbol && !comes_before (dgroup_symbol, symbol)) {
+        return symbol;
+    }
+    
+    /**
+     * Okay, at this point the first symbol found is named DGROUP: followed
+     * by the provided name, so we replace the symbol name with the provided
+     * one.
+     */
+    unindex_symbol (dgroup_symbol);
+    
+    mem_account (MEM_SYMBOLS, 0, strlen (dgroup_symbol->name) + 1);
+    free (dgroup_symbol->name);
+    
+    dgroup_symbol->name = xstrdup_for (MEM_SYMBOLS, name);
+    
+    if (duplicate_names || symbol) {
+        rebuild_index ();
+    } else {
+        index_symbol (dgroup_symbol);
+    }
+    
+    return dgroup_symbol;
 
 }
 
@@ -289,24 +640,22 @@ value_t symbol_get_value (struct symbol *symbol) {
     return symbol_resolve_value (symbol);
 }
 
-value_t symbol_resolve_value (struct symbol *symbol) {
+static value_t resolve_value (struct symbol *symbol) {
 
+    struct expr *expr;
+    
     int resolved = 0;
     value_t final_value = 0;
     
     section_t final_section = symbol_get_section (symbol);
     
-    if (symbol->resolved) {
-        
-        if (symbol->value.type == EXPR_TYPE_CONSTANT) {
-            return (symbol->value.add_number);
-        }
-        
-        return 0;
-    
+    if (symbol->flags & SYMBOL_FLAG_RESOLVED) {
+        return symbol->value;
     }
     
-    if (symbol->resolving) {
+    expr = symbol_get_value_expression (symbol);
+    
+    if (symbol->flags & SYMBOL_FLAG_RESOLVING) {
     
         report_at (NULL, 0, REPORT_ERROR, "symbol definition loop encountered at '%s'", symbol_get_name (symbol));
         
@@ -320,11 +669,11 @@ value_t symbol_resolve_value (struct symbol *symbol) {
         
         int can_move_into_absolute_section;
         
-        symbol->resolving = 1;
-        final_value = symbol->value.add_number;
-
-        switch (symbol->value.type) {
-            
+        symbol->flags |= SYMBOL_FLAG_RESOLVING;
+        final_value = expr->add_number;
+        
+        switch (expr->type) {
+        
             case EXPR_TYPE_ABSENT:
             
                 final_value = 0;
@@ -341,32 +690,32 @@ value_t symbol_resolve_value (struct symbol *symbol) {
                 /* fall through */
             
             case EXPR_TYPE_REGISTER:
-                
+            
                 resolved = 1;
                 break;
             
             case EXPR_TYPE_SYMBOL:
             case EXPR_TYPE_SYMBOL_RVA:
             
-                left_value = symbol_resolve_value (symbol->value.add_symbol);
-                left_section = symbol_get_section (symbol->value.add_symbol);
-                
+                left_value = resolve_value (expr->add_symbol);
+                left_section = symbol_get_section (expr->add_symbol);
+            
             do_symbol:
-                
+            
                 if (left_section == undefined_section || (finalize_symbols && final_section == expr_section && left_section != expr_section && left_section != absolute_section)) {
                 
                     if (finalize_symbols) {
                     
-                        symbol->value.type = EXPR_TYPE_SYMBOL;
-                        symbol->value.op_symbol = symbol->value.add_symbol;
-                        symbol->value.add_number = final_value;
+                        expr->type = EXPR_TYPE_SYMBOL;
+                        expr->op_symbol = expr->add_symbol;
+                        expr->add_number = final_value;
                     
                     }
                     
                     final_section = left_section;
                     final_value += symbol->frag->address + left_value;
-                    resolved = symbol_is_resolved (symbol->value.add_symbol);
-                    symbol->resolving = 0;
+                    resolved = symbol_is_resolved (expr->add_symbol);
+                    symbol->flags &= ~SYMBOL_FLAG_RESOLVING;
                     
                     goto exit_do_not_set_value;
                 
@@ -380,25 +729,25 @@ value_t symbol_resolve_value (struct symbol *symbol) {
                 
                 }
                 
-                resolved = symbol_is_resolved (symbol->value.add_symbol);
+                resolved = symbol_is_resolved (expr->add_symbol);
                 break;
             
             case EXPR_TYPE_LOGICAL_NOT:
             case EXPR_TYPE_BIT_NOT:
             case EXPR_TYPE_UNARY_MINUS:
             
-                left_value = symbol_resolve_value (symbol->value.add_symbol);
-                left_section = symbol_get_section (symbol->value.add_symbol);
+                left_value = resolve_value (expr->add_symbol);
+                left_section = symbol_get_section (expr->add_symbol);
                 
-                if (symbol->value.type != EXPR_TYPE_LOGICAL_NOT && left_section != absolute_section && finalize_symbols) {
-                    report_op_error (symbol, NULL, symbol->value.type, symbol->value.add_symbol);
+                if (expr->type != EXPR_TYPE_LOGICAL_NOT && left_section != absolute_section && finalize_symbols) {
+                    report_op_error (symbol, NULL, expr->type, expr->add_symbol);
                 }
                 
                 if (final_section == expr_section || final_section == undefined_section) {
                     final_section = absolute_section;
                 }
                 
-                switch (symbol->value.type) {
+                switch (expr->type) {
                 
                     case EXPR_TYPE_LOGICAL_NOT:
                     
@@ -422,7 +771,7 @@ value_t symbol_resolve_value (struct symbol *symbol) {
                 }
                 
                 final_value += left_value + symbol->frag->address;
-                resolved = symbol_is_resolved (symbol->value.add_symbol);
+                resolved = symbol_is_resolved (expr->add_symbol);
                 
                 break;
             
@@ -445,12 +794,12 @@ value_t symbol_resolve_value (struct symbol *symbol) {
             case EXPR_TYPE_LEFT_SHIFT:
             case EXPR_TYPE_RIGHT_SHIFT:
             
-                left_value = symbol_resolve_value (symbol->value.add_symbol);
-                right_value = symbol_resolve_value (symbol->value.op_symbol);
-                left_section = symbol_get_section (symbol->value.add_symbol);
-                right_section = symbol_get_section (symbol->value.op_symbol);
+                left_value = resolve_value (expr->add_symbol);
+                right_value = resolve_value (expr->op_symbol);
+                left_section = symbol_get_section (expr->add_symbol);
+                right_section = symbol_get_section (expr->op_symbol);
                 
-                if (symbol->value.type == EXPR_TYPE_ADD) {
+                if (expr->type == EXPR_TYPE_ADD) {
                 
                     if (right_section == absolute_section) {
                     
@@ -460,7 +809,7 @@ value_t symbol_resolve_value (struct symbol *symbol) {
                     } else if (left_section == absolute_section) {
                     
                         final_value += left_value;
-                        symbol->value.add_symbol = symbol->value.op_symbol;
+                        expr->add_symbol = expr->op_symbol;
                         
                         left_value = right_value;
                         left_section = right_section;
@@ -469,7 +818,7 @@ value_t symbol_resolve_value (struct symbol *symbol) {
                     
                     }
                 
-                } else if (symbol->value.type == EXPR_TYPE_SUBTRACT) {
+                } else if (expr->type == EXPR_TYPE_SUBTRACT) {
                 
                     if (right_section == absolute_section) {
                     
@@ -489,16 +838,16 @@ value_t symbol_resolve_value (struct symbol *symbol) {
                  * Addition and subtraction of constants is handled above.
                  */
                 if (!(left_section == absolute_section && right_section == absolute_section)
-                    && !(symbol->value.type == EXPR_TYPE_EQUAL || symbol->value.type == EXPR_TYPE_NOT_EQUAL)
-                    && !((symbol->value.type == EXPR_TYPE_SUBTRACT
-                            || symbol->value.type == EXPR_TYPE_LESSER || symbol->value.type == EXPR_TYPE_LESSER_EQUAL
-                            || symbol->value.type == EXPR_TYPE_GREATER || symbol->value.type == EXPR_TYPE_GREATER_EQUAL)
+                    && !(expr->type == EXPR_TYPE_EQUAL || expr->type == EXPR_TYPE_NOT_EQUAL)
+                    && !((expr->type == EXPR_TYPE_SUBTRACT
+                            || expr->type == EXPR_TYPE_LESSER || expr->type == EXPR_TYPE_LESSER_EQUAL
+                            || expr->type == EXPR_TYPE_GREATER || expr->type == EXPR_TYPE_GREATER_EQUAL)
                          && left_section == right_section
-                         && (left_section != undefined_section || symbol->value.add_symbol == symbol->value.op_symbol)))
+                         && (left_section != undefined_section || expr->add_symbol == expr->op_symbol)))
                 {
                 
                     if (finalize_symbols) {
-                        report_op_error (symbol, symbol->value.add_symbol, symbol->value.type, symbol->value.op_symbol);
+                        report_op_error (symbol, expr->add_symbol, expr->type, expr->op_symbol);
                     } else {
                         can_move_into_absolute_section = 0;
                     }
@@ -510,7 +859,7 @@ value_t symbol_resolve_value (struct symbol *symbol) {
                 }
                 
                 /* Checks for division by zero. */
-                if ((symbol->value.type == EXPR_TYPE_DIVIDE || symbol->value.type == EXPR_TYPE_MODULUS) && right_value == 0) {
+                if ((expr->type == EXPR_TYPE_DIVIDE || expr->type == EXPR_TYPE_MODULUS) && right_value == 0) {
                 
                     const char *filename;
                     unsigned long line_number;
@@ -525,7 +874,7 @@ value_t symbol_resolve_value (struct symbol *symbol) {
                 
                 }
                 
-                switch (symbol->value.type) {
+                switch (expr->type) {
                 
                     case EXPR_TYPE_LOGICAL_OR:
                     
@@ -543,10 +892,10 @@ value_t symbol_resolve_value (struct symbol *symbol) {
                         left_value = ((left_value == right_value
                                        && left_section == right_section
                                        && (left_section != undefined_section
-                                           || symbol->value.add_symbol == symbol->value.op_symbol))
+                                           || expr->add_symbol == expr->op_symbol))
                                       ? ~ (offset_t) 0 : 0);
                         
-                        if (symbol->value.type == EXPR_TYPE_NOT_EQUAL) {
+                        if (expr->type == EXPR_TYPE_NOT_EQUAL) {
                             left_value = ~left_value;
                         }
                         
@@ -642,20 +991,20 @@ value_t symbol_resolve_value (struct symbol *symbol) {
                 
                 }
                 
-                resolved = (symbol_is_resolved (symbol->value.add_symbol) && symbol_is_resolved (symbol->value.op_symbol));
+                resolved = (symbol_is_resolved (expr->add_symbol) && symbol_is_resolved (expr->op_symbol));
                 break;
             
             default:
             
-                report_at (__FILE__, __LINE__, REPORT_INTERNAL_ERROR, "symbol_resolve_value invalid case %i", symbol->value.type);
+                report_at (__FILE__, __LINE__, REPORT_INTERNAL_ERROR, "symbol_resolve_value invalid case %i", expr->type);
                 exit (EXIT_FAILURE);
         
         }
         
-        symbol->resolving = 0;
+        symbol->flags &= ~SYMBOL_FLAG_RESOLVING;
     
     }
-
+    
     if (finalize_symbols) {
         symbol_set_value (symbol, final_value);
     }
@@ -665,16 +1014,36 @@ exit_do_not_set_value:
     if (finalize_symbols) {
     
         if (resolved) {
-            symbol->resolved = resolved;
+        
+            symbol->flags |= SYMBOL_FLAG_RESOLVED;
+            symbol->value = (expr->type == EXPR_TYPE_CONSTANT ? expr->add_number : 0);
+        
         }
     
     }
     
-    symbol_set_section (symbol, final_section);
+    /* Only written when it changes, so sections relaxed side by side can read the sections of each other's symbols. */
+    if (symbol_get_section (symbol) != final_section) {
+        symbol_set_section (symbol, final_section);
+    }
+    
     return final_value;
 
 }
 
+/** Symbols are shared by all sections, so they are resolved under the lock of sections worked on side by side. */
+value_t symbol_resolve_value (struct symbol *symbol) {
+
+    value_t value;
+    
+    parallel_lock ();
+    value = resolve_value (symbol);
+    parallel_unlock ();
+    
+    return value;
+
+}
+
 char *symbol_get_name (struct symbol *symbol) {
     return symbol->name;
 }
@@ -689,13 +1058,13 @@ int get_symbol_snapshot (struct symbol **symbol_p, value_t *value_p, section_t *
     
         int resolved;
         
-        if (symbol->resolving) {
+        if (symbol->flags & SYMBOL_FLAG_RESOLVING) {
             return 1;
         }
         
-        symbol->resolving = 1;
+        symbol->flags |= SYMBOL_FLAG_RESOLVING;
         resolved = resolve_expression (expr);
-        symbol->resolving = 0;
+        symbol->flags &= ~SYMBOL_FLAG_RESOLVING;
         
         if (resolved == 0) {
             return 1;
@@ -763,8 +1132,12 @@ int symbol_is_external (struct symbol *symbol) {
     return symbol->flags & SYMBOL_FLAG_EXTERNAL;
 }
 
+int symbol_get_size (struct symbol *symbol) {
+    return symbol_get_cold (symbol)->size;
+}
+
 int symbol_is_resolved (struct symbol *symbol) {
-    return symbol->resolved;
+    return (symbol->flags & SYMBOL_FLAG_RESOLVED) != 0;
 }
 
 int symbol_is_section_symbol (struct symbol *symbol) {
@@ -776,21 +1149,110 @@ int symbol_is_undefined (struct symbol *symbol) {
 }
 
 int symbol_uses_other_symbol (struct symbol *symbol) {
-    return (symbol->value.type == EXPR_TYPE_SYMBOL);
+    return (symbol_get_value_expression (symbol)->type == EXPR_TYPE_SYMBOL);
 }
 
 int symbol_uses_reloc_symbol (struct symbol *symbol) {
-    return (symbol->value.type == EXPR_TYPE_SYMBOL && ((symbol_is_resolved (symbol) && symbol->value.op_symbol) || symbol_is_undefined (symbol)));
+
+    struct expr *expr = symbol_get_value_expression (symbol);
+    return (expr->type == EXPR_TYPE_SYMBOL && ((symbol_is_resolved (symbol) && expr->op_symbol) || symbol_is_undefined (symbol)));
+
+}
+
+struct symbol *symbol_next (struct symbol *symbol) {
+    return (symbol->next ? symbol_from_id (symbol->next) : NULL);
 }
 
 unsigned long symbol_get_symbol_table_index (struct symbol *symbol) {
-    return symbol->symbol_table_index;
+    return symbol_get_cold (symbol)->symbol_table_index;
+}
+
+void *symbol_get_object_format_dependent_data (struct symbol *symbol) {
+    return symbol_get_cold (symbol)->object_format_dependent_data;
+}
+
+/** Copies every symbol so that symbols_restore_state can undo the finalization done for one output format. */
+void symbols_save_state (void) {
+
+    unsigned long i;
+    
+    symbols_free_state ();
+    
+    saved_hot_chunks = xmalloc_for (MEM_SYMBOLS, sizeof (*saved_hot_chunks) * nb_chunks);
+    saved_cold_chunks = xmalloc_for (MEM_SYMBOLS, sizeof (*saved_cold_chunks) * nb_chunks);
+    
+    for (i = 0; i < nb_chunks; ++i) {
+    
+        saved_hot_chunks[i] = xmalloc_for (MEM_SYMBOLS, sizeof (**hot_chunks) * SYMBOL_CHUNK_SIZE);
+        memcpy (saved_hot_chunks[i], hot_chunks[i], sizeof (**hot_chunks) * SYMBOL_CHUNK_SIZE);
+        
+        saved_cold_chunks[i] = xmalloc_for (MEM_SYMBOLS, sizeof (**cold_chunks) * SYMBOL_CHUNK_SIZE);
+        memcpy (saved_cold_chunks[i], cold_chunks[i], sizeof (**cold_chunks) * SYMBOL_CHUNK_SIZE);
+    
+    }
+    
+    nb_saved_chunks = nb_chunks;
+    nb_saved_symbols = nb_symbols;
+    
+    saved_symbols = symbols;
+    saved_last_symbol = last_symbol;
+
+}
+
+void symbols_restore_state (void) {
+
+    unsigned long i;
+    
+    for (i = 0; i < nb_saved_chunks; ++i) {
+    
+        memcpy (hot_chunks[i], saved_hot_chunks[i], sizeof (**hot_chunks) * SYMBOL_CHUNK_SIZE);
+        memcpy (cold_chunks[i], saved_cold_chunks[i], sizeof (**cold_chunks) * SYMBOL_CHUNK_SIZE);
+    
+    }
+    
+    nb_symbols = nb_saved_symbols;
+    
+    symbols = saved_symbols;
+    last_symbol = saved_last_symbol;
+    
+    finalize_symbols = 0;
+    rebuild_index ();
+
+}
+
+void symbols_free_state (void) {
+
+    unsigned long i;
+    
+    for (i = 0; i < nb_saved_chunks; ++i) {
+    
+        free (saved_hot_chunks[i]);
+        free (saved_cold_chunks[i]);
+    
+    }
+    
+    free (saved_hot_chunks);
+    free (saved_cold_chunks);
+    
+    mem_account (MEM_SYMBOLS, 0, (sizeof (*saved_hot_chunks) + sizeof (*saved_cold_chunks) + (sizeof (**hot_chunks) + sizeof (**cold_chunks)) * SYMBOL_CHUNK_SIZE) * nb_saved_chunks);
+    
+    saved_hot_chunks = NULL;
+    saved_cold_chunks = NULL;
+    
+    nb_saved_chunks = 0;
+
 }
 
 void symbol_add_to_chain (struct symbol *symbol) {
 
-    *pointer_to_pointer_to_next_symbol = symbol;
-    pointer_to_pointer_to_next_symbol = &symbol->next;
+    if (last_symbol) {
+        last_symbol->next = symbol->id;
+    } else {
+        symbols = symbol;
+    }
+    
+    last_symbol = symbol;
+    index_symbol (symbol);
 
 }
 
@@ -802,35 +1264,39 @@ void symbol_set_frag (struct symbol *symbol, struct frag *frag) {
     symbol->frag = frag;
 }
 
+void symbol_set_object_format_dependent_data (struct symbol *symbol, void *data) {
+    symbol_get_cold (symbol)->object_format_dependent_data = data;
+}
+
 void symbol_set_section (struct symbol *symbol, section_t section) {
     symbol->section = section;
 }
 
 void symbol_set_size (int size) {
 
-    struct symbol *symbol;
-    
-    for (symbol = symbols; symbol->next; symbol = symbol->next);
-    
-    if (symbol == NULL) {
+    if (last_symbol == NULL) {
         return;
     }
     
-    symbol->size = size;
+    symbol_get_cold (last_symbol)->size = size;
 
 }
 
 void symbol_set_symbol_table_index (struct symbol *symbol, unsigned long index) {
-    symbol->symbol_table_index = index;
+    symbol_get_cold (symbol)->symbol_table_index = index;
 }
 
 void symbol_set_value (struct symbol *symbol, value_t value) {
 
-    symbol->value.type = EXPR_TYPE_CONSTANT;
-    symbol->value.add_number = value;
+    struct expr *expr = symbol_get_value_expression (symbol);
+    
+    expr->type = EXPR_TYPE_CONSTANT;
+    expr->add_number = value;
+    
+    symbol->value = value;
 
 }
 
 void symbol_set_value_expression (struct symbol *symbol, struct expr *expr) {
-    symbol->value = *expr;
+    *symbol_get_value_expression (symbol) = *expr;
 }
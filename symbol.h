@@ -7,25 +7,28 @@
 #include    "expr.h"
 #include    "types.h"
 
+/**
+ * The fields read on every walk over the symbols.  Records live in dense
+ * chunks indexed by id, and the value expression, symbol table index,
+ * size and object format data are kept in a parallel cold array in
+ * symbol.c that is only touched through the accessors below.
+ */
 struct symbol {
 
     char *name;
     
-    struct expr value;
     section_t section;
-    
     frag_t frag;
-    unsigned long flags;
     
-#define     SYMBOL_FLAG_EXTERNAL                            0x01
-#define     SYMBOL_FLAG_SECTION_SYMBOL                      0x02
+    value_t value;
+    uint32_t id, next;
     
-    struct symbol *next;
+    unsigned int flags;
     
-    unsigned long symbol_table_index;
-    int resolved, resolving, size, write_name_to_string_table;
-    
-    void *object_format_dependent_data;
+#define     SYMBOL_FLAG_EXTERNAL                            0x01
+#define     SYMBOL_FLAG_SECTION_SYMBOL                      0x02
+#define     SYMBOL_FLAG_RESOLVED                            0x04
+#define     SYMBOL_FLAG_RESOLVING                           0x08
 
 };
 
@@ -60,15 +63,27 @@ int symbol_is_undefined (struct symbol *symbol);
 int symbol_uses_other_symbol (struct symbol *symbol);
 int symbol_uses_reloc_symbol (struct symbol *symbol);
 
+struct symbol *symbol_next (struct symbol *symbol);
+
+int symbol_get_size (struct symbol *symbol);
 unsigned long symbol_get_symbol_table_index (struct symbol *symbol);
 
+void *symbol_get_object_format_dependent_data (struct symbol *symbol);
+
+void symbols_free_state (void);
+void symbols_restore_state (void);
+void symbols_save_state (void);
+
 void symbol_add_to_chain (struct symbol *symbol);
 void symbol_set_external (struct symbol *symbol);
 void symbol_set_frag (struct symbol *symbol, frag_t frag);
+void symbol_set_object_format_dependent_data (struct symbol *symbol, void *data);
 void symbol_set_section (struct symbol *symbol, section_t section);
 void symbol_set_size (int size);
 void symbol_set_symbol_table_index (struct symbol *symbol, unsigned long index);
 void symbol_set_value (struct symbol *symbol, value_t value);
 void symbol_set_value_expression (struct symbol *symbol, struct expr *expr);
 
+void symbol_account_to (struct symbol *symbol, int category);
+
 #endif      /* _SYMBOL_H */
@@ -0,0 +1,290 @@
+/******************************************************************************
+ * @file            trace.c
+ *****************************************************************************/
+#include    <stddef.h>
+#include    <stdio.h>
+#include    <stdlib.h>
+#include    <string.h>
+#include    <time.h>
+
+#include    "as.h"
+#include    "hashtab.h"
+#include    "lib.h"
+#include    "report.h"
+#include    "trace.h"
+
+/**
+ * Per-file cost attribution.
+ *
+ * Every source file processed opens a span that is closed when the file
+ * has been read to the end; an included file's span nests inside the span
+ * of the file including it, and the time of the nested spans is taken
+ * out of the including file's own (self) time.  Relaxation and writing
+ * get spans of their own.  The spans are written out as Chrome trace
+ * events ("X" events with microsecond timestamps), and the totals for
+ * each file are printed with the other statistics.
+ *
+ * Times come from clock (), which is all C90 offers.
+ */
+struct file_cost {
+
+    const char *filename;
+    unsigned long included, lines, bytes;
+    
+    unsigned long total, self;
+
+};
+
+struct span {
+
+    const char *name, *category;
+    unsigned long start, duration;
+    
+    struct file_cost *file;
+    unsigned long lines, bytes, children;
+
+};
+
+static struct hashtab hashtab_files = { 0 };
+
+static struct file_cost **files = NULL;
+static unsigned long nb_files = 0;
+
+static struct span **spans = NULL;
+static unsigned long nb_spans = 0;
+
+/* Spans still open, innermost last. */
+static struct span **open_spans = NULL;
+static unsigned long nb_open_spans = 0, open_spans_capacity = 0;
+
+static int enabled (void) {
+    return (state->trace || state->stats || state->stats_json);
+}
+
+static unsigned long now (void) {
+    return (unsigned long) (((double) clock () * 1000000.0) / CLOCKS_PER_SEC);
+}
+
+static struct file_cost *find_file_cost (const char *filename) {
+
+    struct file_cost *file;
+    struct hashtab_name *key;
+    
+    if ((key = hashtab_alloc_name (filename)) == NULL) {
+        return NULL;
+    }
+    
+    if ((file = hashtab_get (&hashtab_files, key)) != NULL) {
+    
+        free (key);
+        return file;
+    
+    }
+    
+    file = xmalloc (sizeof (*file));
+    file->filename = filename;
+    
+    if (hashtab_put (&hashtab_files, key, file)) {
+    
+        free (key);
+        free (file);
+        
+        return NULL;
+    
+    }
+    
+    dynarray_add (&files, &nb_files, file);
+    return file;
+
+}
+
+static void begin_span (const char *name, const char *category, struct file_cost *file) {
+
+    struct span *span = xmalloc (sizeof (*span));
+    
+    span->name = name;
+    span->category = category;
+    span->file = file;
+    
+    if (nb_open_spans == open_spans_capacity) {
+    
+        open_spans_capacity = open_spans_capacity ? open_spans_capacity * 2 : 16;
+        open_spans = xrealloc (open_spans, sizeof (*open_spans) * open_spans_capacity);
+    
+    }
+    
+    open_spans[nb_open_spans++] = span;
+    dynarray_add (&spans, &nb_spans, span);
+    
+    span->start = now ();
+
+}
+
+static struct span *end_span (void) {
+
+    struct span *span;
+    
+    if (nb_open_spans == 0) {
+        return NULL;
+    }
+    
+    span = open_spans[--nb_open_spans];
+    span->duration = now () - span->start;
+    
+    if (nb_open_spans > 0) {
+        open_spans[nb_open_spans - 1]->children += span->duration;
+    }
+    
+    return span;
+
+}
+
+void trace_file_begin (const char *filename) {
+
+    struct file_cost *file;
+    char *name;
+    
+    if (!enabled ()) {
+        return;
+    }
+    
+    name = xstrdup (filename);
+    
+    if ((file = find_file_cost (name)) != NULL && nb_open_spans > 0 && open_spans[nb_open_spans - 1]->file) {
+        file->included++;
+    }
+    
+    begin_span (name, "file", file);
+
+}
+
+void trace_file_end (unsigned long lines, unsigned long bytes) {
+
+    struct span *span;
+    
+    if (!enabled () || (span = end_span ()) == NULL) {
+        return;
+    }
+    
+    span->lines = lines;
+    span->bytes = bytes;
+    
+    if (span->file) {
+    
+        span->file->lines += lines;
+        span->file->bytes += bytes;
+        span->file->total += span->duration;
+        span->file->self += span->duration - span->children;
+    
+    }
+
+}
+
+void trace_phase_begin (const char *name) {
+
+    if (enabled ()) {
+        begin_span (name, "phase", NULL);
+    }
+
+}
+
+void trace_phase_end (void) {
+
+    if (enabled ()) {
+        end_span ();
+    }
+
+}
+
+static int compare_file_costs (const void *a, const void *b) {
+
+    const struct file_cost *file1 = *(const struct file_cost * const *) a;
+    const struct file_cost *file2 = *(const struct file_cost * const *) b;
+    
+    if (file1->self != file2->self) {
+        return (file1->self > file2->self) ? -1 : 1;
+    }
+    
+    return strcmp (file1->filename, file2->filename);
+
+}
+
+void trace_print_stats (FILE *fp) {
+
+    unsigned long i;
+    
+    qsort (files, nb_files, sizeof (*files), &compare_file_costs);
+    
+    for (i = 0; i < nb_files; ++i) {
+    
+        struct file_cost *file = files[i];
+        
+        fprintf (fp, "file %s: included %lu times, %lu lines, %lu bytes, %lu.%03lu ms total, %lu.%03lu ms self\n",
+                 file->filename, file->included, file->lines, file->bytes, file->total / 1000, file->total % 1000, file->self / 1000, file->self % 1000);
+    
+    }
+
+}
+
+void trace_print_stats_json (FILE *fp) {
+
+    unsigned long i;
+    
+    qsort (files, nb_files, sizeof (*files), &compare_file_costs);
+    fprintf (fp, ",\n    \"files\": [");
+    
+    for (i = 0; i < nb_files; ++i) {
+    
+        struct file_cost *file = files[i];
+        
+        fprintf (fp, "%s\n        { \"name\": ", i ? "," : "");
+        print_json_string (fp, file->filename);
+        fprintf (fp, ", \"included\": %lu, \"lines\": %lu, \"bytes\": %lu, \"total_us\": %lu, \"self_us\": %lu }", file->included, file->lines, file->bytes, file->total, file->self);
+    
+    }
+    
+    fprintf (fp, "%s]", nb_files ? "\n    " : "");
+
+}
+
+void trace_write (void) {
+
+    unsigned long i;
+    FILE *fp;
+    
+    if (!state->trace) {
+        return;
+    }
+    
+    if ((fp = fopen (state->trace, "w")) == NULL) {
+    
+        report_at (NULL, 0, REPORT_ERROR, "failed to open '%s' for writing", state->trace);
+        return;
+    
+    }
+    
+    fprintf (fp, "{ \"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    
+    for (i = 0; i < nb_spans; ++i) {
+    
+        struct span *span = spans[i];
+        
+        fprintf (fp, "%s\n    { \"name\": ", i ? "," : "");
+        print_json_string (fp, span->name);
+        fprintf (fp, ", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, \"ts\": %lu, \"dur\": %lu", span->category, span->start, span->duration);
+        
+        if (span->file) {
+            fprintf (fp, ", \"args\": { \"lines\": %lu, \"bytes\": %lu }", span->lines, span->bytes);
+        }
+        
+        fprintf (fp, " }");
+    
+    }
+    
+    fprintf (fp, "\n] }\n");
+    
+    if (fclose (fp)) {
+        report_at (NULL, 0, REPORT_ERROR, "failed to write '%s'", state->trace);
+    }
+
+}
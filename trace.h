@@ -0,0 +1,17 @@
+/******************************************************************************
+ * @file            trace.h
+ *****************************************************************************/
+#ifndef     _TRACE_H
+#define     _TRACE_H
+
+#include    <stdio.h>
+
+void trace_file_begin (const char *filename);
+void trace_file_end (unsigned long lines, unsigned long bytes);
+void trace_phase_begin (const char *name);
+void trace_phase_end (void);
+void trace_print_stats (FILE *fp);
+void trace_print_stats_json (FILE *fp);
+void trace_write (void);
+
+#endif      /* _TRACE_H */
@@ -1,21 +1,293 @@
 /******************************************************************************
  * @file            write.c
  *****************************************************************************/
+#include    <stdio.h>
 #include    <stdlib.h>
 #include    <string.h>
 
 #include    "as.h"
+#include    "expr.h"
 #include    "fixup.h"
 #include    "frag.h"
 #include    "intel.h"
 #include    "lib.h"
 #include    "listing.h"
+#include    "parallel.h"
+#include    "relax_hints.h"
 #include    "report.h"
 #include    "section.h"
 #include    "stdint.h"
 #include    "symbol.h"
+#include    "trace.h"
 #include    "write.h"
 
+static FILE *object_file = NULL;
+static char *object_temp_filename = NULL;
+
+static unsigned long relax_passes = 0;
+static unsigned long relax_sections = 0;
+
+static int files_are_identical (const char *filename1, const char *filename2) {
+
+    static unsigned char buf1[4096], buf2[4096];
+    
+    FILE *f1, *f2;
+    int identical = 0;
+    
+    if ((f1 = fopen (filename1, "rb")) == NULL) {
+        return 0;
+    }
+    
+    if ((f2 = fopen (filename2, "rb")) == NULL) {
+    
+        fclose (f1);
+        return 0;
+    
+    }
+    
+    /* Sizes first, so a grown or shrunk object is never read. */
+    if (fseek (f1, 0, SEEK_END) == 0 && fseek (f2, 0, SEEK_END) == 0 && ftell (f1) == ftell (f2)) {
+    
+        size_t n1, n2;
+        
+        rewind (f1);
+        rewind (f2);
+        
+        for (;;) {
+        
+            n1 = fread (buf1, 1, sizeof (buf1), f1);
+            n2 = fread (buf2, 1, sizeof (buf2), f2);
+            
+            if (n1 != n2 || memcmp (buf1, buf2, n1) != 0) {
+                break;
+            }
+            
+            if (n1 < sizeof (buf1)) {
+            
+                identical = !ferror (f1) && !ferror (f2);
+                break;
+            
+            }
+        
+        }
+    
+    }
+    
+    fclose (f1);
+    fclose (f2);
+    
+    return identical;
+
+}
+
+static int file_exists (const char *filename) {
+
+    FILE *fp;
+    
+    if ((fp = fopen (filename, "rb")) == NULL) {
+        return 0;
+    }
+    
+    fclose (fp);
+    return 1;
+
+}
+
+/**
+ * Returns a name for the temporary object that no existing file has: the
+ * output name with ".tmp" appended, or on MSDOS, where the extension may
+ * only be three characters, with its last character replaced by '$'.  If
+ * that is taken, a digit takes the place of the last character.
+ */
+static char *make_temp_filename (const char *filename) {
+
+    unsigned long length = strlen (filename);
+    char *temp_filename = xmalloc (length + 5);
+    
+    char *last;
+    int digit;
+    
+    strcpy (temp_filename, filename);
+    
+#if     defined (__MSDOS__)
+    last = temp_filename + length - 1;
+    *last = '$';
+#else
+    strcat (temp_filename, ".tmp");
+    last = temp_filename + length + 3;
+#endif
+    
+    for (digit = '0'; file_exists (temp_filename); ++digit) {
+    
+        if (digit > '9') {
+        
+            report_at (NULL, 0, REPORT_ERROR, "Failed to find a free temporary name for '%s'", filename);
+            
+            free (temp_filename);
+            return NULL;
+        
+        }
+        
+        *last = digit;
+    
+    }
+    
+    return temp_filename;
+
+}
+
+/**
+ * With --write-if-changed the object is written next to the real one
+ * and only renamed over it when the bytes differ, so an unchanged object
+ * keeps its modification time.
+ */
+FILE *open_object_file (void) {
+
+    const char *filename = state->outfile;
+    
+    if (state->write_if_changed) {
+    
+        if ((object_temp_filename = make_temp_filename (state->outfile)) == NULL) {
+            return NULL;
+        }
+        
+        filename = object_temp_filename;
+    
+    }
+    
+    if ((object_file = fopen (filename, "wb")) == NULL) {
+    
+        report_at (NULL, 0, REPORT_ERROR, "Failed to open '%s' as output file", filename);
+        
+        free (object_temp_filename);
+        object_temp_filename = NULL;
+    
+    }
+    
+    return object_file;
+
+}
+
+int close_object_file (FILE *outfile) {
+
+    int ret = fclose (outfile);
+    object_file = NULL;
+    
+    if (object_temp_filename == NULL) {
+        return ret;
+    }
+    
+    if (ret == 0) {
+    
+        if (files_are_identical (object_temp_filename, state->outfile)) {
+            remove (object_temp_filename);
+        } else if (rename (object_temp_filename, state->outfile) != 0) {
+        
+            /* Some systems refuse to rename over an existing file. */
+            remove (state->outfile);
+            
+            if (rename (object_temp_filename, state->outfile) != 0) {
+            
+                report_at (NULL, 0, REPORT_ERROR, "Failed to rename '%s' to '%s'", object_temp_filename, state->outfile);
+                remove (object_temp_filename);
+            
+            }
+        
+        }
+    
+    } else {
+        remove (object_temp_filename);
+    }
+    
+    free (object_temp_filename);
+    object_temp_filename = NULL;
+    
+    return ret;
+
+}
+
+void object_blocks_add (struct object_blocks *blocks, const void *data, unsigned long size, const char *failure, const char *name) {
+
+    struct object_block *block;
+    
+    blocks->blocks = xrealloc (blocks->blocks, sizeof (*blocks->blocks) * (blocks->nb_blocks + 1));
+    block = &blocks->blocks[blocks->nb_blocks++];
+    
+    block->data = data;
+    block->offset = blocks->size;
+    block->size = size;
+    
+    block->failure = failure;
+    block->name = name;
+    
+    blocks->size += size;
+
+}
+
+void object_blocks_free (struct object_blocks *blocks) {
+
+    free (blocks->blocks);
+    memset (blocks, 0, sizeof (*blocks));
+
+}
+
+/**
+ * Writes the blocks to outfile, from several threads at their offsets if
+ * the build and -j allow it, otherwise one after the other.  Reports the
+ * first block that could not be written and returns 1 then.
+ */
+int object_blocks_write (struct object_blocks *blocks, FILE *outfile) {
+
+    const struct object_block *failed = NULL;
+    unsigned long i;
+    
+    if (!parallel_write_blocks (outfile, blocks->blocks, blocks->nb_blocks, &failed)) {
+    
+        for (i = 0; i < blocks->nb_blocks; ++i) {
+        
+            if (blocks->blocks[i].size && fwrite (blocks->blocks[i].data, blocks->blocks[i].size, 1, outfile) != 1) {
+            
+                failed = &blocks->blocks[i];
+                break;
+            
+            }
+        
+        }
+    
+    }
+    
+    if (failed) {
+    
+        report_at (NULL, 0, REPORT_ERROR, failed->failure, failed->name);
+        return 1;
+    
+    }
+    
+    return 0;
+
+}
+
+/** Cleans up after a writer that gave up with the object file still open. */
+static void discard_object_file (void) {
+
+    if (object_file == NULL) {
+        return;
+    }
+    
+    fclose (object_file);
+    object_file = NULL;
+    
+    if (object_temp_filename) {
+    
+        remove (object_temp_filename);
+        
+        free (object_temp_filename);
+        object_temp_filename = NULL;
+    
+    }
+
+}
+
 static unsigned long relax_align (unsigned long address, unsigned long alignment) {
 
     unsigned long mask, new_address;
@@ -27,19 +299,19 @@ static unsigned long relax_align (unsigned long address, unsigned long alignment
 
 }
 
-static void relax_section (section_t section) {
+/**
+ * Gives every frag its address with each variant part at its current
+ * size and returns the number of frags.  Calls are only given room for
+ * their far address on the first layout, as the frags are laid out again
+ * when relaxation started from hints has to be redone.
+ */
+static unsigned long layout_frags (struct frag *root_frag, section_t section, int first) {
 
-    struct frag *root_frag, *frag;
-    unsigned long address, frag_count, max_iterations;
+    struct frag *frag;
+    unsigned long address, frag_count;
     unsigned long alignment_needed;
     
-    long change;
-    int changed;
-    
-    section_set (section);
-    
-    root_frag = current_frag_chain->first_frag;
-    address   = 0;
+    address = 0;
     
     for (frag_count = 0, frag = root_frag; frag; frag_count++, frag = frag->next) {
     
@@ -58,17 +330,17 @@ static void relax_section (section_t section) {
             case RELAX_TYPE_ALIGN_CODE:
             
                 alignment_needed = relax_align (address, frag->offset);
-
+                
                 if (frag->relax_subtype != 0 && alignment_needed > frag->relax_subtype) {
                     alignment_needed = 0;
                 }
-
+                
                 address += alignment_needed;
                 break;
             
             case RELAX_TYPE_CALL: {
             
-                if (frag->symbol) {
+                if (frag->symbol && first) {
                 
                     unsigned long old_frag_fixed_size = frag->fixed_size;
                     
@@ -100,6 +372,18 @@ static void relax_section (section_t section) {
     
     }
     
+    return frag_count;
+
+}
+
+static void relax_frags (struct frag *root_frag, section_t section, unsigned long frag_count) {
+
+    struct frag *frag;
+    unsigned long max_iterations;
+    
+    long change;
+    int changed;
+    
     /**
      * Prevents an infinite loop caused by frag growing because of a symbol that moves when the frag grows.
      *
@@ -120,6 +404,10 @@ static void relax_section (section_t section) {
         change = 0;
         changed = 0;
         
+        parallel_lock ();
+        relax_passes++;
+        parallel_unlock ();
+        
         for (frag = root_frag; frag; frag = frag->next) {
         
             long growth = 0;
@@ -147,7 +435,7 @@ static void relax_section (section_t section) {
                     new_offset = relax_align (frag->address + frag->fixed_size, frag->offset);
                     
                     if (frag->relax_subtype != 0) {
-
+                    
                         if (old_offset > frag->relax_subtype) {
                             old_offset = 0;
                         }
@@ -155,8 +443,8 @@ static void relax_section (section_t section) {
                             new_offset = 0;
                         }
                     }
-
-                        
+                    
+                    
                     growth = new_offset - old_offset;
                     break;
                 
@@ -171,10 +459,10 @@ static void relax_section (section_t section) {
                         if (frag->far_call > 0) {
                         
                             frag->far_call--;
-                            fixup_new (frag, frag->opcode_offset_in_buf, 4, frag->symbol, frag->offset, 0, RELOC_TYPE_CALL, 1);
+                            fixup_new_in_section (section, frag, frag->opcode_offset_in_buf, 4, frag->symbol, frag->offset, 0, RELOC_TYPE_CALL, 1);
                         
                         } else {
-                            fixup_new (frag, frag->opcode_offset_in_buf, 4, frag->symbol, frag->offset, 0, RELOC_TYPE_CALL, state->model >= 4 && state->model < 7);
+                            fixup_new_in_section (section, frag, frag->opcode_offset_in_buf, 4, frag->symbol, frag->offset, 0, RELOC_TYPE_CALL, state->model >= 4 && state->model < 7);
                         }
                     
                     }
@@ -269,12 +557,192 @@ static void relax_section (section_t section) {
 
 }
 
+/**
+ * Machine dependent frags of a section being relaxed from hints: the
+ * identity of each, the subtype it started with before seeding and the
+ * subtype the hint asked for.
+ */
+struct relax_record {
+
+    struct frag *frag;
+    char *identity;
+    
+    relax_subtype_t initial_subtype, hinted_subtype;
+
+};
+
+static struct relax_record *seed_frags (struct frag *root_frag, section_t section, unsigned long *nb_records_p, unsigned long *nb_applied_p) {
+
+    struct relax_record *records;
+    struct frag *frag;
+    
+    unsigned long nb_records = 0;
+    
+    for (frag = root_frag; frag; frag = frag->next) {
+    
+        if (frag->relax_type == RELAX_TYPE_MACHINE_DEPENDENT) {
+            nb_records++;
+        }
+    
+    }
+    
+    records = xmalloc (sizeof (*records) * (nb_records + 1));
+    nb_records = 0;
+    
+    for (frag = root_frag; frag; frag = frag->next) {
+    
+        struct relax_record *record;
+        relax_subtype_t subtype;
+        
+        if (frag->relax_type != RELAX_TYPE_MACHINE_DEPENDENT) {
+            continue;
+        }
+        
+        record = &records[nb_records++];
+        record->frag = frag;
+        record->identity = relax_hints_identify (frag);
+        record->initial_subtype = record->hinted_subtype = frag->relax_subtype;
+        
+        if (symbol_get_section (frag->symbol) == section && relax_hints_find (record->identity, &subtype) && machine_dependent_relax_frag_seed (frag, subtype)) {
+        
+            record->hinted_subtype = subtype;
+            relax_hints_note_applied ();
+            
+            (*nb_applied_p)++;
+        
+        }
+    
+    }
+    
+    *nb_records_p = nb_records;
+    return records;
+
+}
+
+/**
+ * Checks the seeded layout with one pass: every hinted jump is sized
+ * again from its shortest form against the seeded addresses.  The jumps
+ * that come out a different size go back to the shortest form and are
+ * relaxed like any other; the rest keep their hints.  Returns the number
+ * of jumps sent back.
+ */
+static unsigned long verify_seeded_frags (struct relax_record *records, unsigned long nb_records, section_t section) {
+
+    unsigned long nb_reset = 0, i;
+    
+    for (i = 0; i < nb_records; ++i) {
+    
+        struct frag *frag = records[i].frag;
+        
+        if (records[i].hinted_subtype == records[i].initial_subtype) {
+            continue;
+        }
+        
+        frag->relax_subtype = records[i].initial_subtype;
+        machine_dependent_relax_frag (frag, section, 0);
+        
+        if (frag->relax_subtype == records[i].hinted_subtype) {
+            continue;
+        }
+        
+        frag->relax_subtype = records[i].initial_subtype;
+        nb_reset++;
+    
+    }
+    
+    return nb_reset;
+
+}
+
+static void relax_section (section_t section) {
+
+    struct frag *root_frag = section_get_frag_chain (section)->first_frag;
+    struct relax_record *records = NULL;
+    
+    unsigned long frag_count, nb_records = 0, nb_applied = 0, i;
+    
+    parallel_lock ();
+    relax_sections++;
+    parallel_unlock ();
+    
+    if (state->relax_hints) {
+        records = seed_frags (root_frag, section, &nb_records, &nb_applied);
+    }
+    
+    frag_count = layout_frags (root_frag, section, 1);
+    
+    if (nb_applied && verify_seeded_frags (records, nb_records, section)) {
+        layout_frags (root_frag, section, 0);
+    }
+    
+    relax_frags (root_frag, section, frag_count);
+    
+    if (!records) {
+        return;
+    }
+    
+    for (i = 0; i < nb_records; ++i) {
+    
+        struct frag *frag = records[i].frag;
+        
+        if (records[i].hinted_subtype != records[i].initial_subtype && (frag->relax_type != RELAX_TYPE_MACHINE_DEPENDENT || frag->relax_subtype != records[i].hinted_subtype)) {
+            relax_hints_note_adjusted ();
+        }
+        
+        if (frag->relax_type == RELAX_TYPE_MACHINE_DEPENDENT && frag->relax_subtype != records[i].initial_subtype) {
+            relax_hints_add (records[i].identity, frag->relax_subtype);
+        } else {
+            free (records[i].identity);
+        }
+    
+    }
+    
+    free (records);
+
+}
+
+/**
+ * Sections can be relaxed side by side only if relaxing one never reads
+ * an address in another: every jump kept in a section must be to a plain
+ * label of that section (jumps elsewhere become fixups without reading
+ * the target), and no .org or .space may depend on a symbol.
+ */
+static int sections_relax_independently (void) {
+
+    section_t section;
+    struct frag *frag;
+    
+    for (section = sections; section; section = section_get_next_section (section)) {
+    
+        for (frag = section_get_frag_chain (section)->first_frag; frag; frag = frag->next) {
+        
+            if ((frag->relax_type == RELAX_TYPE_ORG || frag->relax_type == RELAX_TYPE_SPACE) && frag->symbol) {
+                return 0;
+            }
+            
+            if (frag->relax_type == RELAX_TYPE_MACHINE_DEPENDENT && symbol_get_section (frag->symbol) == section) {
+            
+                int type = symbol_get_value_expression (frag->symbol)->type;
+                
+                if (type != EXPR_TYPE_ABSENT && type != EXPR_TYPE_CONSTANT) {
+                    return 0;
+                }
+            
+            }
+        
+        }
+    
+    }
+    
+    return 1;
+
+}
+
 static void finish_frags_after_relaxation (section_t section) {
 
     struct frag *root_frag, *frag;
     
-    section_set (section);
-    root_frag = current_frag_chain->first_frag;
+    root_frag = section_get_frag_chain (section)->first_frag;
     
     for (frag = root_frag; frag; frag = frag->next) {
     
@@ -302,6 +770,15 @@ static void finish_frags_after_relaxation (section_t section) {
                 }
                 
                 p = finished_frag_increase_fixed_size_by_frag_offset (frag);
+                
+                /* Code alignment is padded with one-byte nops unless -O asks for the multi-byte forms. */
+                if (frag->relax_type == RELAX_TYPE_ALIGN_CODE && state->optimize) {
+                
+                    machine_dependent_fill_code_alignment (frag, p, frag->offset);
+                    break;
+                
+                }
+                
                 fill = *p;
                 
                 for (i = 0; i < frag->offset; i++) {
@@ -351,10 +828,13 @@ static void finish_frags_after_relaxation (section_t section) {
 
 static void adjust_reloc_symbols_of_section (section_t section) {
 
+    struct frag_chain *frag_chain = section_get_frag_chain (section);
     struct fixup *fixup;
-    section_set (section);
     
-    for (fixup = current_frag_chain->first_fixup; fixup; fixup = fixup->next) {
+    /* Addresses are final now, so later passes and the writers see the fixups in address order. */
+    fixups_sort_by_address (frag_chain);
+    
+    for (fixup = frag_chain->fixups; fixup < frag_chain->fixups + frag_chain->nb_fixups; fixup++) {
     
         if (fixup->done) { continue; }
         
@@ -362,6 +842,8 @@ static void adjust_reloc_symbols_of_section (section_t section) {
         
             struct symbol *symbol = fixup->add_symbol;
             
+            parallel_lock ();
+            
             /* Resolves symbols that have not been resolved yet (expression symbols). */
             symbol_resolve_value (symbol);
             
@@ -374,16 +856,14 @@ static void adjust_reloc_symbols_of_section (section_t section) {
             
             }
             
-            if (symbol_force_reloc (symbol)) {
-                continue;
-            }
+            if (!symbol_force_reloc (symbol) && symbol_get_section (symbol) != absolute_section) {
+            
+                fixup->add_number += symbol_get_value (symbol);
+                fixup->add_symbol  = section_symbol (symbol_get_section (symbol));
             
-            if (symbol_get_section (symbol) == absolute_section) {
-                continue;
             }
             
-            fixup->add_number += symbol_get_value (symbol);
-            fixup->add_symbol  = section_symbol (symbol_get_section (symbol));
+            parallel_unlock ();
         
         }
     
@@ -396,14 +876,23 @@ static unsigned long fixup_section (section_t section) {
     struct fixup *fixup;
     section_t add_symbol_section;
     
+    struct frag_chain *frag_chain = section_get_frag_chain (section);
     unsigned long add_number, section_reloc_count = 0;
-    section_set (section);
     
-    for (fixup = current_frag_chain->first_fixup; fixup; fixup = fixup->next) {
+    int locked;
+    
+    for (fixup = frag_chain->fixups; fixup < frag_chain->fixups + frag_chain->nb_fixups; fixup++) {
     
         if (fixup->done) { continue; }
         add_number = fixup->add_number;
         
+        /* Fixups against symbols read them while other sections may be resolving them. */
+        locked = (fixup->add_symbol != NULL);
+        
+        if (locked) {
+            parallel_lock ();
+        }
+        
         if (fixup->add_symbol) {
         
             add_symbol_section = symbol_get_section (fixup->add_symbol);
@@ -438,6 +927,11 @@ static unsigned long fixup_section (section_t section) {
         }
         
         machine_dependent_apply_fixup (fixup, add_number);
+        
+        if (locked) {
+            parallel_unlock ();
+        }
+        
         if (fixup->done == 0) { section_reloc_count++; }
     
     }
@@ -446,27 +940,277 @@ static unsigned long fixup_section (section_t section) {
 
 }
 
-void write_object_file (struct object_format *obj_fmt) {
+static void fixup_section_phase (section_t section) {
+    fixup_section (section);
+}
+
+static void compact_section (section_t section) {
+
+    if (section != bss_section) {
+        frag_chain_compact (section_get_frag_chain (section));
+    }
+
+}
+
+/**
+ * Statistics count as the phases go and memory peaks depend on the order
+ * of allocations, so the per-section phases only run side by side when
+ * no statistics are gathered.
+ */
+static int phases_run_concurrently (void) {
+    return !state->stats && !state->stats_json;
+}
+
+/**
+ * Everything a format specific pass changes after relaxation: the frag
+ * addresses (a.out places data and bss after text), the fixups and the
+ * bytes the fixups are applied to.
+ */
+struct section_state {
+
+    address_t *addresses;
+    unsigned long nb_frags;
+    
+    unsigned char *image;
+    unsigned long image_size;
+    
+    struct fixup *fixups;
+    unsigned long nb_fixups;
+
+};
+
+static struct section_state *saved_sections = NULL;
+
+static void save_sections_state (void) {
+
+    struct section_state *saved;
+    section_t section;
+    
+    saved_sections = xmalloc (sizeof (*saved_sections) * sections_get_count ());
+    
+    for (section = sections, saved = saved_sections; section; section = section_get_next_section (section), saved++) {
+    
+        struct frag_chain *frag_chain = section_get_frag_chain (section);
+        struct frag *frag;
+        
+        unsigned long nb_frags = 0;
+        
+        for (frag = frag_chain->first_frag; frag; frag = frag->next) {
+            nb_frags++;
+        }
+        
+        saved->addresses = xmalloc_for (MEM_FRAGS, sizeof (*saved->addresses) * nb_frags);
+        saved->nb_frags = nb_frags;
+        
+        for (frag = frag_chain->first_frag, nb_frags = 0; frag; frag = frag->next) {
+            saved->addresses[nb_frags++] = frag->address;
+        }
+        
+        if (frag_chain->image) {
+        
+            saved->image = xmalloc_for (MEM_FRAG_BUFFERS, frag_chain->image_size);
+            saved->image_size = frag_chain->image_size;
+            
+            memcpy (saved->image, frag_chain->image, frag_chain->image_size);
+        
+        }
+        
+        saved->nb_fixups = frag_chain->nb_fixups;
+        
+        if (saved->nb_fixups) {
+        
+            saved->fixups = xmalloc_for (MEM_FIXUPS, sizeof (*saved->fixups) * saved->nb_fixups);
+            memcpy (saved->fixups, frag_chain->fixups, sizeof (*saved->fixups) * saved->nb_fixups);
+        
+        }
+    
+    }
+
+}
+
+static void restore_sections_state (void) {
+
+    struct section_state *saved;
+    section_t section;
+    
+    for (section = sections, saved = saved_sections; section; section = section_get_next_section (section), saved++) {
+    
+        struct frag_chain *frag_chain = section_get_frag_chain (section);
+        struct frag *frag;
+        
+        unsigned long i = 0;
+        
+        for (frag = frag_chain->first_frag; frag; frag = frag->next) {
+            frag->address = saved->addresses[i++];
+        }
+        
+        if (saved->image) {
+            memcpy (frag_chain->image, saved->image, frag_chain->image_size);
+        }
+        
+        frag_chain->nb_fixups = saved->nb_fixups;
+        
+        if (saved->nb_fixups) {
+            memcpy (frag_chain->fixups, saved->fixups, sizeof (*saved->fixups) * saved->nb_fixups);
+        }
+    
+    }
+
+}
+
+static void free_sections_state (void) {
+
+    unsigned long i, count = sections_get_count ();
+    
+    for (i = 0; i < count; ++i) {
+    
+        struct section_state *saved = &saved_sections[i];
+        
+        mem_account (MEM_FRAGS, 0, sizeof (*saved->addresses) * saved->nb_frags);
+        mem_account (MEM_FRAG_BUFFERS, 0, saved->image_size);
+        mem_account (MEM_FIXUPS, 0, sizeof (*saved->fixups) * saved->nb_fixups);
+        
+        free (saved->addresses);
+        free (saved->image);
+        free (saved->fixups);
+    
+    }
+    
+    free (saved_sections);
+    saved_sections = NULL;
+
+}
+
+static void write_output (struct object_format *obj_fmt) {
 
     struct symbol *symbol;
+    
+    if (obj_fmt->adjust_code) {
+        (obj_fmt->adjust_code) ();
+    }
+    
+    finalize_symbols = 1;
+    
+    for (symbol = symbols; symbol; symbol = symbol_next (symbol)) {
+        symbol_resolve_value (symbol);
+    }
+    
+    parallel_for_each_section (&adjust_reloc_symbols_of_section, phases_run_concurrently ());
+    parallel_for_each_section (&fixup_section_phase, phases_run_concurrently ());
+    
+    if (obj_fmt->write_object) {
+        (obj_fmt->write_object) ();
+    }
+
+}
+
+static unsigned long section_bytes (section_t section) {
+
+    struct frag *frag;
+    unsigned long bytes = 0;
+    
+    for (frag = section_get_frag_chain (section)->first_frag; frag; frag = frag->next) {
+        bytes += frag->fixed_size;
+    }
+    
+    return bytes;
+
+}
+
+void write_print_stats (FILE *fp) {
+
     section_t section;
-    value_t val = 0;
     
-    sections_chain_subsection_frags ();
+    fprintf (fp, "relaxation: %lu passes over %lu sections\n", relax_passes, relax_sections);
+    relax_hints_print_stats (fp);
     
     for (section = sections; section; section = section_get_next_section (section)) {
-        relax_section (section);
+        fprintf (fp, "section %s: %lu bytes\n", section_get_name (section), section_bytes (section));
     }
+
+}
+
+void write_print_stats_json (FILE *fp) {
+
+    section_t section;
+    
+    fprintf (fp, ",\n    \"relaxation\": { \"passes\": %lu, \"sections\": %lu }", relax_passes, relax_sections);
+    relax_hints_print_stats_json (fp);
+    
+    fprintf (fp, ",\n    \"sections\": [");
     
     for (section = sections; section; section = section_get_next_section (section)) {
-        finish_frags_after_relaxation (section);
+    
+        fprintf (fp, "%s\n        { \"name\": ", (section == sections) ? "" : ",");
+        print_json_string (fp, section_get_name (section));
+        fprintf (fp, ", \"bytes\": %lu }", section_bytes (section));
+    
     }
     
+    fprintf (fp, "%s]", sections ? "\n    " : "");
+
+}
+
+/**
+ * The sources were parsed with the pseudo-ops of the first format only,
+ * so a further output may be in a format that cannot hold every section
+ * they created.  Reports each such section; nothing is written then.
+ */
+static int outputs_support_sections (void) {
+
+    section_t section;
+    
+    unsigned long i;
+    int ok = 1;
+    
+    for (i = 0; i < state->nb_outputs; ++i) {
+    
+        struct output *output = state->outputs[i];
+        
+        if (!output->obj_fmt->supports_section) {
+            continue;
+        }
+        
+        for (section = sections; section; section = section_get_next_section (section)) {
+        
+            if (!output->obj_fmt->supports_section (section)) {
+            
+                report_at (output->filename, 0, REPORT_ERROR, "section '%s' cannot be written in %s format", section_get_name (section), output->obj_fmt->name);
+                ok = 0;
+            
+            }
+        
+        }
+    
+    }
+    
+    return ok;
+
+}
+
+void write_object_file (void) {
+
+    unsigned long i;
+    value_t val = 0;
+    
+    trace_phase_begin ("relaxation");
+    
+    sections_chain_subsection_frags ();
+    relax_hints_load ();
+    
+    /* Hints are looked up and collected in section order, so they keep relaxation serial. */
+    parallel_for_each_section (&relax_section, phases_run_concurrently () && !state->relax_hints && sections_relax_independently ());
+    relax_hints_save ();
+    
+    parallel_for_each_section (&finish_frags_after_relaxation, phases_run_concurrently ());
+    
+    trace_phase_end ();
+    
     if (state->end_sym) {
     
         struct symbol *symbol;
         
-        for (symbol = symbols; symbol; symbol = symbol->next) {
+        for (symbol = symbols; symbol; symbol = symbol_next (symbol)) {
         
             if (!symbol_is_undefined (symbol) && symbol_get_section (symbol) != absolute_section) {
             
@@ -517,26 +1261,50 @@ void write_object_file (struct object_format *obj_fmt) {
     
     }
     
-    if (obj_fmt->adjust_code) {
-        (obj_fmt->adjust_code) ();
-    }
+    /* Frag sizes are final, so each section's bytes are gathered into one image that the fixups patch and the writers output. */
+    parallel_for_each_section (&compact_section, phases_run_concurrently ());
     
-    finalize_symbols = 1;
-
-    for (symbol = symbols; symbol; symbol = symbol->next) {
-        symbol_resolve_value (symbol);
+    if (!outputs_support_sections ()) {
+        return;
     }
     
-    for (section = sections; section; section = section_get_next_section (section)) {
-        adjust_reloc_symbols_of_section (section);
+    /**
+     * Parsing, encoding and relaxation are shared by all outputs; each
+     * further output starts again from the state left after relaxation.
+     */
+    if (state->nb_outputs > 1) {
+    
+        save_sections_state ();
+        symbols_save_state ();
+    
     }
     
-    for (section = sections; section; section = section_get_next_section (section)) {
-        fixup_section (section);
+    for (i = 0; i < state->nb_outputs; ++i) {
+    
+        if (i > 0) {
+        
+            restore_sections_state ();
+            symbols_restore_state ();
+        
+        }
+        
+        state->format = state->outputs[i]->format;
+        state->outfile = state->outputs[i]->filename;
+        
+        trace_phase_begin ("writing");
+        
+        write_output (state->outputs[i]->obj_fmt);
+        discard_object_file ();
+        
+        trace_phase_end ();
+    
     }
     
-    if (obj_fmt->write_object) {
-        (obj_fmt->write_object) ();
+    if (state->nb_outputs > 1) {
+    
+        free_sections_state ();
+        symbols_free_state ();
+    
     }
 
 }
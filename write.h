@@ -4,8 +4,39 @@
 #ifndef     _WRITE_H
 #define     _WRITE_H
 
-#include    "as.h"
+#include    <stdio.h>
 
-void write_object_file (struct object_format *obj_fmt);
+/**
+ * Writers lay the object file out as blocks, each placed right after the
+ * previous one, and write them once every offset is known.  failure is
+ * the message reported if the block cannot be written, with name filled
+ * in for its %s.
+ */
+struct object_block {
+
+    const void *data;
+    unsigned long offset, size;
+    
+    const char *failure, *name;
+
+};
+
+struct object_blocks {
+
+    struct object_block *blocks;
+    unsigned long nb_blocks, size;
+
+};
+
+FILE *open_object_file (void);
+int close_object_file (FILE *outfile);
+
+void object_blocks_add (struct object_blocks *blocks, const void *data, unsigned long size, const char *failure, const char *name);
+void object_blocks_free (struct object_blocks *blocks);
+int object_blocks_write (struct object_blocks *blocks, FILE *outfile);
+
+void write_object_file (void);
+void write_print_stats (FILE *fp);
+void write_print_stats_json (FILE *fp);
 
 #endif      /* _WRITE_H */